@@ -11,17 +11,40 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    alloc_profiler.cpp \
+    channel.cpp \
     cpputilities.cpp \
+    crash_report.cpp \
     debuging.cpp \
+    event_bus.cpp \
+    flight_recorder.cpp \
+    lock_profiler.cpp \
+    profiler.cpp \
+    signals_shm.cpp \
     signals_slots.cpp \
-    threading.cpp
+    symbolizer.cpp \
+    threading.cpp \
+    tracer.cpp
 
 HEADERS += \
+    alloc_profiler.h \
+    channel.h \
     cpputilities.h \
     cpputilities_global.h \
+    crash_report.h \
     debuging.h \
+    event_bus.h \
+    flight_recorder.h \
+    lock_profiler.h \
+    profiler.h \
+    signals_shm.h \
     signals_slots.h \
-    threading.h
+    slot_map.h \
+    symbolizer.h \
+    threading.h \
+    tracer.h
+
+LIBS += -lrt
 
 # Default rules for deployment.
 unix {
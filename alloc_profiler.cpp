@@ -0,0 +1,597 @@
+#include "alloc_profiler.h"
+#include "symbolizer.h"
+
+#include <new>
+#include <map>
+#include <vector>
+#include <tuple>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace CppUtilities {
+
+thread_local uint32_t AllocScope::current = 0;
+
+static std::mutex labels_mtx;
+static std::unordered_map<std::string, uint32_t> &label_ids = *new std::unordered_map<std::string, uint32_t>;
+static std::vector<std::string> &label_names = *new std::vector<std::string> {""};
+
+uint32_t AllocProfiler::intern(const std::string &name)
+{
+    labels_mtx.lock();
+    auto it = label_ids.find(name);
+    uint32_t id;
+    if (it != label_ids.end()) {
+        id = it->second;
+    } else {
+        id = uint32_t(label_names.size());
+        label_names.push_back(name);
+        label_ids.emplace(name, id);
+    }
+    labels_mtx.unlock();
+    return id;
+}
+
+std::string AllocProfiler::label(uint32_t id)
+{
+    labels_mtx.lock();
+    std::string name = id < label_names.size() ? label_names[id] : "";
+    labels_mtx.unlock();
+    return name;
+}
+
+AllocProfiler *AllocProfiler::get()
+{
+    static AllocProfiler *inst = new AllocProfiler;
+    return inst;
+}
+
+#ifdef ALLOC_PROFILING
+
+//Written by its thread only: a load and a store, no locked instruction.
+struct Counter {
+    std::atomic<uint64_t> v = {0};
+    inline void add(uint64_t n) {v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);};
+    inline uint64_t get() const {return v.load(std::memory_order_relaxed);};
+    inline void reset() {v.store(0, std::memory_order_relaxed);};
+};
+
+struct Totals {
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint64_t bytes = 0;
+    uint64_t freed = 0;
+};
+
+struct ThreadRecord {
+    static const int SCOPES = 64; //The last one takes what does not fit.
+    static const int SAMPLES = 128;
+
+    struct Scope {
+        std::atomic<uint32_t> label = {0};
+        Counter allocs;
+        Counter bytes;
+    };
+    struct Sample {
+        uint64_t size;
+        uint64_t weight; //Bytes it stands for.
+        uint32_t scope;
+        int depth;
+        void *pcs[StackTrace::MAX_FRAMES];
+    };
+
+    ThreadRecord *next = nullptr;
+    std::atomic<bool> used = {false};
+    std::atomic<uint32_t> label = {0};
+    pid_t tid = 0;
+
+    Counter allocs;
+    Counter frees;
+    Counter bytes;
+    Counter freed;
+    Counter sizes[AllocProfiler::SIZE_CLASSES];
+    Scope scopes[SCOPES];
+
+    int64_t until_sample = 0;
+    uint64_t rng = 0;
+    Sample samples[SAMPLES];
+    std::atomic<size_t> head = {0};
+    std::atomic<size_t> tail = {0};
+};
+
+static std::atomic<bool> alloc_active = {false};
+static std::atomic<size_t> sample_bytes = {0};
+static std::atomic<uint32_t> other_scopes = {0};
+static std::mutex records_mtx;
+static ThreadRecord *records = nullptr;
+//Ended threads' counts, by thread label, once their records are taken by new threads.
+static std::map<uint32_t, Totals> &retired_threads = *new std::map<uint32_t, Totals>;
+static std::map<uint32_t, Totals> &retired_scopes = *new std::map<uint32_t, Totals>;
+static uint64_t retired_sizes[AllocProfiler::SIZE_CLASSES] = {};
+//Sampled stacks: (thread label, scope label, pcs) -> (samples, bytes).
+static std::map<std::tuple<uint32_t, uint32_t, std::vector<void *>>, std::pair<uint64_t, uint64_t>> &stacks
+    = *new std::map<std::tuple<uint32_t, uint32_t, std::vector<void *>>, std::pair<uint64_t, uint64_t>>;
+
+static ThreadRecord *const THREAD_ENDED = reinterpret_cast<ThreadRecord *>(1);
+static thread_local ThreadRecord *tls_record __attribute__((tls_model("initial-exec"))) = nullptr;
+//Set while the profiler itself runs on the thread: what it allocates is not counted.
+static thread_local bool tls_busy __attribute__((tls_model("initial-exec"))) = false;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+
+static inline int size_class(size_t size)
+{
+    if (size <= 8) {
+        return 0;
+    }
+    int c = 64 - __builtin_clzll(uint64_t(size - 1)) - 3;
+    return c < AllocProfiler::SIZE_CLASSES - 1 ? c : AllocProfiler::SIZE_CLASSES - 1;
+}
+
+//Exponential intervals: each byte has the same chance to be sampled, whatever the size of its allocation.
+static inline int64_t next_sample(ThreadRecord *r)
+{
+    r->rng ^= r->rng << 13;
+    r->rng ^= r->rng >> 7;
+    r->rng ^= r->rng << 17;
+    double u = double((r->rng >> 11) + 1) / double(1ull << 53);
+    //Without stacks, sample() only comes back here once in a while, to see if they were asked for since.
+    size_t mean = sample_bytes.load(std::memory_order_relaxed);
+    return int64_t(-std::log(u) * double(mean ? mean : 1 << 20)) + 1;
+}
+
+static void drain_locked(ThreadRecord *r)
+{
+    size_t h = r->head.load(std::memory_order_relaxed);
+    size_t t = r->tail.load(std::memory_order_acquire);
+    for (; h != t; h++) {
+        ThreadRecord::Sample &s = r->samples[h % ThreadRecord::SAMPLES];
+        std::pair<uint64_t, uint64_t> &e = stacks[std::make_tuple(r->label.load(), s.scope, std::vector<void *>(s.pcs, s.pcs + s.depth))];
+        e.first++;
+        e.second += s.weight;
+    }
+    r->head.store(h, std::memory_order_release);
+}
+
+static void fold_locked(ThreadRecord *r)
+{
+    drain_locked(r);
+    Totals &t = retired_threads[r->label.load()];
+    t.allocs += r->allocs.get();
+    t.frees += r->frees.get();
+    t.bytes += r->bytes.get();
+    t.freed += r->freed.get();
+    for (int i = 0; i < AllocProfiler::SIZE_CLASSES; i++) {
+        retired_sizes[i] += r->sizes[i].get();
+    }
+    for (ThreadRecord::Scope &s : r->scopes) {
+        if (uint32_t l = s.label.load()) {
+            retired_scopes[l].allocs += s.allocs.get();
+            retired_scopes[l].bytes += s.bytes.get();
+        }
+    }
+}
+
+static void reset(ThreadRecord *r)
+{
+    r->allocs.reset();
+    r->frees.reset();
+    r->bytes.reset();
+    r->freed.reset();
+    for (Counter &c : r->sizes) {
+        c.reset();
+    }
+    for (ThreadRecord::Scope &s : r->scopes) {
+        s.label.store(0, std::memory_order_relaxed);
+        s.allocs.reset();
+        s.bytes.reset();
+    }
+    r->scopes[ThreadRecord::SCOPES - 1].label.store(other_scopes.load(), std::memory_order_relaxed);
+}
+
+//pthread key destructor: the record goes back to the pool, whatever the thread allocates after is not counted.
+static void thread_ended(void *p)
+{
+    ThreadRecord *r = static_cast<ThreadRecord *>(p);
+    tls_record = THREAD_ENDED;
+    r->used.store(false, std::memory_order_release);
+}
+
+//First allocation of a thread: takes the record of an ended thread, or a new one. Never freed.
+static ThreadRecord *claim()
+{
+    tls_busy = true;
+    records_mtx.lock();
+    ThreadRecord *r = records;
+    while (r && r->used.load(std::memory_order_acquire)) {
+        r = r->next;
+    }
+    if (r) {
+        fold_locked(r);
+    } else {
+        r = new (malloc(sizeof(ThreadRecord))) ThreadRecord;
+        r->next = records;
+        records = r;
+    }
+    reset(r);
+    r->used.store(true, std::memory_order_relaxed);
+    r->label.store(0, std::memory_order_relaxed);
+    r->tid = pid_t(syscall(SYS_gettid));
+    r->rng = uint64_t(r->tid) * 0x9E3779B97F4A7C15ull | 1;
+    r->until_sample = next_sample(r);
+    records_mtx.unlock();
+
+    pthread_once(&record_key_once, []() {pthread_key_create(&record_key, thread_ended);});
+    pthread_setspecific(record_key, r);
+    tls_record = r;
+    tls_busy = false;
+    return r;
+}
+
+static inline ThreadRecord *current_record()
+{
+    ThreadRecord *r = tls_record;
+    if (__builtin_expect(r == nullptr, 0)) {
+        return tls_busy ? nullptr : claim();
+    }
+    return r == THREAD_ENDED || tls_busy ? nullptr : r;
+}
+
+//caller: the return address of the operator new, the stack starts at it whatever was inlined or tail called.
+__attribute__((noinline)) static void sample(ThreadRecord *r, size_t size, uint32_t scope, void *caller)
+{
+    tls_busy = true;
+    size_t t = r->tail.load(std::memory_order_relaxed);
+    size_t mean = sample_bytes.load(std::memory_order_relaxed);
+    if (mean && t - r->head.load(std::memory_order_acquire) < ThreadRecord::SAMPLES) {
+        ThreadRecord::Sample &s = r->samples[t % ThreadRecord::SAMPLES];
+        void *pcs[StackTrace::MAX_FRAMES + 8];
+        int n = StackTrace::capture(pcs, StackTrace::MAX_FRAMES + 8);
+        int first = 0;
+        while (first < n && pcs[first] != caller) {
+            first++;
+        }
+        if (first == n) {
+            first = 0;
+        }
+        s.depth = std::min(n - first, int(StackTrace::MAX_FRAMES));
+        std::copy(pcs + first, pcs + first + s.depth, s.pcs);
+        //A small allocation is sampled less often than one every sample_bytes: it stands for more than its size.
+        s.weight = uint64_t(double(size) / -std::expm1(-double(size) / double(mean)));
+        s.size = size;
+        s.scope = scope;
+        r->tail.store(t + 1, std::memory_order_release);
+    }
+    r->until_sample = next_sample(r);
+    tls_busy = false;
+}
+
+//Open addressing over the first SCOPES - 1 slots, the last one is "other scopes".
+static inline ThreadRecord::Scope &scope_slot(ThreadRecord *r, uint32_t scope)
+{
+    const uint32_t n = ThreadRecord::SCOPES - 1;
+    uint32_t i = (scope * 0x9E3779B1u) % n;
+    for (uint32_t probes = 0; probes < n; probes++, i = i + 1 == n ? 0 : i + 1) {
+        uint32_t l = r->scopes[i].label.load(std::memory_order_relaxed);
+        if (l == scope) {
+            return r->scopes[i];
+        } else if (l == 0) {
+            r->scopes[i].label.store(scope, std::memory_order_relaxed);
+            return r->scopes[i];
+        }
+    }
+    return r->scopes[n];
+}
+
+static inline void record_alloc(void *p, size_t size, void *caller)
+{
+    ThreadRecord *r = current_record();
+    if (!r || !p) {
+        return;
+    }
+    size_t usable = malloc_usable_size(p);
+    r->allocs.add(1);
+    r->bytes.add(usable);
+    r->sizes[size_class(size)].add(1);
+    if (uint32_t scope = AllocScope::current) {
+        ThreadRecord::Scope &s = scope_slot(r, scope);
+        s.allocs.add(1);
+        s.bytes.add(usable);
+    }
+    r->until_sample -= int64_t(size);
+    if (__builtin_expect(r->until_sample < 0, 0)) {
+        sample(r, size, AllocScope::current, caller);
+    }
+}
+
+static inline void record_free(void *p)
+{
+    ThreadRecord *r = current_record();
+    if (!r || !p) {
+        return;
+    }
+    r->frees.add(1);
+    r->freed.add(malloc_usable_size(p));
+}
+
+static void *allocate(size_t size, bool nothrow, void *caller)
+{
+    void *p;
+    while (!(p = malloc(size ? size : 1))) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            if (nothrow) {
+                return nullptr;
+            }
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+    if (alloc_active.load(std::memory_order_relaxed)) {
+        record_alloc(p, size, caller);
+    }
+    return p;
+}
+
+static void *allocate(size_t size, std::align_val_t align, bool nothrow, void *caller)
+{
+    size_t a = std::max(size_t(align), sizeof(void *));
+    void *p;
+    while (!(p = aligned_alloc(a, (size + a - 1) / a * a))) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            if (nothrow) {
+                return nullptr;
+            }
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+    if (alloc_active.load(std::memory_order_relaxed)) {
+        record_alloc(p, size, caller);
+    }
+    return p;
+}
+
+static inline void deallocate(void *p)
+{
+    if (alloc_active.load(std::memory_order_relaxed)) {
+        record_free(p);
+    }
+    free(p);
+}
+
+#endif
+
+bool AllocProfiler::start(size_t bytes)
+{
+#ifdef ALLOC_PROFILING
+    //The first backtrace() allocates: not in the middle of an operator new.
+    StackTrace::capture();
+    other_scopes = intern("(other scopes)");
+    sample_bytes = bytes;
+    alloc_active = true;
+    return true;
+#else
+    (void)bytes;
+    return false;
+#endif
+}
+
+void AllocProfiler::stop()
+{
+#ifdef ALLOC_PROFILING
+    alloc_active = false;
+#endif
+}
+
+bool AllocProfiler::running()
+{
+#ifdef ALLOC_PROFILING
+    return alloc_active;
+#else
+    return false;
+#endif
+}
+
+void AllocProfiler::set_thread(const std::string &name, int id)
+{
+#ifdef ALLOC_PROFILING
+    uint32_t l = intern(name + "[" + std::to_string(id) + "]");
+    if (ThreadRecord *r = current_record()) {
+        r->label.store(l, std::memory_order_relaxed);
+    }
+#else
+    (void)name;
+    (void)id;
+#endif
+}
+
+#ifdef ALLOC_PROFILING
+//Everything a report shows, live records and ended threads together. Taken under records_mtx, which is taken in an
+//operator new: the labels are only named once it is released.
+struct Snapshot {
+    std::map<std::pair<uint32_t, pid_t>, Totals> threads;
+    std::map<uint32_t, Totals> scopes;
+    uint64_t sizes[AllocProfiler::SIZE_CLASSES] = {};
+};
+
+static void add(Totals &to, const Totals &from)
+{
+    to.allocs += from.allocs;
+    to.frees += from.frees;
+    to.bytes += from.bytes;
+    to.freed += from.freed;
+}
+
+static void snapshot_locked(Snapshot &snap)
+{
+    for (std::pair<const uint32_t, Totals> &t : retired_threads) {
+        add(snap.threads[{t.first, 0}], t.second);
+    }
+    for (std::pair<const uint32_t, Totals> &s : retired_scopes) {
+        add(snap.scopes[s.first], s.second);
+    }
+    for (int i = 0; i < AllocProfiler::SIZE_CLASSES; i++) {
+        snap.sizes[i] = retired_sizes[i];
+    }
+    for (ThreadRecord *r = records; r; r = r->next) {
+        drain_locked(r);
+        uint32_t l = r->label.load();
+        add(snap.threads[{l, l || !r->used.load() ? 0 : r->tid}], {r->allocs.get(), r->frees.get(), r->bytes.get(), r->freed.get()});
+        for (int i = 0; i < AllocProfiler::SIZE_CLASSES; i++) {
+            snap.sizes[i] += r->sizes[i].get();
+        }
+        for (ThreadRecord::Scope &s : r->scopes) {
+            if (uint32_t sl = s.label.load(std::memory_order_relaxed)) {
+                add(snap.scopes[sl], {s.allocs.get(), 0, s.bytes.get(), 0});
+            }
+        }
+    }
+}
+
+static std::string thread_label(uint32_t label, pid_t tid)
+{
+    return label ? AllocProfiler::label(label) : tid ? "tid " + std::to_string(tid) : "(unnamed threads)";
+}
+#endif
+
+std::string AllocProfiler::report(size_t top)
+{
+#ifdef ALLOC_PROFILING
+    //Whatever this thread allocates from here on is the profiler's own.
+    bool busy = tls_busy;
+    tls_busy = true;
+    Snapshot snap;
+    std::vector<std::pair<std::tuple<uint32_t, uint32_t, std::vector<void *>>, std::pair<uint64_t, uint64_t>>> heaviest;
+    records_mtx.lock();
+    snapshot_locked(snap);
+    heaviest.assign(stacks.begin(), stacks.end());
+    records_mtx.unlock();
+
+    std::string out = "\n----------[BEG] [ALLOC REPORT]----------\n";
+    char buf[256];
+    out += "\n[THREADS] allocs frees bytes freed\n";
+    for (std::pair<const std::pair<uint32_t, pid_t>, Totals> &t : snap.threads) {
+        snprintf(buf, sizeof(buf), "%-32s %12llu %12llu %14llu %14llu\n", thread_label(t.first.first, t.first.second).c_str(), (unsigned long long)t.second.allocs,
+                 (unsigned long long)t.second.frees, (unsigned long long)t.second.bytes, (unsigned long long)t.second.freed);
+        out += buf;
+    }
+    out += "\n[SCOPES] allocs bytes\n";
+    for (std::pair<const uint32_t, Totals> &s : snap.scopes) {
+        if (!s.second.allocs) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "%-32s %12llu %14llu\n", label(s.first).c_str(), (unsigned long long)s.second.allocs, (unsigned long long)s.second.bytes);
+        out += buf;
+    }
+    out += "\n[SIZES] allocs\n";
+    for (int i = 0; i < SIZE_CLASSES; i++) {
+        if (snap.sizes[i]) {
+            if (i < SIZE_CLASSES - 1) {
+                snprintf(buf, sizeof(buf), "<= %-29zu %12llu\n", size_t(8) << i, (unsigned long long)snap.sizes[i]);
+            } else {
+                snprintf(buf, sizeof(buf), "> %-30zu %12llu\n", size_t(8) << (i - 1), (unsigned long long)snap.sizes[i]);
+            }
+            out += buf;
+        }
+    }
+
+    std::sort(heaviest.begin(), heaviest.end(), [](const auto &a, const auto &b) {return a.second.second > b.second.second;});
+    if (heaviest.size() > top) {
+        heaviest.resize(top);
+    }
+    out += "\n[STACKS] ~bytes (samples) thread scope\n";
+    for (auto &h : heaviest) {
+        const std::vector<void *> &pcs = std::get<2>(h.first);
+        snprintf(buf, sizeof(buf), "~%llu (%llu) ", (unsigned long long)h.second.second, (unsigned long long)h.second.first);
+        out += buf + thread_label(std::get<0>(h.first), 0) + " " + label(std::get<1>(h.first)) + "\n";
+        out += Symbolizer::get()->format(pcs.data(), int(pcs.size())) + "\n";
+    }
+    out += "----------[END] [ALLOC REPORT]----------\n";
+    tls_busy = busy;
+    return out;
+#else
+    (void)top;
+    return "";
+#endif
+}
+
+std::string AllocProfiler::collapsed()
+{
+#ifdef ALLOC_PROFILING
+    bool busy = tls_busy;
+    tls_busy = true;
+    records_mtx.lock();
+    for (ThreadRecord *r = records; r; r = r->next) {
+        drain_locked(r);
+    }
+    std::map<std::tuple<uint32_t, uint32_t, std::vector<void *>>, std::pair<uint64_t, uint64_t>> copy = stacks;
+    records_mtx.unlock();
+
+    std::map<std::string, uint64_t> lines;
+    for (auto &s : copy) {
+        const std::vector<void *> &pcs = std::get<2>(s.first);
+        std::string scope = label(std::get<1>(s.first));
+        lines[thread_label(std::get<0>(s.first), 0) + ";" + (scope.empty() ? "" : scope + ";") + Symbolizer::get()->collapse(pcs.data(), int(pcs.size()))] += s.second.second;
+    }
+    std::string out;
+    for (std::pair<const std::string, uint64_t> &l : lines) {
+        out += l.first + " " + std::to_string(l.second) + "\n";
+    }
+    tls_busy = busy;
+    return out;
+#else
+    return "";
+#endif
+}
+
+void AllocProfiler::clear()
+{
+#ifdef ALLOC_PROFILING
+    bool busy = tls_busy;
+    tls_busy = true;
+    records_mtx.lock();
+    for (ThreadRecord *r = records; r; r = r->next) {
+        drain_locked(r);
+    }
+    stacks.clear();
+    records_mtx.unlock();
+    tls_busy = busy;
+#endif
+}
+}
+
+#ifdef ALLOC_PROFILING
+//The replaceable global operators: each translation unit of the process, and the libraries, go through them.
+void *operator new(size_t size) {return CppUtilities::allocate(size, false, __builtin_return_address(0));}
+void *operator new[](size_t size) {return CppUtilities::allocate(size, false, __builtin_return_address(0));}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {return CppUtilities::allocate(size, true, __builtin_return_address(0));}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {return CppUtilities::allocate(size, true, __builtin_return_address(0));}
+void *operator new(size_t size, std::align_val_t align) {return CppUtilities::allocate(size, align, false, __builtin_return_address(0));}
+void *operator new[](size_t size, std::align_val_t align) {return CppUtilities::allocate(size, align, false, __builtin_return_address(0));}
+void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {return CppUtilities::allocate(size, align, true, __builtin_return_address(0));}
+void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {return CppUtilities::allocate(size, align, true, __builtin_return_address(0));}
+
+void operator delete(void *p) noexcept {CppUtilities::deallocate(p);}
+void operator delete[](void *p) noexcept {CppUtilities::deallocate(p);}
+void operator delete(void *p, size_t) noexcept {CppUtilities::deallocate(p);}
+void operator delete[](void *p, size_t) noexcept {CppUtilities::deallocate(p);}
+void operator delete(void *p, const std::nothrow_t &) noexcept {CppUtilities::deallocate(p);}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {CppUtilities::deallocate(p);}
+void operator delete(void *p, std::align_val_t) noexcept {CppUtilities::deallocate(p);}
+void operator delete[](void *p, std::align_val_t) noexcept {CppUtilities::deallocate(p);}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {CppUtilities::deallocate(p);}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {CppUtilities::deallocate(p);}
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {CppUtilities::deallocate(p);}
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {CppUtilities::deallocate(p);}
+#endif
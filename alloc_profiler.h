@@ -0,0 +1,73 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+namespace CppUtilities {
+
+/**
+ * Allocation profiler, in place of mtrace: with ALLOC_PROFILING def
+ * ined, the library replaces the global operator new and delete. Be
+ * tween start() and stop(), each thread counts its allocations, free
+ * s and bytes in its own record (no lock, no shared line), by size c
+ * lass and by the scope it is in (the signal being emitted), and one
+ * allocation every sample_bytes or so has its stack captured. The r
+ * ecords are only read, and the stacks symbolized, by report() and c
+ * ollapsed(). Memory from malloc() directly is not seen.
+ **/
+class AllocProfiler
+{
+public:
+    static AllocProfiler *get();
+
+    //False when the library was built without ALLOC_PROFILING. sample_bytes 0: no stacks.
+    bool start(size_t sample_bytes = 512 * 1024);
+    void stop();
+    bool running();
+
+    //Labels the calling thread's allocations (the threads of the library do it when they start).
+    void set_thread(const std::string &name, int id = -1);
+
+    //Per thread, per scope and per size class, then the sampled stacks weighing the most.
+    std::string report(size_t top = 10);
+    //Sampled stacks with their estimated bytes: "thread;scope;outermost;...;innermost bytes", as flamegraph.pl reads it.
+    std::string collapsed();
+    //Forgets the sampled stacks. The counters are the threads' own to write: they run from the first start().
+    void clear();
+
+    //Labels are interned once, 0 is none.
+    static uint32_t intern(const std::string &name);
+    static std::string label(uint32_t id);
+
+    static const int SIZE_CLASSES = 20; //<=8, <=16, ... <=2M, more.
+
+private:
+    AllocProfiler() {};
+};
+
+//The allocations made while it lives are attributed to the label, e.g. a signal's name, interned once into cache.
+class AllocScope
+{
+public:
+    template<class F> inline AllocScope(std::atomic<uint32_t> &cache, F &&name) : _previous(current) {
+        uint32_t id = cache.load(std::memory_order_relaxed);
+        if (!id) {
+            id = AllocProfiler::intern(name());
+            cache.store(id, std::memory_order_relaxed);
+        }
+        current = id;
+    };
+    inline ~AllocScope() {current = _previous;};
+    AllocScope(const AllocScope &) = delete;
+    AllocScope &operator=(const AllocScope &) = delete;
+
+    static thread_local uint32_t current;
+
+private:
+    uint32_t _previous;
+};
+
+}
@@ -0,0 +1,8 @@
+#include "channel.h"
+
+namespace CppUtilities {
+
+/* Template type predefs */
+template class SpscChannel<int>;
+template class MpmcChannel<int>;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include "threading.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+namespace CppUtilities {
+
+//What a ThreadLooping sees of a channel: its values are handled in place, by batch, with no executor per value.
+class AbstractChannel
+{
+public:
+    virtual ~AbstractChannel() {};
+
+    //Runs the handler on up to max values, returns how many.
+    virtual size_t dispatch(size_t max) = 0;
+
+protected:
+    //A push rings the doorbell of the thread draining the channel, if any.
+    inline void notify_consumer() {
+        if (AbstractThread *t = _consumer.load(std::memory_order_acquire)) {
+            t->notify();
+        }
+    };
+
+    std::atomic<AbstractThread *> _consumer = {nullptr};
+
+    friend class ThreadLooping;
+};
+
+template<class T>
+class Channel : public AbstractChannel
+{
+public:
+    using handler_t = std::function<void(T &)>;
+
+    //Called by the consuming thread for each value, which is destroyed right after (move it out to keep it).
+    inline void set_handler(handler_t handler) {_handler = std::move(handler);};
+
+protected:
+    inline static size_t round_capacity(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        return cap;
+    };
+
+    handler_t _handler;
+};
+
+/**
+ * Bounded ring for one producer thread and one consumer thread. The
+ * indexes are on their own cache lines, each side keeping a cached
+ * copy of the other's so a push or a pop reads no shared line while
+ * there is room or data. drain() hands the values to a function whe
+ * re they are in the ring, and frees the room once per batch.
+ **/
+template<class T>
+class SpscChannel : public Channel<T>
+{
+public:
+    inline explicit SpscChannel(size_t capacity = 1024);
+    inline ~SpscChannel() override;
+    SpscChannel(const SpscChannel &) = delete;
+    SpscChannel &operator=(const SpscChannel &) = delete;
+
+    //False when full.
+    template<class V> inline bool try_push(V &&value);
+    //Yields until there is room.
+    template<class V> inline void push(V &&value) {while (!try_push(std::forward<V>(value))) {std::this_thread::yield();}};
+    inline bool try_pop(T &out);
+    //Calls f(T &) on up to max values, returns how many.
+    template<class F> inline size_t drain(F &&f, size_t max = SIZE_MAX);
+
+    inline size_t dispatch(size_t max) override {return drain(this->_handler, max);};
+    inline size_t size() const {return _tail.load() - _head.load();};
+    inline size_t capacity() const {return _mask + 1;};
+
+private:
+    using storage_t = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+    inline T *cell(size_t i) {return std::launder(reinterpret_cast<T *>(&_cells[i & _mask]));};
+
+    const size_t _mask;
+    std::unique_ptr<storage_t[]> _cells;
+    alignas(64) std::atomic<size_t> _tail = {0};
+    size_t _head_cache = 0; //Producer side.
+    alignas(64) std::atomic<size_t> _head = {0};
+    size_t _tail_cache = 0; //Consumer side.
+};
+
+/**
+ * Bounded ring for any number of producers and consumers (D. Vyukov'
+ * s): each cell has a sequence telling if it is free for the push o
+ * f a ticket or filled for its pop, so a push or a pop is one CAS on
+ * its index. drain() takes a run of filled cells with a single CAS.
+ **/
+template<class T>
+class MpmcChannel : public Channel<T>
+{
+public:
+    inline explicit MpmcChannel(size_t capacity = 1024);
+    inline ~MpmcChannel() override;
+    MpmcChannel(const MpmcChannel &) = delete;
+    MpmcChannel &operator=(const MpmcChannel &) = delete;
+
+    template<class V> inline bool try_push(V &&value);
+    template<class V> inline void push(V &&value) {while (!try_push(std::forward<V>(value))) {std::this_thread::yield();}};
+    inline bool try_pop(T &out);
+    template<class F> inline size_t drain(F &&f, size_t max = SIZE_MAX);
+
+    inline size_t dispatch(size_t max) override {return drain(this->_handler, max);};
+    inline size_t capacity() const {return _mask + 1;};
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+
+        inline T *value() {return std::launder(reinterpret_cast<T *>(&storage));};
+    };
+
+    const size_t _mask;
+    std::unique_ptr<Cell[]> _cells;
+    alignas(64) std::atomic<size_t> _tail = {0};
+    alignas(64) std::atomic<size_t> _head = {0};
+};
+
+
+
+template<class T> inline
+SpscChannel<T>::SpscChannel(size_t capacity) : _mask(Channel<T>::round_capacity(capacity) - 1), _cells(new storage_t[_mask + 1])
+{
+}
+
+template<class T> inline
+SpscChannel<T>::~SpscChannel()
+{
+    for (size_t i = _head.load(); i != _tail.load(); i++) {
+        cell(i)->~T();
+    }
+}
+
+template<class T> template<class V> inline
+bool SpscChannel<T>::try_push(V &&value)
+{
+    size_t t = _tail.load(std::memory_order_relaxed);
+    if (t - _head_cache > _mask) {
+        _head_cache = _head.load(std::memory_order_acquire);
+        if (t - _head_cache > _mask) {
+            return false;
+        }
+    }
+    new (cell(t)) T(std::forward<V>(value));
+    _tail.store(t + 1, std::memory_order_release);
+    this->notify_consumer();
+    return true;
+}
+
+template<class T> inline
+bool SpscChannel<T>::try_pop(T &out)
+{
+    return drain([&out](T &v) {out = std::move(v);}, 1) == 1;
+}
+
+template<class T> template<class F> inline
+size_t SpscChannel<T>::drain(F &&f, size_t max)
+{
+    size_t h = _head.load(std::memory_order_relaxed);
+    if (_tail_cache == h) {
+        _tail_cache = _tail.load(std::memory_order_acquire);
+    }
+    size_t n = std::min(_tail_cache - h, max);
+    for (size_t i = 0; i < n; i++) {
+        T *v = cell(h + i);
+        f(*v);
+        v->~T();
+    }
+    if (n) {
+        _head.store(h + n, std::memory_order_release);
+    }
+    return n;
+}
+
+template<class T> inline
+MpmcChannel<T>::MpmcChannel(size_t capacity) : _mask(Channel<T>::round_capacity(capacity) - 1), _cells(new Cell[_mask + 1])
+{
+    for (size_t i = 0; i <= _mask; i++) {
+        _cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<class T> inline
+MpmcChannel<T>::~MpmcChannel()
+{
+    for (size_t i = _head.load(); i != _tail.load(); i++) {
+        _cells[i & _mask].value()->~T();
+    }
+}
+
+template<class T> template<class V> inline
+bool MpmcChannel<T>::try_push(V &&value)
+{
+    size_t pos = _tail.load(std::memory_order_relaxed);
+    Cell *c;
+    for (;;) {
+        c = &_cells[pos & _mask];
+        intptr_t diff = intptr_t(c->seq.load(std::memory_order_acquire)) - intptr_t(pos);
+        if (diff == 0) {
+            if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = _tail.load(std::memory_order_relaxed);
+        }
+    }
+    new (c->value()) T(std::forward<V>(value));
+    c->seq.store(pos + 1, std::memory_order_release);
+    this->notify_consumer();
+    return true;
+}
+
+template<class T> inline
+bool MpmcChannel<T>::try_pop(T &out)
+{
+    return drain([&out](T &v) {out = std::move(v);}, 1) == 1;
+}
+
+template<class T> template<class F> inline
+size_t MpmcChannel<T>::drain(F &&f, size_t max)
+{
+    size_t pos = _head.load(std::memory_order_relaxed);
+    size_t n;
+    for (;;) {
+        //The filled cells from pos on: their sequences only move once they are taken.
+        n = 0;
+        while (n < max && n <= _mask && _cells[(pos + n) & _mask].seq.load(std::memory_order_acquire) == pos + n + 1) {
+            n++;
+        }
+        if (n == 0) {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == pos) {
+                return 0;
+            }
+            pos = head;
+        } else if (_head.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        Cell &c = _cells[(pos + i) & _mask];
+        f(*c.value());
+        c.value()->~T();
+        c.seq.store(pos + i + _mask + 1, std::memory_order_release);
+    }
+    return n;
+}
+}
@@ -8,6 +8,13 @@ bool __sscal_outputs_feature() {
     return false;
 #endif
 }
+bool __tracking_outputs_feature() {
+#ifdef TRACKING_OUTPUTS
+    return true;
+#else
+    return false;
+#endif
+}
 bool __force_debug_feature() {
 #ifdef FORCE_DEBUG
     return true;
@@ -36,4 +43,39 @@ bool __thread_name_use_feature() {
     return false;
 #endif
 }
+bool __stack_frame_pointers_feature() {
+#ifdef STACK_FRAME_POINTERS
+    return true;
+#else
+    return false;
+#endif
+}
+bool __alloc_profiling_feature() {
+#ifdef ALLOC_PROFILING
+    return true;
+#else
+    return false;
+#endif
+}
+bool __flight_recorder_feature() {
+#ifdef FLIGHT_RECORDER
+    return true;
+#else
+    return false;
+#endif
+}
+bool __lock_profiling_feature() {
+#ifdef LOCK_PROFILING
+    return true;
+#else
+    return false;
+#endif
+}
+bool __timeline_tracing_feature() {
+#ifdef TIMELINE_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
 }
@@ -2,14 +2,30 @@
 
 #include "cpputilities_global.h"
 #include "signals_slots.h"
+#include "signals_shm.h"
+#include "event_bus.h"
+#include "channel.h"
 #include "threading.h"
 #include "debuging.h"
+#include "symbolizer.h"
+#include "profiler.h"
+#include "alloc_profiler.h"
+#include "flight_recorder.h"
+#include "crash_report.h"
+#include "lock_profiler.h"
+#include "tracer.h"
 
 //Compile time "knowledge" of the flags. Compile time data does not guarantee that an app at runtime will have the same data. Whereas here, you're sure of what you have.
 namespace CppUtilities {
 bool __sscal_outputs_feature();
+bool __tracking_outputs_feature();
 bool __force_debug_feature();
 bool __debug_all_outs_feature();
 bool __sigsot_meta_use_feature();
 bool __thread_name_use_feature();
+bool __stack_frame_pointers_feature();
+bool __alloc_profiling_feature();
+bool __flight_recorder_feature();
+bool __lock_profiling_feature();
+bool __timeline_tracing_feature();
 }
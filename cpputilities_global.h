@@ -21,12 +21,40 @@
 #define THREAD_TRACKING
 #define SIGSOT_TRACKING
 
+//Print the trackers' events (signals registered, unregistered, tracked) to the console.
+#define TRACKING_OUTPUTS
+
 //Print when a slot (ftor or xtor) is called from a signal.
 //The signal classes have to implement it by their own as the following format, printed BEFORE calling:
 /*
     std::cout << "                > [CALLED] [" << ID << "] [" << NAME << "] [" << TYPE << "]" << std::endl;
 */
+//The calls are printed by the headers: a program defining NO_SSCALL_OUTPUTS before including them (or with
+//-DNO_SSCALL_OUTPUTS) is left without, as the benchmarks of tools/ are.
+#ifndef NO_SSCALL_OUTPUTS
 #define SSCALL_OUTPUTS
+#endif
+
+//StackTrace::capture() walks the frame pointers instead of unwinding: nanoseconds instead of microseconds, but the
+//library and the application have to be built with -fno-omit-frame-pointer, else the stacks are cut short.
+//#define STACK_FRAME_POINTERS
+
+//The library replaces the global operator new and delete, so AllocProfiler can count the allocations of each thread
+//and signal, and sample their stacks. Costs a flag check per allocation until AllocProfiler::get()->start().
+//#define ALLOC_PROFILING
+
+//Each thread keeps its last events (emits, slot calls, callbacks added and run) in a ring of its own, that the crash
+//handler dumps to a file. An event costs a time stamp counter read and a few stores, about 20 ns: it doubles the time of
+//an emit to one direct slot.
+//#define FLIGHT_RECORDER
+
+//The emits, slot calls, callbacks and routine passes are recorded as spans, with flows from a callback's queueing to
+//its run, while the Tracer runs: a timeline for chrome://tracing or Perfetto. Off, a span costs a flag check.
+#define TIMELINE_TRACING
+
+//The mutexes of the threads, signals and ThreadTracker are ProfiledMutexes, counting their contention and wait and
+//hold times per site into LockProfiler. Plain std::mutexes without it.
+//#define LOCK_PROFILING
 
 //Generate stack trace output and such when fails even if the argument was not passed when running the app.
 #define FORCE_DEBUG
@@ -0,0 +1,254 @@
+#include "crash_report.h"
+#include "symbolizer.h"
+#include "flight_recorder.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <ctime>
+
+#include <elf.h>
+
+namespace CppUtilities {
+
+//The order of the ucontext's gregs.
+static const char *const X86_64_REGISTERS[] = {"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rdi", "rsi", "rbp", "rbx", "rdx", "rax",
+                                               "rcx", "rsp", "rip", "eflags", "csgsfs", "err", "trapno", "oldmask", "cr2"};
+
+template<class T>
+static bool take(const char *&c, const char *end, T &v)
+{
+    if (size_t(end - c) < sizeof(T)) {
+        return false;
+    }
+    memcpy(&v, c, sizeof(T));
+    c += sizeof(T);
+    return true;
+}
+
+bool CrashReport::load(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        _error = "cannot open " + path;
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const char *c = data.data(), *end = data.data() + data.size();
+    if (!take(c, end, header) || memcmp(header.magic, CrashFormat::MAGIC, sizeof(header.magic)) != 0) {
+        _error = path + " is not a crash report";
+        return false;
+    } else if (header.version != CrashFormat::VERSION) {
+        _error = "version " + std::to_string(header.version) + " of the format, this reads " + std::to_string(CrashFormat::VERSION);
+        return false;
+    }
+
+    CrashFormat::RecordHeader record;
+    while (take(c, end, record)) {
+        if (uint64_t(end - c) < record.size) {
+            _error = "cut in a record of type " + std::to_string(record.type);
+            return false;
+        }
+        const char *r = c, *r_end = c + record.size;
+        c = r_end;
+        switch (record.type) {
+            case CrashFormat::Info:
+                take(r, r_end, info);
+                info.binary[sizeof(info.binary) - 1] = 0;
+                break;
+            case CrashFormat::Registers:
+                take(r, r_end, registers);
+                break;
+            case CrashFormat::Thread: {
+                Thread t;
+                if (take(r, r_end, t.info)) {
+                    t.info.name[sizeof(t.info.name) - 1] = 0;
+                    t.stack.assign(r, r_end);
+                    threads.push_back(std::move(t));
+                }
+                break;
+            }
+            case CrashFormat::Maps: {
+                std::istringstream lines(std::string(r, r_end));
+                std::string line;
+                while (std::getline(lines, line)) {
+                    if (line == "[truncated]") {
+                        maps_truncated = true;
+                        continue;
+                    }
+                    Mapping m;
+                    char perms[8] = {0};
+                    int path_at = 0;
+                    if (sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %n", &m.start, &m.end, perms, &m.offset, &path_at) >= 4) {
+                        m.exec = perms[2] == 'x';
+                        m.path = path_at ? line.substr(size_t(path_at)) : "";
+                        maps.push_back(m);
+                    }
+                }
+                break;
+            }
+            case CrashFormat::Threads:
+            case CrashFormat::Signals: {
+                std::vector<CrashFormat::TrackedObject> &list = record.type == CrashFormat::Threads ? tracked_threads : tracked_signals;
+                CrashFormat::TrackedObject o;
+                while (take(r, r_end, o)) {
+                    list.push_back(o);
+                }
+                break;
+            }
+            case CrashFormat::Frames: {
+                CrashFormat::CrashFrames f;
+                if (!take(r, r_end, f) || threads.empty() || threads.back().info.tid != f.tid) {
+                    break;
+                }
+                uint64_t pc;
+                for (uint32_t i = 0; i < f.count && take(r, r_end, pc); i++) {
+                    threads.back().frames.push_back(pc);
+                }
+                break;
+            }
+            case CrashFormat::Flight: {
+                if (!take(r, r_end, flight)) {
+                    break;
+                }
+                FlightRing ring;
+                while (take(r, r_end, ring.info)) {
+                    ring.info.name[sizeof(ring.info.name) - 1] = 0;
+                    ring.entries.resize(flight.entries);
+                    for (CrashFormat::CrashFlightEntry &e : ring.entries) {
+                        take(r, r_end, e);
+                    }
+                    flight_rings.push_back(ring);
+                }
+                break;
+            }
+            case CrashFormat::End:
+                return true;
+        }
+    }
+    //No end record: the handler did not finish, what was read is kept.
+    _error = "no end record, the report is incomplete";
+    return true;
+}
+
+const CrashReport::Mapping *CrashReport::mapping(uint64_t addr) const
+{
+    for (const Mapping &m : maps) {
+        if (addr >= m.start && addr < m.end) {
+            return &m;
+        }
+    }
+    return nullptr;
+}
+
+std::string CrashReport::symbolize(uint64_t addr, bool return_address) const
+{
+    std::ostringstream out;
+    out << "0x" << std::hex << addr;
+    const Mapping *m = mapping(addr);
+    if (!m || m->path.empty() || m->path[0] != '/') {
+        return out.str();
+    }
+    //A return address minus one is in the call, for its line.
+    uint64_t file_offset = addr - m->start + m->offset;
+    SymbolInfo s;
+    if (Symbolizer::get()->resolve_file(m->path, file_offset - return_address, s) && !s.function.empty()) {
+        out << " " << s.function << " + 0x" << s.offset + return_address;
+        if (!s.file.empty()) {
+            out << " at " << s.file << ":" << std::dec << s.line;
+        }
+    } else {
+        out << " " << m->path << " + 0x" << file_offset;
+    }
+    return out.str();
+}
+
+std::string CrashReport::to_string(size_t max_frames)
+{
+    std::ostringstream out;
+    time_t when = time_t(info.time);
+    char date[64] = {0};
+    strftime(date, sizeof(date), "%F %T", localtime(&when));
+    out << "\n-----------[BEG] [CRASH REPORT]-----------\n\n";
+    out << "Signal " << info.signal << " (" << strsignal(info.signal) << "), code " << info.code << ", address 0x" << std::hex << info.address
+        << std::dec << "\nProcess " << info.pid << ", thread " << info.tid << ", " << date << "\nBinary: " << info.binary << "\n";
+    if (!_error.empty()) {
+        out << "Warning: " << _error << "\n";
+    }
+    if (maps_truncated) {
+        out << "Warning: the maps were truncated, the frames past them are not symbolized\n";
+    }
+
+    out << "\nRegisters:\n" << std::hex;
+    for (uint32_t i = 0; i < registers.count && i < 64; i++) {
+        if (header.machine == EM_X86_64 && i < sizeof(X86_64_REGISTERS) / sizeof(X86_64_REGISTERS[0])) {
+            out << std::setw(8) << X86_64_REGISTERS[i];
+        } else {
+            out << std::setw(8) << ("x" + std::to_string(i));
+        }
+        out << " 0x" << std::setw(16) << std::setfill('0') << registers.regs[i] << std::setfill(' ') << (i % 4 == 3 ? "\n" : "");
+    }
+    out << std::dec << "\n";
+
+    for (const Thread &t : threads) {
+        out << "\nThread " << t.info.tid << " [" << t.info.name << "] [" << t.info.id << "]" << (t.info.crashed ? " crashed" : "") << ", stack 0x"
+            << std::hex << t.info.stack_low << "-0x" << t.info.stack_high << ", " << std::dec << t.stack.size() << " bytes from 0x" << std::hex
+            << t.info.dump_start << std::dec << "\n";
+        //The interrupted pc, then return addresses.
+        for (size_t i = 0; i < t.frames.size() && i < max_frames; i++) {
+            out << "    #" << i << " " << symbolize(t.frames[i], i > 0) << "\n";
+        }
+        if (!t.frames.empty()) {
+            continue;
+        }
+        size_t frame = 0;
+        if (t.info.crashed) {
+            out << "    #0 " << symbolize(registers.pc, false) << "\n";
+            frame++;
+        }
+        //Every word pointing into code, innermost first: return addresses, and stale or unrelated values.
+        for (size_t i = 0; i + sizeof(uint64_t) <= t.stack.size() && frame < max_frames; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, t.stack.data() + i, sizeof(word));
+            uint64_t at = t.info.dump_start + i;
+            const Mapping *m = mapping(word);
+            if (at < t.info.sp || !m || !m->exec || m->path.empty() || m->path[0] != '/') {
+                continue;
+            }
+            out << "    #" << frame++ << " " << symbolize(word, true) << " (scan, at 0x" << std::hex << at << std::dec << ")\n";
+        }
+    }
+
+    out << "\nThreadTracker: " << tracked_threads.size() << " threads\n";
+    for (const CrashFormat::TrackedObject &o : tracked_threads) {
+        out << "    [" << o.id << "] " << (o.running ? "running" : "stopped") << " 0x" << std::hex << o.object << std::dec << "\n";
+    }
+    out << "SignalTracker: " << tracked_signals.size() << " signals\n";
+    for (const CrashFormat::TrackedObject &o : tracked_signals) {
+        out << "    [" << o.id << "] 0x" << std::hex << o.object << std::dec << (o.running ? " tracked" : "") << "\n";
+    }
+
+    for (const FlightRing &r : flight_rings) {
+        out << "\nFlight recorder, thread " << r.info.tid << " [" << r.info.name << "] [" << r.info.id << "] " << (r.info.used ? "running, " : "ended, ")
+            << r.info.count << " events\n";
+        uint64_t time = 0;
+        uint64_t n = r.entries.size();
+        for (uint64_t i = r.info.count > n ? r.info.count - n : 0; n && i < r.info.count; i++) {
+            const CrashFormat::CrashFlightEntry &e = r.entries[i % n];
+            if (e.time) {
+                time = e.time;
+            }
+            if (time) {
+                out << "    -" << uint64_t(flight.now > time ? double(flight.now - time) * flight.tick_ns / 1000 : 0) << " us ";
+            } else {
+                out << "    ? us ";
+            }
+            out << FlightRecorder::event_name(FlightEvent(e.what >> 32)) << " " << uint32_t(e.what) << " 0x" << std::hex << e.object << std::dec << "\n";
+        }
+    }
+    out << "\n-----------[END] [CRASH REPORT]-----------\n";
+    return out.str();
+}
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace CppUtilities {
+
+//Layout of the binary crash report: a FileHeader, then records, each a RecordHeader followed by size bytes.
+//Written by the crash handler with write(2) only, read back by CrashReport, on the same machine or another.
+namespace CrashFormat {
+static const char MAGIC[8] = {'C', 'P', 'P', 'U', 'C', 'R', 'S', 'H'};
+static const uint32_t VERSION = 2;
+
+enum Record : uint32_t {
+    Info = 1,   //CrashInfo.
+    Registers,  //CrashRegisters, of the crashing thread.
+    Thread,     //CrashThread, then its stack from dump_start to stack_high (or less if it could not be read).
+    Maps,       //The text of /proc/self/maps, ending with a "[truncated]" line if it did not fit.
+    Threads,    //TrackedObject each, from ThreadTracker (running: 1 or 0).
+    Signals,    //TrackedObject each, from SignalTracker (running: tracking enabled).
+    Flight,     //CrashFlight, then per ring a CrashFlightRing and its entries.
+    Frames,     //CrashFrames, then count pcs (uint64_t) a thread unwound, the interrupted one first: follows its Thread.
+    End
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t machine; //ELF e_machine of the process.
+};
+struct RecordHeader {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t size;
+};
+struct CrashInfo {
+    int32_t signal;
+    int32_t code;
+    int32_t pid;
+    int32_t tid;
+    uint64_t address; //si_addr.
+    int64_t time;     //s since the epoch.
+    char binary[1024];
+};
+struct CrashRegisters {
+    uint64_t pc;
+    uint64_t sp;
+    uint64_t fp;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t regs[64]; //The general registers of the ucontext, in its order.
+};
+struct CrashThread {
+    int32_t tid;
+    int32_t id;       //ThreadTracker's, -1 if none.
+    char name[32];
+    uint64_t stack_low;
+    uint64_t stack_high;
+    uint64_t sp;      //0 when unknown.
+    uint64_t dump_start;
+    uint32_t crashed;
+    uint32_t reserved;
+};
+struct CrashFrames {
+    int32_t tid;
+    uint32_t count;
+};
+struct TrackedObject {
+    int32_t id;
+    int32_t running;
+    uint64_t object;
+};
+struct CrashFlight {
+    double tick_ns;
+    uint64_t now;
+    uint32_t entries; //Per ring.
+    uint32_t reserved;
+};
+struct CrashFlightRing {
+    int32_t tid;
+    int32_t id;
+    char name[32];
+    uint64_t count;
+    uint32_t used;
+    uint32_t reserved;
+};
+struct CrashFlightEntry {
+    uint64_t time;
+    uint64_t what;
+    uint64_t object;
+};
+}
+
+/**
+ * Reads a crash report written by the crash handler (setup_sig_hand
+ * le() with report set) and symbolizes it against the files the maps
+ * name, through Symbolizer::resolve_file(): they must be there, the
+ * same build, where the process had them. Each thread's frames are t
+ * he ones it unwound itself at the crash; for one that did not answer
+ * , its stack is scanned for the words pointing into code instead: fr
+ * ames after the first are then candidates, not proofs.
+ **/
+class CrashReport
+{
+public:
+    //False, with error() set, if the file is not a report or is cut.
+    bool load(const std::string &path);
+    inline const std::string &error() const {return _error;};
+
+    //The signal, the registers, each thread with its symbolized frames, the trackers and the flight recorder.
+    std::string to_string(size_t max_frames = 64);
+
+    struct Thread {
+        CrashFormat::CrashThread info;
+        std::vector<char> stack;
+        std::vector<uint64_t> frames; //Unwound, empty if the thread did not answer.
+    };
+    struct Mapping {
+        uint64_t start, end, offset;
+        bool exec;
+        std::string path;
+    };
+    struct FlightRing {
+        CrashFormat::CrashFlightRing info;
+        std::vector<CrashFormat::CrashFlightEntry> entries;
+    };
+
+    CrashFormat::FileHeader header = {};
+    CrashFormat::CrashInfo info = {};
+    CrashFormat::CrashRegisters registers = {};
+    std::vector<Thread> threads;
+    std::vector<Mapping> maps;
+    bool maps_truncated = false;
+    std::vector<CrashFormat::TrackedObject> tracked_threads;
+    std::vector<CrashFormat::TrackedObject> tracked_signals;
+    CrashFormat::CrashFlight flight = {};
+    std::vector<FlightRing> flight_rings;
+
+private:
+    const Mapping *mapping(uint64_t addr) const;
+    std::string symbolize(uint64_t addr, bool return_address) const;
+
+    std::string _error;
+};
+
+}
@@ -1,5 +1,9 @@
 #include "debuging.h"
 #include "cpputilities_global.h"
+#include "symbolizer.h"
+#include "alloc_profiler.h"
+#include "flight_recorder.h"
+#include "crash_report.h"
 
 #ifdef THREAD_TRACKING
 #include "threading.h"
@@ -18,10 +22,19 @@
 #include <string>
 
 #include <execinfo.h> // for backtrace
-#include <dlfcn.h>    // for dladdr
-#include <cxxabi.h>   // for __cxa_demangle
 #include <signal.h>
-#include <mcheck.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <elf.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 const int MAX_STACK_FRAMES = 128;
 bool active_mtrace = false;
@@ -30,78 +43,34 @@ std::string bin_path = "";
 
 namespace CppUtilities {
 
+//Like addr2line -C -f: the function, then file:line, "??" for what is unknown.
+static std::string addr2line_format(const void *addr)
+{
+    const SymbolInfo &info = Symbolizer::get()->lookup(addr);
+    return (info.function.empty() ? "??" : info.function) + "\n" + (info.file.empty() ? "??" : info.file) + ":" + std::to_string(info.line) + "\n";
+}
+
 std::string Backtrace(int skip = 1)
 {
     void *callstack[128];
     const int nMaxFrames = sizeof(callstack) / sizeof(callstack[0]);
-    char buf[1024];
-    int nFrames = backtrace(callstack, nMaxFrames);
-    char **symbols = backtrace_symbols(callstack, nFrames);
-
-    std::ostringstream trace_buf;
-    for (int i = skip; i < nFrames; i++) {
-        Dl_info info;
-        if (dladdr(callstack[i], &info) && info.dli_sname) {
-            char *demangled = nullptr;
-            int status = -1;
-            if (info.dli_sname[0] == '_')
-                demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
-            snprintf(buf, sizeof(buf), "%-3d %*p %s + %zd\n",
-                     i, int(2 + sizeof(void*) * 2), callstack[i],
-                     status == 0 ? demangled :
-                     info.dli_sname == nullptr ? symbols[i] : info.dli_sname,
-                     (char *)callstack[i] - (char *)info.dli_saddr);
-            free(demangled);
-        } else {
-            snprintf(buf, sizeof(buf), "%-3d %*p %s\n",
-                     i, int(2 + sizeof(void*) * 2), callstack[i], symbols[i]);
-        }
-        trace_buf << buf;
-    }
-    free(symbols);
-    if (nFrames == nMaxFrames)
-        trace_buf << "[truncated]\n";
-    return trace_buf.str();
+    int nFrames = StackTrace::capture(callstack, nMaxFrames, skip);
+
+    std::string trace_buf = Symbolizer::get()->format(callstack, nFrames, skip);
+    if (nFrames == StackTrace::capture_limit(nMaxFrames, skip))
+        trace_buf += "[truncated]\n";
+    return trace_buf;
 }
 
-std::string get_path(char *argo)
+std::string get_path(char *)
 {
-        char exepath[1024 + 1] = {0};
-
-        sprintf(argo, "/proc/%d/exe", getpid());
-        readlink(argo, exepath, 1024);
-        return std::string(exepath);
+    return Symbolizer::get()->executable();
 }
 
 
 std::string execute_addr_l(std::string &addr)
 {
-
-    FILE *fp;
-    std::string output;
-
-    /* Open the command for reading. */
-    std::string orig = "addr2line -C -f -e ";
-    orig.append(bin_path);
-    orig.append(" ");
-    orig.append(addr);
-    fp = popen(const_cast<char *>(orig.c_str()), "r");
-    if (fp == NULL) {
-        printf("Failed to run command\n" );
-        exit(1);
-    }
-
-    char path[1024];
-
-    /* Read the output a line at a time - output it. */
-    while (fgets(path, sizeof(path)-1, fp) != NULL) {
-        output.append(path);
-    }
-
-    /* close */
-    pclose(fp);
-
-    return output;
+    return addr2line_format(reinterpret_cast<const void *>(strtoull(addr.c_str(), nullptr, 16)));
 }
 
 void print_cerr_thread_log()
@@ -133,94 +102,928 @@ void print_sig_path(int sig)
 #endif
 }
 
-void handleSignals [[ noreturn ]] (int sig)
+//The crash handler only makes async-signal-safe calls: what it needs is allocated here before it can run.
+static const size_t ALT_STACK_SIZE = 64 * 1024;
+static char main_alt_stack[ALT_STACK_SIZE];
+static char crash_bin_path[1024 + 1];
+static char crash_out[1024];
+static size_t crash_out_len = 0;
+static int crash_fd = STDERR_FILENO;
+static char crash_flight_path[1024 + 64];
+//Sized from the maps by setup_sig_handle() and setup_stack_dump_signal(); dump_thread_stacks() alone has the default.
+static char crash_maps_default[64 * 1024];
+static char *crash_maps = crash_maps_default;
+static size_t crash_maps_size = sizeof(crash_maps_default);
+static size_t crash_maps_len = 0;
+static bool crash_maps_cut = false;
+static const char MAPS_CUT[] = "[truncated]\n";
+static void *crash_frames[MAX_STACK_FRAMES];
+static char crash_report_path[1024 + 64];
+static bool crash_report_set = false;
+//Bytes of stack in the report, from each thread's stack pointer: more for the crashing one.
+static const size_t CRASH_STACK_BYTES = 256 * 1024;
+static const size_t THREAD_STACK_BYTES = 64 * 1024;
+static CrashFormat::TrackedObject crash_tracked[4096];
+#ifdef FLIGHT_RECORDER
+static CrashFormat::CrashFlightEntry crash_flight_entries[FlightRecorder::SIZE];
+#endif
+
+//What a fresh slot has answered, and the request of a crash handler asking nothing.
+static const uint32_t NO_REQUEST = 0;
+
+//The threads whose stacks go in the report and the dumps, registered by setup_thread_sig_stack(). A slot is taken by a
+//CAS on its tid (-1 while it is filled), and freed when the thread ends. Its frames are written by the thread itself,
+//in the stack signal's handler, then answered is set to the request asked.
+struct CrashThreadSlot {
+    std::atomic<int> tid = {0};
+    int id = -1;
+    char name[32] = {0};
+    uintptr_t stack_low = 0;
+    uintptr_t stack_high = 0;
+    void *pcs[StackTrace::MAX_FRAMES] = {};
+    int depth = 0;
+    uintptr_t sp = 0;
+    std::atomic<uint32_t> asked = {NO_REQUEST};
+    std::atomic<uint32_t> answered = {NO_REQUEST};
+};
+static const int MAX_CRASH_THREADS = 256;
+static CrashThreadSlot crash_threads[MAX_CRASH_THREADS];
+static std::atomic<bool> crash_handler_set = {false};
+static std::atomic<bool> crash_handling = {false};
+//The real-time signal each thread answers with its stack, 0 until its handler is set. How long a dump waits for them.
+static int stack_signal = 0;
+static const int STACKS_TIMEOUT_MS = 200;
+static std::atomic<uint32_t> stacks_request = {NO_REQUEST};
+//Held while crash_out and crash_fd are used, by a dump (thread stacks or flight recorder) or the crash handler.
+static std::atomic<bool> stacks_dumping = {false};
+
+static void crash_flush()
 {
-    //First of all, flush all the streams!
-    fflush(stdout);
-    fflush(stderr);
-    fflush(stdin);
+    size_t done = 0;
+    while (done < crash_out_len) {
+        ssize_t w = write(crash_fd, crash_out + done, crash_out_len - done);
+        if (w <= 0) {
+            break;
+        }
+        done += size_t(w);
+    }
+    crash_out_len = 0;
+}
 
-#ifndef FORCE_DEBUG
-    if (active_debug) {
-#endif
-        print_cerr_thread_log();
-#ifndef DEBUG_ALL_OUTS
-        if (sig != SIGINT) { //No need to print anything as the user wanted to kill it! Normal.
+static void crash_put(const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (crash_out_len == sizeof(crash_out)) {
+            crash_flush();
+        }
+        crash_out[crash_out_len++] = str[i];
+    }
+}
+
+static void crash_put(const char *str)
+{
+    crash_put(str, strlen(str));
+}
+
+static void crash_put_num(uintptr_t v, unsigned base)
+{
+    char digits[2 + sizeof(uintptr_t) * 8];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n++] = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v);
+    if (base == 16) {
+        digits[sizeof(digits) - 1 - n++] = 'x';
+        digits[sizeof(digits) - 1 - n++] = '0';
+    }
+    crash_put(digits + sizeof(digits) - n, n);
+}
+
+static uintptr_t parse_hex(const char *&c, const char *end)
+{
+    uintptr_t v = 0;
+    for (; c < end; c++) {
+        if (*c >= '0' && *c <= '9') {
+            v = v * 16 + uintptr_t(*c - '0');
+        } else if (*c >= 'a' && *c <= 'f') {
+            v = v * 16 + uintptr_t(*c - 'a' + 10);
+        } else {
+            break;
+        }
+    }
+    return v;
+}
+
+//open(2) and read(2) of /proc/self/maps: the mappings as they are at the crash. What does not fit is cut at the last
+//whole line, then marked by a "[truncated]" line.
+static void crash_read_maps()
+{
+    crash_maps_len = 0;
+    crash_maps_cut = false;
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    size_t room = crash_maps_size - (sizeof(MAPS_CUT) - 1);
+    ssize_t r;
+    while (crash_maps_len < room && (r = read(fd, crash_maps + crash_maps_len, room - crash_maps_len)) > 0) {
+        crash_maps_len += size_t(r);
+    }
+    char more;
+    if (crash_maps_len == room && read(fd, &more, 1) > 0) {
+        while (crash_maps_len && crash_maps[crash_maps_len - 1] != '\n') {
+            crash_maps_len--;
+        }
+        memcpy(crash_maps + crash_maps_len, MAPS_CUT, sizeof(MAPS_CUT) - 1);
+        crash_maps_len += sizeof(MAPS_CUT) - 1;
+        crash_maps_cut = true;
+    }
+    close(fd);
+}
+
+//Twice the maps' length now, as threads and libraries loaded later add lines. A buffer replaced is kept: a dump may be
+//reading it.
+static void size_crash_maps()
+{
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    char chunk[4096];
+    size_t len = 0;
+    ssize_t r;
+    while ((r = read(fd, chunk, sizeof(chunk))) > 0) {
+        len += size_t(r);
+    }
+    close(fd);
+    if (2 * len > crash_maps_size) {
+        crash_maps = new char[2 * len];
+        crash_maps_size = 2 * len;
+    }
+}
+
+//The maps' line holding addr, "start-end perms offset dev inode path": its bounds, and where the perms start.
+static bool crash_find_mapping(uintptr_t addr, uintptr_t &start, uintptr_t &stop, const char *&fields, const char *&eol)
+{
+    const char *c = crash_maps, *end = crash_maps + crash_maps_len;
+    while (c < end) {
+        eol = static_cast<const char *>(memchr(c, '\n', size_t(end - c)));
+        if (!eol) {
+            eol = end;
+        }
+        fields = c;
+        start = parse_hex(fields, eol);
+        fields++;
+        stop = parse_hex(fields, eol);
+        if (addr >= start && addr < stop) {
+            return true;
+        }
+        c = eol + 1;
+    }
+    return false;
+}
+
+//The module holding addr and the offset of addr in its file, what addr2line wants.
+static bool crash_find_module(uintptr_t addr, const char *&path, size_t &path_len, uintptr_t &offset)
+{
+    uintptr_t start, stop;
+    const char *f, *eol;
+    if (!crash_find_mapping(addr, start, stop, f, eol)) {
+        return false;
+    }
+    //Skips the perms, then reads the offset.
+    while (f < eol && *f == ' ') f++;
+    while (f < eol && *f != ' ') f++;
+    while (f < eol && *f == ' ') f++;
+    offset = addr - start + parse_hex(f, eol);
+    //Skips the offset's end, dev and inode, to the path.
+    for (int field = 0; field < 2; field++) {
+        while (f < eol && *f == ' ') f++;
+        while (f < eol && *f != ' ') f++;
+    }
+    while (f < eol && *f == ' ') f++;
+    path = f;
+    path_len = size_t(eol - f);
+    return path_len > 0;
+}
+
+//"#i pc module offset", what addr2line wants.
+static void crash_put_frame(int i, void *pc)
+{
+    const char *path;
+    size_t path_len;
+    uintptr_t offset;
+    crash_put("#");
+    crash_put_num(uintptr_t(i), 10);
+    crash_put(" ");
+    crash_put_num(uintptr_t(pc), 16);
+    if (crash_find_module(uintptr_t(pc), path, path_len, offset)) {
+        crash_put(" ");
+        crash_put(path, path_len);
+        crash_put(" ");
+        crash_put_num(offset, 16);
+    } else if (crash_maps_cut) {
+        crash_put(" (maps truncated)");
+    }
+    crash_put("\n");
+}
+
+static uintptr_t context_sp(const ucontext_t *uc)
+{
+#if defined(__x86_64__)
+    return uintptr_t(uc->uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+    return uintptr_t(uc->uc_mcontext.sp);
+#else
+    (void)uc;
+    return 0;
 #endif
-            try {
-                void *array[MAX_STACK_FRAMES];
-                size_t size = 0;
-                char **strings = nullptr;
-                size_t i;
-                signal(sig, SIG_DFL);
-                size = static_cast<size_t>(backtrace(array, MAX_STACK_FRAMES));
-                strings = backtrace_symbols(array, int(size));
+}
 
-                std::cerr << "\n-----------[BEG] [ADDR2LINE LOG]-----------\n" << std::endl;
+//Run by a thread asked for its stack: the slot index comes with the signal, the code it interrupted is unwound.
+static void stack_signal_handler(int, siginfo_t *info, void *context)
+{
+    int i = info->si_value.sival_int;
+    if (info->si_code != SI_QUEUE || info->si_pid != getpid() || i < 0 || i >= MAX_CRASH_THREADS) {
+        return;
+    }
+    int saved_errno = errno;
+    CrashThreadSlot &slot = crash_threads[i];
+    //Once per request: the signal of one that timed out can still be queued, and must not rewrite the frames read.
+    uint32_t request = slot.asked.load(std::memory_order_acquire);
+    if (slot.tid.load(std::memory_order_acquire) == int(syscall(SYS_gettid)) && slot.answered.load(std::memory_order_relaxed) != request) {
+        slot.depth = StackTrace::capture_context(context, slot.pcs, StackTrace::MAX_FRAMES, slot.stack_low, slot.stack_high);
+        slot.sp = context_sp(static_cast<ucontext_t *>(context));
+        slot.answered.store(request, std::memory_order_release);
+    }
+    errno = saved_errno;
+}
 
-                for (i = 0; i < size; ++i) {
-                    std::string symbol(strings[i]);
-                    size_t pos1 = symbol.find("[");
-                    std::string address = symbol.substr(pos1 +1, symbol.find_last_of("]") -pos1 -1);
+static void setup_stack_signal()
+{
+    if (stack_signal) {
+        return;
+    }
+    //A real-time signal leaves SIGUSR1/2 to the application; SIGRTMIN itself is the likeliest to be taken already.
+    struct sigaction sa = {};
+    sa.sa_sigaction = stack_signal_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGRTMIN + 2, &sa, nullptr) == 0) {
+        stack_signal = SIGRTMIN + 2;
+    }
+    //The first backtrace() loads libgcc_s, which allocates: never in the handler.
+    backtrace(crash_frames, MAX_STACK_FRAMES);
+}
 
-                    std::cerr << execute_addr_l(address) << std::endl;
+//Signals each registered thread but self for its stack, then waits for the answers up to STACKS_TIMEOUT_MS: a thread
+//blocking the signal, or stopped, is left without. Returns the request the answers are for.
+static uint32_t collect_thread_stacks(int self)
+{
+    uint32_t request = stacks_request.fetch_add(1) + 1;
+    if (request == NO_REQUEST) {
+        request = stacks_request.fetch_add(1) + 1;
+    }
+    if (!stack_signal) {
+        return request;
+    }
+    int pid = int(getpid());
+    for (int i = 0; i < MAX_CRASH_THREADS; i++) {
+        CrashThreadSlot &slot = crash_threads[i];
+        int tid = slot.tid.load(std::memory_order_acquire);
+        if (tid <= 0 || tid == self) {
+            continue;
+        }
+        slot.asked.store(request, std::memory_order_release);
+        siginfo_t si = {};
+        si.si_signo = stack_signal;
+        si.si_code = SI_QUEUE;
+        si.si_pid = pid;
+        si.si_uid = getuid();
+        si.si_value.sival_int = i;
+        if (syscall(SYS_rt_tgsigqueueinfo, pid, tid, stack_signal, &si) != 0) {
+            slot.asked.store(NO_REQUEST, std::memory_order_relaxed);
+        }
+    }
+    //Yields first, the answers take microseconds: sleeping at once would cost a millisecond on a loaded machine.
+    timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int polls = 0;; polls++) {
+        bool pending = false;
+        for (CrashThreadSlot &slot : crash_threads) {
+            int tid = slot.tid.load(std::memory_order_acquire);
+            if (tid > 0 && tid != self && slot.asked.load(std::memory_order_relaxed) == request &&
+                    slot.answered.load(std::memory_order_acquire) != request) {
+                pending = true;
+                break;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!pending || (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 >= STACKS_TIMEOUT_MS) {
+            break;
+        } else if (polls < 100) {
+            sched_yield();
+        } else {
+            timespec ms = {0, 1000000};
+            nanosleep(&ms, nullptr);
+        }
+    }
+    return request;
+}
 
-                }
-                std::cerr << "\n-----------[END] [ADDR2LINE LOG]-----------\n" << std::endl;
+static void crash_put_thread(int tid, const CrashThreadSlot *slot)
+{
+    crash_put("\nThread ");
+    crash_put_num(uintptr_t(tid), 10);
+    crash_put(" [");
+    crash_put(slot ? slot->name : "");
+    crash_put("] [");
+    int id = slot ? slot->id : -1;
+    if (id < 0) {
+        crash_put("-");
+    }
+    crash_put_num(uintptr_t(id < 0 ? -id : id), 10);
+    crash_put("]");
+}
 
-                std::cerr << "\n----------[BEG] [PROG OFFSET LOG]----------\n" << std::endl;
-                std::cerr << Backtrace() << std::endl;
-                std::cerr << "\n----------[END] [PROG OFFSET LOG]----------\n" << std::endl;
-                free(strings);
+//The answers to request (NO_REQUEST when none was made), the calling thread's own frames given apart (none to leave it
+//out).
+static void crash_put_thread_stacks(uint32_t request, int self, void **self_pcs, int self_depth)
+{
+    crash_put("\n-----------[BEG] [THREAD STACKS]-----------\n");
+    const CrashThreadSlot *own = nullptr;
+    for (const CrashThreadSlot &slot : crash_threads) {
+        if (slot.tid.load(std::memory_order_acquire) == self) {
+            own = &slot;
+        }
+    }
+    if (self_depth) {
+        crash_put_thread(self, own);
+        crash_put(" (dumping)\n");
+        for (int i = 0; i < self_depth; i++) {
+            crash_put_frame(i, self_pcs[i]);
+        }
+    }
+    for (const CrashThreadSlot &slot : crash_threads) {
+        int tid = slot.tid.load(std::memory_order_acquire);
+        if (tid <= 0 || tid == self) {
+            continue;
+        }
+        crash_put_thread(tid, &slot);
+        if (request == NO_REQUEST) {
+            crash_put(": not asked\n");
+            continue;
+        }
+        if (slot.answered.load(std::memory_order_acquire) != request) {
+            crash_put(stack_signal ? ": no answer\n"
+                                   : ": not asked, neither setup_sig_handle() nor setup_stack_dump_signal() was called\n");
+            continue;
+        }
+        crash_put("\n");
+        for (int i = 0; i < slot.depth; i++) {
+            crash_put_frame(i, slot.pcs[i]);
+        }
+    }
+    crash_put("\n-----------[END] [THREAD STACKS]-----------\n");
+}
+
+void dump_thread_stacks(int fd)
+{
+    if (stacks_dumping.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+    //The crash handler waits for the dump in progress, none starts after it.
+    if (crash_handling.load()) {
+        stacks_dumping.store(false, std::memory_order_release);
+        return;
+    }
+    int saved_errno = errno;
+    int previous_fd = crash_fd;
+    crash_flush();
+    crash_fd = fd;
+    crash_read_maps();
+    int self = int(syscall(SYS_gettid));
+    uint32_t request = collect_thread_stacks(self);
+    void *pcs[StackTrace::MAX_FRAMES];
+    int depth = StackTrace::capture(pcs, StackTrace::MAX_FRAMES);
+    crash_put_thread_stacks(request, self, pcs, depth);
+    crash_flush();
+    crash_fd = previous_fd;
+    errno = saved_errno;
+    stacks_dumping.store(false, std::memory_order_release);
+}
+
+static void stack_dump_handler(int)
+{
+    dump_thread_stacks(STDERR_FILENO);
+}
 
-            } catch (...) {
-                /* ... can we really do smthg about it at all? ... */
+void setup_stack_dump_signal(int sig)
+{
+    size_crash_maps();
+    setup_stack_signal();
+    struct sigaction sa = {};
+    sa.sa_handler = stack_dump_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, nullptr);
+}
+
+static const char *signal_name(int sig)
+{
+    switch (sig) {
+        case SIGTERM: return "SIGTERM";
+        case SIGILL: return "SIGILL";
+        case SIGSEGV: return "SIGSEGV";
+        case SIGBUS: return "SIGBUS";
+        case SIGINT: return "SIGINT";
+        case SIGABRT: return "SIGABRT";
+        case SIGFPE: return "SIGFPE";
+    }
+    return "UNKNOWN";
+}
+
+//The caller holds stacks_dumping: crash_out and crash_fd are its.
+static void put_flight_recorder(int fd)
+{
+    int previous_fd = crash_fd;
+    crash_flush();
+    crash_fd = fd;
+    double tick_ns = FlightRecorder::tick_ns();
+    uint64_t now = FlightRecorder::now();
+    crash_put("\n---------[BEG] [FLIGHT RECORDER]---------\n");
+    for (FlightRecorder::Ring *r = FlightRecorder::rings(); r; r = r->next) {
+        uint64_t count = r->count.load(std::memory_order_acquire);
+        crash_put("\nThread ");
+        crash_put_num(uintptr_t(r->tid), 10);
+        crash_put(" [");
+        crash_put(r->name);
+        crash_put("] [");
+        if (r->id < 0) {
+            crash_put("-");
+        }
+        crash_put_num(uintptr_t(r->id < 0 ? -r->id : r->id), 10);
+        crash_put(r->used.load() ? "] running, " : "] ended, ");
+        crash_put_num(uintptr_t(count), 10);
+        crash_put(" events\n");
+        //Oldest first. The thread may be writing the next one meanwhile: an entry can be torn.
+        uint64_t time = 0;
+        for (uint64_t i = count > FlightRecorder::SIZE ? count - FlightRecorder::SIZE : 0; i < count; i++) {
+            const FlightRecorder::Entry &e = r->entries[i & (FlightRecorder::SIZE - 1)];
+            uint64_t what = e.what.load(std::memory_order_relaxed);
+            if (uint64_t t = e.time.load(std::memory_order_relaxed)) {
+                time = t;
             }
-#ifndef DEBUG_ALL_OUTS
+            if (time) {
+                crash_put("    -");
+                crash_put_num(uintptr_t(now > time ? double(now - time) * tick_ns / 1000 : 0), 10);
+                crash_put(" us ");
+            } else {
+                crash_put("    ? us ");
+            }
+            crash_put(FlightRecorder::event_name(FlightEvent(what >> 32)));
+            crash_put(" ");
+            crash_put_num(uintptr_t(uint32_t(what)), 10);
+            crash_put(" ");
+            crash_put_num(uintptr_t(e.object.load(std::memory_order_relaxed)), 16);
+            crash_put("\n");
+        }
+    }
+    crash_put("\n---------[END] [FLIGHT RECORDER]---------\n");
+    crash_flush();
+    crash_fd = previous_fd;
+}
+
+void dump_flight_recorder(int fd)
+{
+    if (stacks_dumping.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+    //The crash handler writes the rings itself, none starts after it.
+    if (!crash_handling.load()) {
+        put_flight_recorder(fd);
+    }
+    stacks_dumping.store(false, std::memory_order_release);
+}
+
+static bool report_write(int fd, const void *data, size_t len)
+{
+    const char *c = static_cast<const char *>(data);
+    while (len) {
+        ssize_t w = write(fd, c, len);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        } else if (w <= 0) {
+            return false;
+        }
+        c += w;
+        len -= size_t(w);
+    }
+    return true;
+}
+
+static void report_record(int fd, uint32_t type, uint64_t size)
+{
+    CrashFormat::RecordHeader h = {type, 0, size};
+    report_write(fd, &h, sizeof(h));
+}
+
+//write(2) straight from the memory: an unreadable page fails with EFAULT instead of faulting, and is written as zeros.
+static void report_memory(int fd, uintptr_t from, size_t len)
+{
+    static const char zeros[4096] = {0};
+    while (len) {
+        ssize_t w = write(fd, reinterpret_cast<const void *>(from), len);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        } else if (w > 0) {
+            from += size_t(w);
+            len -= size_t(w);
+            continue;
+        }
+        size_t n = std::min(len, sizeof(zeros) - from % sizeof(zeros));
+        if (!report_write(fd, zeros, n)) {
+            return;
         }
+        from += n;
+        len -= n;
+    }
+}
+
+//From sp (and its red zone) up, the top of the stack when it is not known, within the mapping. Then the frames the
+//thread unwound, if any.
+static void report_thread(int fd, int tid, int id, const char *name, uintptr_t low, uintptr_t high, uintptr_t sp, bool crashed,
+                          void *const *pcs, int depth)
+{
+    CrashFormat::CrashThread t = {};
+    t.tid = tid;
+    t.id = id;
+    strncpy(t.name, name, sizeof(t.name) - 1);
+    uintptr_t start, stop;
+    const char *fields, *eol;
+    if (!high && crash_find_mapping(sp, start, stop, fields, eol)) {
+        low = start;
+        high = stop;
+    }
+    size_t bytes = crashed ? CRASH_STACK_BYTES : THREAD_STACK_BYTES;
+    uintptr_t from = sp > 128 ? sp - 128 : (high > bytes ? high - bytes : 0);
+    uintptr_t to = high - from > bytes ? from + bytes : high;
+    if (crash_find_mapping(high - 1, start, stop, fields, eol)) {
+        from = std::max(from, start);
+        to = std::min(to, stop);
+    }
+    from = std::max(from, low);
+    if (to < from) {
+        to = from;
+    }
+    t.stack_low = low;
+    t.stack_high = high;
+    t.sp = sp;
+    t.dump_start = from;
+    t.crashed = crashed;
+    report_record(fd, CrashFormat::Thread, sizeof(t) + (to - from));
+    report_write(fd, &t, sizeof(t));
+    report_memory(fd, from, to - from);
+
+    if (depth > 0) {
+        CrashFormat::CrashFrames f = {tid, uint32_t(depth)};
+        static_assert(sizeof(void *) == sizeof(uint64_t), "The frames are written as they are in memory");
+        report_record(fd, CrashFormat::Frames, sizeof(f) + size_t(depth) * sizeof(uint64_t));
+        report_write(fd, &f, sizeof(f));
+        report_write(fd, pcs, size_t(depth) * sizeof(uint64_t));
+    }
+}
+
+template<class F>
+static void report_tracked(int fd, uint32_t type, F &&walk)
+{
+    size_t n = 0;
+    walk([&n](int id, const void *object, bool running) {
+        if (n < sizeof(crash_tracked) / sizeof(crash_tracked[0])) {
+            crash_tracked[n++] = {id, running, uint64_t(uintptr_t(object))};
+        }
+    });
+    report_record(fd, type, n * sizeof(crash_tracked[0]));
+    report_write(fd, crash_tracked, n * sizeof(crash_tracked[0]));
+}
+
+//Only write(2) from buffers set before: milliseconds, as each stack is bounded and goes in one call.
+static bool write_crash_report(int sig, siginfo_t *siginfo, ucontext_t *uc, uint32_t request, void *const *frames, int depth)
+{
+    int fd = open(crash_report_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    int self = int(syscall(SYS_gettid));
+
+    CrashFormat::FileHeader header = {};
+    memcpy(header.magic, CrashFormat::MAGIC, sizeof(header.magic));
+    header.version = CrashFormat::VERSION;
+#if defined(__x86_64__)
+    header.machine = EM_X86_64;
+#elif defined(__aarch64__)
+    header.machine = EM_AARCH64;
+#endif
+    report_write(fd, &header, sizeof(header));
+
+    CrashFormat::CrashInfo info = {};
+    info.signal = sig;
+    info.code = siginfo->si_code;
+    info.pid = int(getpid());
+    info.tid = self;
+    info.address = uint64_t(uintptr_t(siginfo->si_addr));
+    info.time = int64_t(time(nullptr));
+    strncpy(info.binary, crash_bin_path, sizeof(info.binary) - 1);
+    report_record(fd, CrashFormat::Info, sizeof(info));
+    report_write(fd, &info, sizeof(info));
+
+    CrashFormat::CrashRegisters regs = {};
+#if defined(__x86_64__)
+    regs.pc = uint64_t(uc->uc_mcontext.gregs[REG_RIP]);
+    regs.sp = uint64_t(uc->uc_mcontext.gregs[REG_RSP]);
+    regs.fp = uint64_t(uc->uc_mcontext.gregs[REG_RBP]);
+    regs.count = NGREG;
+    for (int i = 0; i < NGREG; i++) {
+        regs.regs[i] = uint64_t(uc->uc_mcontext.gregs[i]);
+    }
+#elif defined(__aarch64__)
+    regs.pc = uc->uc_mcontext.pc;
+    regs.sp = uc->uc_mcontext.sp;
+    regs.fp = uc->uc_mcontext.regs[29];
+    regs.count = 31;
+    for (int i = 0; i < 31; i++) {
+        regs.regs[i] = uc->uc_mcontext.regs[i];
+    }
+#else
+    (void)uc;
 #endif
+    report_record(fd, CrashFormat::Registers, sizeof(regs));
+    report_write(fd, &regs, sizeof(regs));
 
-        const char *sigVal;
-        switch (sig) {
-            case SIGTERM: sigVal = "SIGTERM"; break;
-            case SIGILL: sigVal = "SIGILL"; break;
-            case SIGSEGV: sigVal = "SIGSEGV"; break;
-            case SIGINT: sigVal = "SIGINT"; break;
-            case SIGABRT: sigVal = "SIGABRT"; break;
-            case SIGFPE: sigVal = "SIGFPE"; break;
+    //The crashing thread first, even if it was never registered.
+    const CrashThreadSlot *own = nullptr;
+    for (const CrashThreadSlot &slot : crash_threads) {
+        if (slot.tid.load(std::memory_order_acquire) == self) {
+            own = &slot;
+        }
+    }
+    report_thread(fd, self, own ? own->id : -1, own ? own->name : "", own ? own->stack_low : 0, own ? own->stack_high : 0, uintptr_t(regs.sp), true,
+                  frames, depth);
+    for (const CrashThreadSlot &slot : crash_threads) {
+        int tid = slot.tid.load(std::memory_order_acquire);
+        if (tid > 0 && tid != self) {
+            bool answered = slot.answered.load(std::memory_order_acquire) == request;
+            report_thread(fd, tid, slot.id, slot.name, slot.stack_low, slot.stack_high, answered ? slot.sp : 0, false, slot.pcs, answered ? slot.depth : 0);
         }
+    }
 
-        std::cerr << "RECEIVED SIGNAL: " << sigVal << std::endl;
+    report_record(fd, CrashFormat::Maps, crash_maps_len);
+    report_write(fd, crash_maps, crash_maps_len);
 
-        //Last flush :=[
-        fflush(stdout);
-        fflush(stderr);
-        fflush(stdin);
+#ifdef THREAD_TRACKING
+    report_tracked(fd, CrashFormat::Threads, [](auto &&add) {
+        ThreadTracker::get()->for_each([&add](int id, AbstractThread *t, bool running) {add(id, t, running);});
+    });
+#endif
+#ifdef SIGSOT_TRACKING
+    if (SignalTracker::accessible()) {
+        report_tracked(fd, CrashFormat::Signals, [](auto &&add) {
+            SignalTracker::get()->for_each([&add](int id, AbstractSignalTracking *s, bool tracked) {add(id, s, tracked);});
+        });
+    }
+#endif
+
+#ifdef FLIGHT_RECORDER
+    CrashFormat::CrashFlight flight = {FlightRecorder::tick_ns(), FlightRecorder::now(), uint32_t(FlightRecorder::SIZE), 0};
+    //The list only grows: the rings counted are there when written, a newer one is left out.
+    FlightRecorder::Ring *first = FlightRecorder::rings();
+    size_t rings = 0;
+    for (FlightRecorder::Ring *r = first; r; r = r->next) {
+        rings++;
+    }
+    report_record(fd, CrashFormat::Flight, sizeof(flight) + rings * (sizeof(CrashFormat::CrashFlightRing) + sizeof(crash_flight_entries)));
+    report_write(fd, &flight, sizeof(flight));
+    for (FlightRecorder::Ring *r = first; r; r = r->next) {
+        CrashFormat::CrashFlightRing ring = {};
+        ring.tid = int(r->tid);
+        ring.id = r->id;
+        memcpy(ring.name, r->name, sizeof(ring.name));
+        ring.count = r->count.load(std::memory_order_acquire);
+        ring.used = r->used.load();
+        for (size_t i = 0; i < FlightRecorder::SIZE; i++) {
+            crash_flight_entries[i] = {r->entries[i].time.load(std::memory_order_relaxed), r->entries[i].what.load(std::memory_order_relaxed),
+                                       uint64_t(uintptr_t(r->entries[i].object.load(std::memory_order_relaxed)))};
+        }
+        report_write(fd, &ring, sizeof(ring));
+        report_write(fd, crash_flight_entries, sizeof(crash_flight_entries));
+    }
+#endif
 
+    report_record(fd, CrashFormat::End, 0);
+    close(fd);
+    return true;
+}
+
+//For the crash handler, which never gives it back. A dump holding it for longer than a dump takes (its thread crashed
+//in it, or is stopped) is cut short: the crash output starts over from an empty buffer, on stderr.
+static void claim_crash_out()
+{
+    timespec ms = {0, 1000000};
+    for (int waited = 0; stacks_dumping.exchange(true, std::memory_order_acquire); waited++) {
+        if (waited >= 2 * STACKS_TIMEOUT_MS) {
+            crash_out_len = 0;
+            crash_fd = STDERR_FILENO;
+            return;
+        }
+        nanosleep(&ms, nullptr);
+    }
+}
+
+void handleSignals [[ noreturn ]] (int sig, siginfo_t *info, void *context)
+{
+    //Another thread crashing meanwhile waits for this one to end the process.
+    if (crash_handling.exchange(true)) {
+        for (;;) {
+            pause();
+        }
+    }
+
+    //Before anything is printed, while the other threads are still where they were: each one gives its stack.
+    //A fault only: SIGINT and SIGTERM end the process on request, there is nothing to report nor to wait for.
+    claim_crash_out();
+    crash_read_maps();
+    bool fault = sig == SIGSEGV || sig == SIGBUS || sig == SIGILL || sig == SIGFPE || sig == SIGABRT;
+    int self = int(syscall(SYS_gettid));
+    uint32_t request = fault ? collect_thread_stacks(self) : NO_REQUEST;
+
+    //Loaded and warmed up by setup_sig_handle(), so it does not allocate.
+    //From the faulting pc: the handler runs on its own stack, a plain backtrace() stops at the signal frame.
+    uintptr_t stack_low = 0, stack_high = 0;
+    for (const CrashThreadSlot &slot : crash_threads) {
+        if (slot.tid.load(std::memory_order_acquire) == self) {
+            stack_low = slot.stack_low;
+            stack_high = slot.stack_high;
+        }
+    }
+    int size = StackTrace::capture_context(context, crash_frames, MAX_STACK_FRAMES, stack_low, stack_high);
+    bool reported = crash_report_set && fault && write_crash_report(sig, info, static_cast<ucontext_t *>(context), request, crash_frames, size);
+
+#ifndef FORCE_DEBUG
+    if (active_debug) {
+#endif
+        crash_put("\nRECEIVED SIGNAL: ");
+        crash_put(signal_name(sig));
+        if (sig == SIGSEGV || sig == SIGBUS || sig == SIGILL || sig == SIGFPE) {
+            crash_put(" at ");
+            crash_put_num(uintptr_t(info->si_addr), 16);
+        }
+        crash_put(" in thread ");
+        crash_put_num(uintptr_t(self), 10);
+        crash_put("\n");
+#ifdef THREAD_TRACKING
+        crash_put("    > Stopped ones [");
+        crash_put_num(ThreadTracker::get()->count(false), 10);
+        crash_put("/");
+        crash_put_num(ThreadTracker::get()->count(true), 10);
+        crash_put("] running ones\n");
+#endif
+#ifndef DEBUG_ALL_OUTS
+        if (sig != SIGINT) { //No need to print anything as the user wanted to kill it! Normal.
+#endif
+            crash_put("\n-----------[BEG] [CRASH FRAMES]-----------\n\n");
+            for (int i = 0; i < size; i++) {
+                crash_put_frame(i, crash_frames[i]);
+            }
+            if (size == MAX_STACK_FRAMES) {
+                crash_put("[truncated]\n");
+            }
+            crash_put("\n-----------[END] [CRASH FRAMES]-----------\n");
+            if (request != NO_REQUEST) {
+                crash_put_thread_stacks(request, self, nullptr, 0);
+            }
+            crash_put("Binary: ");
+            crash_put(crash_bin_path);
+            crash_put("\nSymbolize a frame with: addr2line -C -f -e <module> <offset>\n");
+#ifdef FLIGHT_RECORDER
+            //A file of its own: 256 events per thread would drown the frames.
+            crash_flush();
+            int fd = open(crash_flight_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0) {
+                put_flight_recorder(fd);
+                close(fd);
+                crash_put("Flight recorder: ");
+                crash_put(crash_flight_path);
+                crash_put("\n");
+            }
+#endif
+            if (reported) {
+                crash_put("Crash report: ");
+                crash_put(crash_report_path);
+                crash_put("\n");
+            }
+#ifndef DEBUG_ALL_OUTS
+        }
+#endif
+        crash_flush();
 #ifndef FORCE_DEBUG
     }
 #endif
 
-    if (active_mtrace) {
-        muntrace();
+    _exit(sig);
+}
+
+static CrashThreadSlot *register_crash_thread(const char *name, int id)
+{
+    void *addr = nullptr;
+    size_t size = 0;
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
     }
+    for (CrashThreadSlot &slot : crash_threads) {
+        int free_slot = 0;
+        if (slot.tid.compare_exchange_strong(free_slot, -1)) {
+            slot.id = id;
+            strncpy(slot.name, name ? name : "", sizeof(slot.name) - 1);
+            slot.stack_low = uintptr_t(addr);
+            slot.stack_high = uintptr_t(addr) + size;
+            slot.tid.store(int(syscall(SYS_gettid)), std::memory_order_release);
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+void setup_thread_sig_stack(const char *name, int id)
+{
+    //Listed for the crash report until the thread ends, the handler set or not.
+    struct Registration {
+        Registration(const char *name, int id) : slot(register_crash_thread(name, id)) {}
+        ~Registration() {
+            if (slot) {
+                slot->tid.store(0, std::memory_order_release);
+            }
+        }
+        CrashThreadSlot *slot;
+    };
+    static thread_local Registration registration(name, id);
+    (void)registration;
 
-    exit(sig);
+    if (!crash_handler_set) {
+        return;
+    }
+    //One per thread, freed when it ends.
+    struct AltStack {
+        AltStack() : mem(new char[ALT_STACK_SIZE]) {
+            stack_t ss = {};
+            ss.ss_sp = mem.get();
+            ss.ss_size = ALT_STACK_SIZE;
+            sigaltstack(&ss, nullptr);
+        }
+        ~AltStack() {
+            stack_t ss = {};
+            ss.ss_flags = SS_DISABLE;
+            sigaltstack(&ss, nullptr);
+        }
+        std::unique_ptr<char[]> mem;
+    };
+    static thread_local AltStack alt;
+    (void)alt;
 }
 
-void setup_sig_handle(char *argo, bool mtrack, bool dbg)
+void setup_sig_handle(char *argo, bool mtrack, bool dbg, bool report)
 {
     active_mtrace = mtrack;
     active_debug = dbg;
+    if (mtrack && !AllocProfiler::get()->start()) {
+        std::cout << "Allocation tracking asked but ALLOC_PROFILING is not defined: nothing will be recorded" << std::endl;
+    }
 
     bin_path = get_path(argo);
+    strncpy(crash_bin_path, bin_path.c_str(), sizeof(crash_bin_path) - 1);
+    snprintf(crash_flight_path, sizeof(crash_flight_path), "%s.%d.flight", bin_path.substr(bin_path.rfind('/') + 1).c_str(), int(getpid()));
+    snprintf(crash_report_path, sizeof(crash_report_path), "%s.%d.crash", bin_path.substr(bin_path.rfind('/') + 1).c_str(), int(getpid()));
+    crash_report_set = report;
+    size_crash_maps();
+    setup_thread_sig_stack("main");
+    setup_stack_signal();
 
-    signal(SIGTERM, handleSignals);
-    signal(SIGSEGV, handleSignals);
-    signal(SIGILL, handleSignals);
-    signal(SIGINT, handleSignals);
-    signal(SIGABRT, handleSignals);
-    signal(SIGFPE, handleSignals);
+    //A stack overflow leaves no room on the thread's stack to run the handler.
+    stack_t ss = {};
+    ss.ss_sp = main_alt_stack;
+    ss.ss_size = ALT_STACK_SIZE;
+    sigaltstack(&ss, nullptr);
+
+    struct sigaction sa = {};
+    sa.sa_sigaction = handleSignals;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for (int sig : {SIGTERM, SIGSEGV, SIGBUS, SIGILL, SIGINT, SIGABRT, SIGFPE}) {
+        sigaction(sig, &sa, nullptr);
+    }
+    crash_handler_set = true;
 }
 
 
@@ -228,18 +1031,12 @@ void print_stack_trace()
 {
     void *array[MAX_STACK_FRAMES];
     size_t size = 0;
-    char **strings = nullptr;
     size_t i;
-    size = static_cast<size_t>(backtrace(array, MAX_STACK_FRAMES));
-    strings = backtrace_symbols(array, int(size));
+    size = static_cast<size_t>(StackTrace::capture(array, MAX_STACK_FRAMES));
     std::cout << "\n----------[BEG] [PROG CALL STACK]----------\n" << "\n-----------[BEG] [ADDR2LINE LOG]-----------\n" << std::endl;
 
     for (i = 0; i < size; ++i) {
-        std::string symbol(strings[i]);
-        size_t pos1 = symbol.find("[");
-        std::string address = symbol.substr(pos1 +1, symbol.find_last_of("]") -pos1 -1);
-
-        std::cerr << execute_addr_l(address) << std::endl;
+        std::cerr << addr2line_format((char *)array[i] - 1) << std::endl;
     }
 
     std::cout << "\n-----------[END] [ADDR2LINE LOG]-----------\n" << "\n----------[BEG] [PROG OFFSET LOG]----------\n" << std::endl;
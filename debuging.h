@@ -1,9 +1,26 @@
 #pragma once
 
+#include <signal.h>
+
 namespace CppUtilities {
-void setup_sig_handle(char *argo, bool mtrack, bool dbg);
+//With report, a fault (not SIGINT nor SIGTERM) also writes a binary report, <binary name>.<pid>.crash in the working
+//directory: read it with CrashReport (crash_report.h).
+void setup_sig_handle(char *argo, bool mtrack, bool dbg, bool report = false);
+//Gives the calling thread its own stack for the crash handler, once setup_sig_handle() was called, and lists it for the
+//crash report under that name and id. The threads of the library call it.
+void setup_thread_sig_stack(const char *name = nullptr, int id = -1);
 void print_cerr_thread_log();
 void print_sig_path(int sig);
 
 void print_stack_trace();
+//Writes the FlightRecorder rings, async-signal-safe: the crash handler does it into <binary name>.<pid>.flight in the
+//working directory. A call while a dump_thread_stacks(), another one or the crash handler runs returns at once.
+void dump_flight_recorder(int fd);
+//Writes the stacks of all the threads setup_thread_sig_stack() listed, async-signal-safe: each one is interrupted by
+//SIGRTMIN + 2 to unwind itself, and waited for up to 200 ms. Frames are given as module and offset, like the crash
+//ones (the crash handler writes them too). Needs setup_sig_handle() or setup_stack_dump_signal() called before; a
+//call while another one runs returns at once.
+void dump_thread_stacks(int fd);
+//Dumps them on stderr each time sig is received, for a process that hangs: kill -USR1 <pid>.
+void setup_stack_dump_signal(int sig = SIGUSR1);
 }
@@ -0,0 +1,87 @@
+#include "event_bus.h"
+
+namespace CppUtilities {
+
+TopicRegistry *TopicRegistry::get()
+{
+    //Never deleted, Topics may be built until the very end.
+    static TopicRegistry *inst = new TopicRegistry;
+    return inst;
+}
+
+uint32_t TopicRegistry::intern(const std::string &name)
+{
+    mtx.lock();
+    auto it = ids.find(name);
+    uint32_t id;
+    if (it != ids.end()) {
+        id = it->second;
+    } else {
+        id = names.size();
+        names.push_back(name);
+        ids.insert({name, id});
+    }
+    mtx.unlock();
+    return id;
+}
+
+std::string TopicRegistry::name(uint32_t id)
+{
+    mtx.lock();
+    std::string n = id < names.size() ? names[id] : "";
+    mtx.unlock();
+    return n;
+}
+
+static std::vector<std::string> split_topic(const std::string &topic)
+{
+    std::vector<std::string> segments;
+    size_t start = 0;
+    for (;;) {
+        size_t dot = topic.find('.', start);
+        segments.push_back(topic.substr(start, dot - start));
+        if (dot == std::string::npos) {
+            break;
+        }
+        start = dot + 1;
+    }
+    return segments;
+}
+
+TopicPattern::TopicPattern(const std::string &pattern)
+{
+    _segments = split_topic(pattern);
+    for (const std::string &s : _segments) {
+        if (s == "*" || s == "**") {
+            _exact = false;
+        }
+    }
+}
+
+bool TopicPattern::matches(const std::string &topic) const
+{
+    return matches(split_topic(topic), 0, 0);
+}
+
+bool TopicPattern::matches(const std::vector<std::string> &topic, size_t t, size_t p) const
+{
+    for (; p < _segments.size(); p++, t++) {
+        if (_segments[p] == "**") {
+            //Tries each number of segments it can take, from none.
+            for (size_t skip = t; skip <= topic.size(); skip++) {
+                if (matches(topic, skip, p + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        if (t >= topic.size() || (_segments[p] != "*" && _segments[p] != topic[t])) {
+            return false;
+        }
+    }
+    return t == topic.size();
+}
+
+/* Template type predefs */
+template class EventBus<void>;
+}
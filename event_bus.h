@@ -0,0 +1,278 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include "signals_slots.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+
+namespace CppUtilities {
+
+//Topic names are interned once into ids, shared by all the buses. Id 0 is no topic.
+class TopicRegistry
+{
+public:
+    static TopicRegistry *get();
+
+    uint32_t intern(const std::string &name);
+    std::string name(uint32_t id);
+
+private:
+    TopicRegistry() {};
+
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> names = {""};
+    std::mutex mtx;
+};
+
+//Keep them rather than names: building one from a name looks it up in the registry.
+struct Topic
+{
+    inline Topic(const std::string &name) : id(TopicRegistry::get()->intern(name)) {};
+    inline Topic(const char *name) : Topic(std::string(name)) {};
+    inline std::string name() const {return TopicRegistry::get()->name(id);};
+
+    uint32_t id;
+};
+
+/**
+ * A pattern is a topic whose dot separated segments can be * (any s
+ * egment) or ** (any number of segments, none included): "sensor.*.
+ * temp", "sensor.**". It is split once, at subscribe time, and only
+ * matched against a topic the first time the bus sees that topic.
+ **/
+class TopicPattern
+{
+public:
+    explicit TopicPattern(const std::string &pattern);
+
+    bool matches(const std::string &topic) const;
+    inline bool exact() const {return _exact;};
+
+private:
+    bool matches(const std::vector<std::string> &topic, size_t t, size_t p) const;
+
+    std::vector<std::string> _segments;
+    bool _exact = true;
+};
+
+using SubscriptionId = uint32_t;
+
+/**
+ * Routes emits by topic: each topic has its own SignalMulti, found
+ * from the topic id in an open-addressing table read without lock,
+ * so an emit costs a hash probe on top of the SignalMulti's. A subs
+ * cription is a ftor and a pattern: it is connected (as a copy, with
+ * the same target thread) to each matching topic, those seen later
+ * included.
+ **/
+template<class C = void, class ... Args>
+class EventBus
+{
+public:
+    using function_t = std::function<C(Args ...)>;
+    using signal_t = SignalMulti<C, Args ...>;
+
+    inline explicit EventBus(std::string sn = "Undefined") : _name(sn) {_table.store(grow(nullptr));};
+    inline ~EventBus();
+    EventBus(const EventBus &) = delete;
+    EventBus &operator=(const EventBus &) = delete;
+
+    //The bus owns the ftor.
+    inline SubscriptionId subscribe(const std::string &pattern, GenericFunctor<C, Args ...> *f);
+    inline SubscriptionId subscribe(const std::string &pattern, function_t f) {return subscribe(pattern, new GenericFunctor<C, Args ...>(f));};
+    inline bool unsubscribe(SubscriptionId id);
+
+    template<class ... Vals> inline void emit(Topic topic, Vals && ... vals);
+    //The topic's own signal, to connect to it or emit it directly.
+    inline signal_t *signal(Topic topic);
+
+private:
+    struct Bucket {
+        std::atomic<uint32_t> topic {0};
+        std::atomic<signal_t *> signal {nullptr};
+    };
+    struct Table {
+        uint32_t mask;
+        uint32_t count;
+        std::unique_ptr<Bucket[]> buckets;
+    };
+    struct Subscription {
+        SubscriptionId id;
+        TopicPattern pattern;
+        std::unique_ptr<GenericFunctor<C, Args ...>> ftor;
+        std::vector<Connection> connections;
+    };
+
+    inline static uint32_t slot(uint32_t topic, uint32_t mask) {return (topic * 0x9E3779B1u >> 7) & mask;};
+    inline signal_t *find(uint32_t topic);
+    inline signal_t *materialize(Topic topic);
+    inline void insert_locked(Table *table, uint32_t topic, signal_t *sig);
+    inline Table *grow(Table *from);
+    inline void connect_locked(Subscription &s, signal_t *sig);
+
+    std::string _name;
+    std::atomic<Table *> _table {nullptr};
+    //Tables replaced by a bigger one, an emit may still be reading them.
+    std::vector<std::unique_ptr<Table>> _tables;
+    std::vector<std::pair<std::string, std::unique_ptr<signal_t>>> _signals;
+    std::vector<std::unique_ptr<Subscription>> _subscriptions;
+    SubscriptionId _last_id = 0;
+    std::mutex mtx;
+};
+
+
+
+template<class C, class ... Args> inline
+EventBus<C, Args ...>::~EventBus()
+{
+    //The topics' signals delete their copies, then the subscriptions their originals.
+    _signals.clear();
+    _subscriptions.clear();
+}
+
+template<class C, class ... Args> template<class ... Vals> inline
+void EventBus<C, Args ...>::emit(Topic topic, Vals && ... vals)
+{
+    signal_t *sig = find(topic.id);
+    if (!sig) {
+        sig = materialize(topic);
+    }
+    sig->emit(std::forward<Vals>(vals) ...);
+}
+
+template<class C, class ... Args> inline
+typename EventBus<C, Args ...>::signal_t *EventBus<C, Args ...>::signal(Topic topic)
+{
+    signal_t *sig = find(topic.id);
+    return sig ? sig : materialize(topic);
+}
+
+template<class C, class ... Args> inline
+typename EventBus<C, Args ...>::signal_t *EventBus<C, Args ...>::find(uint32_t topic)
+{
+    Table *table = _table.load(std::memory_order_acquire);
+    for (uint32_t i = slot(topic, table->mask);; i = (i + 1) & table->mask) {
+        uint32_t t = table->buckets[i].topic.load(std::memory_order_acquire);
+        if (t == topic) {
+            return table->buckets[i].signal.load(std::memory_order_relaxed);
+        } else if (t == 0) {
+            return nullptr;
+        }
+    }
+}
+
+//First emit (or signal()) of a topic on this bus: the patterns are matched against it here only.
+template<class C, class ... Args> inline
+typename EventBus<C, Args ...>::signal_t *EventBus<C, Args ...>::materialize(Topic topic)
+{
+    mtx.lock();
+    signal_t *sig = find(topic.id);
+    if (!sig) {
+        std::string name = topic.name();
+        sig = new signal_t(_name + ":" + name);
+        _signals.emplace_back(name, sig);
+        for (std::unique_ptr<Subscription> &s : _subscriptions) {
+            if (s->pattern.matches(name)) {
+                connect_locked(*s, sig);
+            }
+        }
+
+        Table *table = _table.load();
+        //Half full at most, so the probes stay short.
+        if ((table->count + 1) * 2 > table->mask + 1) {
+            table = grow(table);
+            _table.store(table, std::memory_order_release);
+        }
+        insert_locked(table, topic.id, sig);
+    }
+    mtx.unlock();
+    return sig;
+}
+
+template<class C, class ... Args> inline
+void EventBus<C, Args ...>::insert_locked(Table *table, uint32_t topic, signal_t *sig)
+{
+    uint32_t i = slot(topic, table->mask);
+    while (table->buckets[i].topic.load() != 0) {
+        i = (i + 1) & table->mask;
+    }
+    //The signal first: a reader seeing the topic sees it.
+    table->buckets[i].signal.store(sig, std::memory_order_relaxed);
+    table->buckets[i].topic.store(topic, std::memory_order_release);
+    table->count++;
+}
+
+template<class C, class ... Args> inline
+typename EventBus<C, Args ...>::Table *EventBus<C, Args ...>::grow(Table *from)
+{
+    uint32_t size = from ? (from->mask + 1) * 2 : 16;
+    Table *table = new Table {size - 1, 0, std::unique_ptr<Bucket[]>(new Bucket[size])};
+    if (from) {
+        for (uint32_t i = 0; i <= from->mask; i++) {
+            if (uint32_t t = from->buckets[i].topic.load()) {
+                insert_locked(table, t, from->buckets[i].signal.load());
+            }
+        }
+    }
+    _tables.emplace_back(table);
+    return table;
+}
+
+template<class C, class ... Args> inline
+void EventBus<C, Args ...>::connect_locked(Subscription &s, signal_t *sig)
+{
+    GenericFunctor<C, Args ...> *copy = new GenericFunctor<C, Args ...>(s.ftor->target(), s.ftor->name(), s.ftor->get());
+    copy->set_blocking(s.ftor->blocking());
+    if constexpr (sizeof ... (Args) > 0) {
+        copy->set_affinity(s.ftor->key());
+    }
+    s.connections.push_back(sig->connect(copy));
+}
+
+template<class C, class ... Args> inline
+SubscriptionId EventBus<C, Args ...>::subscribe(const std::string &pattern, GenericFunctor<C, Args ...> *f)
+{
+    TopicPattern compiled(pattern);
+    signal_t *exact = compiled.exact() ? signal(pattern) : nullptr;
+
+    mtx.lock();
+    Subscription *s = new Subscription {++_last_id, std::move(compiled), std::unique_ptr<GenericFunctor<C, Args ...>>(f), {}};
+    _subscriptions.emplace_back(s);
+    if (exact) {
+        connect_locked(*s, exact);
+    } else {
+        for (std::pair<std::string, std::unique_ptr<signal_t>> &sig : _signals) {
+            if (s->pattern.matches(sig.first)) {
+                connect_locked(*s, sig.second.get());
+            }
+        }
+    }
+    SubscriptionId id = s->id;
+    mtx.unlock();
+    return id;
+}
+
+template<class C, class ... Args> inline
+bool EventBus<C, Args ...>::unsubscribe(SubscriptionId id)
+{
+    mtx.lock();
+    for (auto it = _subscriptions.begin(); it != _subscriptions.end(); ++it) {
+        if ((*it)->id == id) {
+            for (Connection &c : (*it)->connections) {
+                c.disconnect();
+            }
+            _subscriptions.erase(it);
+            mtx.unlock();
+            return true;
+        }
+    }
+    mtx.unlock();
+    return false;
+}
+}
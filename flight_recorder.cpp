@@ -0,0 +1,138 @@
+#include "flight_recorder.h"
+
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace CppUtilities {
+
+static std::mutex rings_mtx;
+static std::atomic<FlightRecorder::Ring *> ring_list = {nullptr};
+static FlightRecorder::Ring *const THREAD_ENDED = reinterpret_cast<FlightRecorder::Ring *>(1);
+static thread_local FlightRecorder::Ring *tls_ring __attribute__((tls_model("initial-exec"))) = nullptr;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+//Both clocks read at the first record, to convert ticks at dump time.
+static std::atomic<uint64_t> base_ticks = {0};
+static std::atomic<uint64_t> base_ns = {0};
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+uint64_t FlightRecorder::now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return monotonic_ns();
+#endif
+}
+
+double FlightRecorder::tick_ns()
+{
+    uint64_t t0 = base_ticks.load(), ns0 = base_ns.load();
+    uint64_t t1 = now(), ns1 = monotonic_ns();
+    return t0 && t1 > t0 ? double(ns1 - ns0) / double(t1 - t0) : 1.0;
+}
+
+FlightRecorder::Ring *FlightRecorder::rings()
+{
+    return ring_list.load(std::memory_order_acquire);
+}
+
+const char *FlightRecorder::event_name(FlightEvent event)
+{
+    switch (event) {
+        case FlightEvent::None: return "NONE";
+        case FlightEvent::Emit: return "EMIT";
+        case FlightEvent::SlotCall: return "SLOT_CALL";
+        case FlightEvent::AddCallback: return "ADD_CALLBACK";
+        case FlightEvent::ExecuteBegin: return "EXECUTE_BEGIN";
+        case FlightEvent::ExecuteEnd: return "EXECUTE_END";
+    }
+    return "UNKNOWN";
+}
+
+//pthread key destructor: the ring can be taken by a new thread, this one records nothing more.
+static void thread_ended(void *p)
+{
+    tls_ring = THREAD_ENDED;
+    static_cast<FlightRecorder::Ring *>(p)->used.store(false, std::memory_order_release);
+}
+
+//First record of a thread: the ring of an ended thread, else a new one. Never freed.
+static FlightRecorder::Ring *claim()
+{
+    rings_mtx.lock();
+    if (!base_ticks.load()) {
+        base_ns = monotonic_ns();
+        base_ticks = FlightRecorder::now();
+    }
+    FlightRecorder::Ring *r = ring_list.load();
+    while (r && r->used.load(std::memory_order_acquire)) {
+        r = r->next;
+    }
+    if (r) {
+        r->count.store(0, std::memory_order_relaxed);
+        r->id = -1;
+        r->name[0] = 0;
+    } else {
+        r = new (malloc(sizeof(FlightRecorder::Ring))) FlightRecorder::Ring;
+        r->next = ring_list.load();
+        ring_list.store(r, std::memory_order_release);
+    }
+    r->used.store(true, std::memory_order_relaxed);
+    r->tid = pid_t(syscall(SYS_gettid));
+    rings_mtx.unlock();
+
+    pthread_once(&ring_key_once, []() {pthread_key_create(&ring_key, thread_ended);});
+    pthread_setspecific(ring_key, r);
+    tls_ring = r;
+    return r;
+}
+
+void FlightRecorder::record(FlightEvent event, uint32_t id, const void *object, bool timed)
+{
+    Ring *r = tls_ring;
+    if (__builtin_expect(r == nullptr, 0)) {
+        r = claim();
+    } else if (r == THREAD_ENDED) {
+        return;
+    }
+    uint64_t n = r->count.load(std::memory_order_relaxed);
+    Entry &e = r->entries[n & (SIZE - 1)];
+    e.time.store(timed ? now() : 0, std::memory_order_relaxed);
+    e.what.store(uint64_t(event) << 32 | id, std::memory_order_relaxed);
+    e.object.store(object, std::memory_order_relaxed);
+    r->count.store(n + 1, std::memory_order_release);
+}
+
+void FlightRecorder::set_thread(const std::string &name, int id)
+{
+    Ring *r = tls_ring;
+    if (r == THREAD_ENDED) {
+        return;
+    } else if (!r) {
+        r = claim();
+    }
+    r->id = id;
+    strncpy(r->name, name.c_str(), sizeof(r->name) - 1);
+}
+}
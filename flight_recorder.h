@@ -0,0 +1,64 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include <sys/types.h>
+
+namespace CppUtilities {
+
+enum class FlightEvent : uint32_t {
+    None,
+    Emit,           //id: the signal's, object: the signal.
+    SlotCall,       //id: the signal's, object: the ftor.
+    AddCallback,    //id: the target thread's, object: the executor.
+    ExecuteBegin,   //id: the running thread's, object: the executor.
+    ExecuteEnd
+};
+
+/**
+ * Last events of each thread, kept in a ring of its own: the crash
+ * handler dumps them all (dump_flight_recorder() in debuging.h), to
+ * see what each loop was doing before the process died. A record is
+ * a time stamp counter read and three relaxed stores into the thread
+ * 's ring, no lock; the rings of ended threads are reused.
+ **/
+class FlightRecorder
+{
+public:
+    static const size_t SIZE = 256; //Events per thread, a power of 2.
+
+    struct Entry {
+        std::atomic<uint64_t> time = {0}; //Ticks, see now(). 0 when untimed.
+        std::atomic<uint64_t> what = {0}; //FlightEvent << 32 | id.
+        std::atomic<const void *> object = {nullptr};
+    };
+    struct Ring {
+        Entry entries[SIZE];
+        std::atomic<uint64_t> count = {0}; //Events ever recorded: the next one goes at count % SIZE.
+        std::atomic<bool> used = {false};
+        Ring *next = nullptr;
+        pid_t tid = 0;
+        int id = -1;
+        char name[32] = {0};
+    };
+
+    //Untimed, an event takes the time of the thread's previous one: for those that right follow another (a slot
+    //call and its emit), as the counter read is most of the cost.
+    static void record(FlightEvent event, uint32_t id, const void *object, bool timed = true);
+    //Names the calling thread's ring (the threads of the library do it when they start).
+    static void set_thread(const std::string &name, int id = -1);
+
+    //All the rings, ended threads' included. The list only grows: walking it is async-signal-safe.
+    static Ring *rings();
+    static const char *event_name(FlightEvent event);
+    //The time stamp counter where there is one, else the monotonic clock in ns. Async-signal-safe.
+    static uint64_t now();
+    //ns per tick, measured between the first record and this call. Async-signal-safe.
+    static double tick_ns();
+};
+
+}
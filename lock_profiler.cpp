@@ -0,0 +1,146 @@
+#include "lock_profiler.h"
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+
+#include <time.h>
+
+namespace CppUtilities {
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+LockProfiler::LockProfiler()
+{
+    _base_ns = monotonic_ns();
+    _base_ticks = FlightRecorder::now();
+}
+
+LockProfiler *LockProfiler::get()
+{
+    //Never deleted: mutexes of static objects may still count at exit.
+    static LockProfiler *inst = new LockProfiler;
+    return inst;
+}
+
+LockSite *LockProfiler::site(const char *site, const std::string &owner)
+{
+    mtx.lock();
+    LockSite *&s = _sites[{site, owner}];
+    if (!s) {
+        s = new LockSite;
+        s->site = site;
+        s->owner = owner;
+    }
+    LockSite *found = s;
+    mtx.unlock();
+    return found;
+}
+
+double LockProfiler::tick_ns()
+{
+    uint64_t ticks = FlightRecorder::now(), ns = monotonic_ns();
+    return ticks > _base_ticks && ns > _base_ns ? double(ns - _base_ns) / double(ticks - _base_ticks) : 1.0;
+}
+
+double LockProfiler::bucket_ns(int i)
+{
+    return std::ldexp(tick_ns(), i);
+}
+
+std::vector<LockProfiler::Stats> LockProfiler::snapshot()
+{
+    double tick = tick_ns();
+    std::vector<Stats> stats;
+    mtx.lock();
+    for (auto &it : _sites) {
+        LockSite *s = it.second;
+        Stats st = {s->site, s->owner, s->acquires.load(), s->contended.load(), double(s->wait_ticks.load()) * tick, double(s->max_wait.load()) * tick,
+                    double(s->hold_ticks.load()) * tick, double(s->max_hold.load()) * tick, {}, {}};
+        for (int b = 0; b < LockSite::BUCKETS; b++) {
+            st.waits.push_back(s->waits[b].load());
+            st.holds.push_back(s->holds[b].load());
+        }
+        stats.push_back(std::move(st));
+    }
+    mtx.unlock();
+    std::sort(stats.begin(), stats.end(), [](const Stats &a, const Stats &b) {
+        return a.wait_ns != b.wait_ns ? a.wait_ns > b.wait_ns : a.acquires > b.acquires;
+    });
+    return stats;
+}
+
+static std::string format_ns(double ns)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(ns < 10000 ? 0 : 1);
+    if (ns < 10000) {
+        out << ns << " ns";
+    } else if (ns < 1e7) {
+        out << ns / 1e3 << " us";
+    } else {
+        out << ns / 1e6 << " ms";
+    }
+    return out.str();
+}
+
+static std::string format_histogram(const std::vector<uint64_t> &counts, LockProfiler *p)
+{
+    std::string line;
+    for (size_t b = 0; b < counts.size(); b++) {
+        if (counts[b]) {
+            line += (b ? " <" + format_ns(p->bucket_ns(int(b))) : std::string(" 0")) + ":" + std::to_string(counts[b]);
+        }
+    }
+    return line;
+}
+
+std::string LockProfiler::report(size_t top)
+{
+    std::vector<Stats> stats = snapshot();
+    std::ostringstream out;
+    out << "\n----------[BEG] [LOCK PROFILER]-----------\n";
+    for (size_t i = 0; i < stats.size() && i < top && stats[i].acquires; i++) {
+        const Stats &s = stats[i];
+        out << "\n" << s.site << " [" << s.owner << "]: " << s.acquires << " acquires, " << s.contended << " contended ("
+            << std::fixed << std::setprecision(1) << 100.0 * double(s.contended) / double(s.acquires) << "%)\n";
+        out << "    wait: " << format_ns(s.wait_ns) << " total, " << format_ns(s.contended ? s.wait_ns / double(s.contended) : 0) << " per contended, "
+            << format_ns(s.max_wait_ns) << " max\n";
+        out << "    hold: " << format_ns(s.hold_ns) << " total, " << format_ns(s.hold_ns / double(s.acquires)) << " average, "
+            << format_ns(s.max_hold_ns) << " max\n";
+        out << "    waits:" << format_histogram(s.waits, this) << "\n";
+        out << "    holds:" << format_histogram(s.holds, this) << "\n";
+    }
+    if (stats.size() > top) {
+        out << "\n(" << stats.size() - top << " more sites)\n";
+    }
+    out << "\n----------[END] [LOCK PROFILER]-----------\n";
+    return out.str();
+}
+
+void LockProfiler::reset()
+{
+    mtx.lock();
+    for (auto &it : _sites) {
+        LockSite *s = it.second;
+        s->acquires = 0;
+        s->contended = 0;
+        s->wait_ticks = 0;
+        s->max_wait = 0;
+        s->hold_ticks = 0;
+        s->max_hold = 0;
+        for (int b = 0; b < LockSite::BUCKETS; b++) {
+            s->waits[b] = 0;
+            s->holds[b] = 0;
+        }
+    }
+    mtx.unlock();
+}
+
+}
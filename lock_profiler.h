@@ -0,0 +1,172 @@
+#pragma once
+
+#include "cpputilities_global.h"
+#include "flight_recorder.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+namespace CppUtilities {
+
+//The counts of a lock site (a mutex member, e.g. AbstractThread::mtx) for one owner name: the mutexes of all the
+//threads named "io" share a record. Times are in ticks of FlightRecorder::now().
+struct LockSite
+{
+    static const int BUCKETS = 40; //[2^(i-1), 2^i) ticks, the first one is 0.
+
+    inline void acquired(uint64_t wait, bool contended) {
+        acquires.fetch_add(1, std::memory_order_relaxed);
+        if (contended) {
+            this->contended.fetch_add(1, std::memory_order_relaxed);
+            wait_ticks.fetch_add(wait, std::memory_order_relaxed);
+            if (wait > max_wait.load(std::memory_order_relaxed)) {
+                max_wait.store(wait, std::memory_order_relaxed);
+            }
+        }
+        waits[bucket(wait)].fetch_add(1, std::memory_order_relaxed);
+    };
+    inline void released(uint64_t hold) {
+        hold_ticks.fetch_add(hold, std::memory_order_relaxed);
+        if (hold > max_hold.load(std::memory_order_relaxed)) {
+            max_hold.store(hold, std::memory_order_relaxed);
+        }
+        holds[bucket(hold)].fetch_add(1, std::memory_order_relaxed);
+    };
+    inline static int bucket(uint64_t ticks) {
+        int b = ticks ? 64 - __builtin_clzll(ticks) : 0;
+        return b < BUCKETS ? b : BUCKETS - 1;
+    };
+
+    std::string site;
+    std::string owner;
+    std::atomic<uint64_t> acquires = {0};
+    std::atomic<uint64_t> contended = {0};  //Acquires that had to wait.
+    std::atomic<uint64_t> wait_ticks = {0};
+    std::atomic<uint64_t> max_wait = {0};
+    std::atomic<uint64_t> hold_ticks = {0};
+    std::atomic<uint64_t> max_hold = {0};
+    std::atomic<uint64_t> waits[BUCKETS] = {};
+    std::atomic<uint64_t> holds[BUCKETS] = {};
+};
+
+/**
+ * Registry of the lock sites, for LOCK_PROFILING: with it defined, t
+ * he mutexes of the library (AbstractThread::mtx, GenericSignal::mtx
+ * , ThreadTracker::events_mtx) are ProfiledMutexes, each counting in
+ * to the record of its site and owner's name. Records are never fre
+ * ed; a snapshot or a report can be taken anytime, without stopping
+ * the threads, and what is being counted meanwhile may be in it or n
+ * ot.
+ **/
+class LockProfiler
+{
+public:
+    static LockProfiler *get();
+
+    //The record of a site for an owner, made the first time.
+    LockSite *site(const char *site, const std::string &owner);
+
+    struct Stats {
+        std::string site;
+        std::string owner;
+        uint64_t acquires;
+        uint64_t contended;
+        double wait_ns;     //Total, of the contended acquires.
+        double max_wait_ns;
+        double hold_ns;     //Total.
+        double max_hold_ns;
+        //Per bucket: count of the waits (holds) under bucket_ns(i), and at least bucket_ns(i - 1).
+        std::vector<uint64_t> waits;
+        std::vector<uint64_t> holds;
+    };
+    //The sites, most waited on first.
+    std::vector<Stats> snapshot();
+    //Per site: the acquires, how many waited, the wait and hold times and their histograms.
+    std::string report(size_t top = 10);
+    //Zeroes the counts, the sites stay.
+    void reset();
+
+    //Upper bound of a histogram bucket.
+    double bucket_ns(int i);
+    //ns per tick, measured since the first get().
+    double tick_ns();
+
+private:
+    LockProfiler();
+
+    std::map<std::pair<std::string, std::string>, LockSite *> _sites;
+    std::mutex mtx;
+    uint64_t _base_ticks = 0;
+    uint64_t _base_ns = 0;
+};
+
+//A std::mutex counting its acquires, contended ones and wait and hold times into its site's record (none until
+//set_site()). Uncontended, it costs two time stamp counter reads and a few relaxed increments more.
+class ProfiledMutex
+{
+public:
+    ProfiledMutex() = default;
+    ProfiledMutex(const ProfiledMutex &) = delete;
+    ProfiledMutex &operator=(const ProfiledMutex &) = delete;
+
+    inline void set_site(const char *site, const std::string &owner) {_site = LockProfiler::get()->site(site, owner);};
+
+    inline void lock() {
+        LockSite *s = _site.load(std::memory_order_relaxed);
+        if (_mtx.try_lock()) {
+            _locked_at = s ? FlightRecorder::now() : 0;
+            if (s) {
+                s->acquired(0, false);
+            }
+            return;
+        }
+        uint64_t from = s ? FlightRecorder::now() : 0;
+        _mtx.lock();
+        _locked_at = s ? FlightRecorder::now() : 0;
+        if (s) {
+            s->acquired(_locked_at - from, true);
+        }
+    };
+    inline bool try_lock() {
+        if (!_mtx.try_lock()) {
+            return false;
+        }
+        LockSite *s = _site.load(std::memory_order_relaxed);
+        _locked_at = s ? FlightRecorder::now() : 0;
+        if (s) {
+            s->acquired(0, false);
+        }
+        return true;
+    };
+    inline void unlock() {
+        LockSite *s = _site.load(std::memory_order_relaxed);
+        if (s && _locked_at) {
+            s->released(FlightRecorder::now() - _locked_at);
+        }
+        _mtx.unlock();
+    };
+
+private:
+    std::mutex _mtx;
+    std::atomic<LockSite *> _site = {nullptr};
+    uint64_t _locked_at = 0; //Under the lock.
+};
+
+//The mutexes of the library, and the condition variable to wait on them: plain ones without LOCK_PROFILING.
+#ifdef LOCK_PROFILING
+typedef ProfiledMutex TrackedMutex;
+typedef std::condition_variable_any TrackedCondition;
+#else
+typedef std::mutex TrackedMutex;
+typedef std::condition_variable TrackedCondition;
+#endif
+
+inline void set_lock_site(std::mutex &, const char *, const std::string &) {}
+inline void set_lock_site(ProfiledMutex &m, const char *site, const std::string &owner) {m.set_site(site, owner);}
+
+}
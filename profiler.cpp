@@ -0,0 +1,250 @@
+#include "profiler.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
+
+namespace CppUtilities {
+
+//Written by the thread's own handler only, read by collapsed(): a single producer, single consumer ring.
+struct Profiler::Ring {
+    static const size_t SIZE = 1024;
+    struct Sample {
+        int depth;
+        void *pcs[StackTrace::MAX_FRAMES];
+    };
+
+    Sample samples[SIZE];
+    std::atomic<size_t> head = {0};
+    std::atomic<size_t> tail = {0};
+    std::atomic<size_t> dropped = {0};
+};
+
+struct Profiler::Profile {
+    std::string tag; //name[id]
+    pid_t tid;
+    pthread_t thread;
+    uintptr_t stack_low = 0;
+    uintptr_t stack_high = 0;
+    timer_t timer;
+    std::atomic<bool> armed = {false};
+    Ring *ring = nullptr;
+
+    ~Profile() {
+        delete ring;
+    }
+};
+
+Profiler *Profiler::get()
+{
+    //Never deleted: threads detach from it until the very end.
+    static Profiler *inst = new Profiler;
+    return inst;
+}
+
+//Interrupted pc first, then the return addresses, into a lock-free ring. Async-signal-safe with STACK_FRAME_POINTERS
+//only: else capture_context() calls backtrace(), which is not (start() warns).
+static void profiler_handler(int, siginfo_t *info, void *context)
+{
+    Profiler::Profile *p = static_cast<Profiler::Profile *>(info->si_value.sival_ptr);
+    if (info->si_code != SI_TIMER || !p || !p->armed.load(std::memory_order_acquire)) {
+        return;
+    }
+    int saved_errno = errno;
+    Profiler::Ring *r = p->ring;
+    size_t t = r->tail.load(std::memory_order_relaxed);
+    if (t - r->head.load(std::memory_order_acquire) >= Profiler::Ring::SIZE) {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        errno = saved_errno;
+        return;
+    }
+    Profiler::Ring::Sample &s = r->samples[t % Profiler::Ring::SIZE];
+    s.depth = StackTrace::capture_context(context, s.pcs, StackTrace::MAX_FRAMES, p->stack_low, p->stack_high);
+    r->tail.store(t + 1, std::memory_order_release);
+    errno = saved_errno;
+}
+
+bool Profiler::start(int hz)
+{
+    if (hz <= 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    if (_running) {
+        return true;
+    }
+#ifndef STACK_FRAME_POINTERS
+    std::cout << "Profiler: without STACK_FRAME_POINTERS, the samples are taken by backtrace() in a signal handler, which can "
+                 "deadlock a thread interrupted in the unwinder: not for production" << std::endl;
+#endif
+    //The first backtrace() loads libgcc_s, which allocates: never in the handler.
+    void *warm[4];
+    backtrace(warm, 4);
+
+    struct sigaction sa = {};
+    sa.sa_sigaction = profiler_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+        return false;
+    }
+    _period_ns = 1000000000L / hz;
+    _running = true;
+    for (std::pair<const pid_t, Profile *> &t : _threads) {
+        arm_locked(t.second);
+    }
+    return true;
+}
+
+void Profiler::stop()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    _running = false;
+    for (std::pair<const pid_t, Profile *> &t : _threads) {
+        disarm_locked(t.second);
+    }
+}
+
+//The timer counts the CPU time of the thread only, and signals it only.
+void Profiler::arm_locked(Profile *p)
+{
+    if (p->armed) {
+        return;
+    }
+    if (!p->ring) {
+        p->ring = new Ring;
+    }
+    clockid_t clock;
+    if (pthread_getcpuclockid(p->thread, &clock) != 0) {
+        return;
+    }
+    sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_value.sival_ptr = p;
+    sev._sigev_un._tid = p->tid;
+    if (timer_create(clock, &sev, &p->timer) != 0) {
+        return;
+    }
+    p->armed.store(true, std::memory_order_release);
+    itimerspec its = {};
+    its.it_interval.tv_sec = _period_ns / 1000000000L;
+    its.it_interval.tv_nsec = _period_ns % 1000000000L;
+    its.it_value = its.it_interval;
+    timer_settime(p->timer, 0, &its, nullptr);
+}
+
+//A signal already queued finds the profile disarmed, and the profile is not freed while its thread lives.
+void Profiler::disarm_locked(Profile *p)
+{
+    if (p->armed) {
+        p->armed.store(false, std::memory_order_release);
+        timer_delete(p->timer);
+    }
+}
+
+void Profiler::attach_current(std::string name, int id)
+{
+    Profile *p = new Profile;
+    p->tag = name + "[" + std::to_string(id) + "]";
+    p->tid = pid_t(syscall(SYS_gettid));
+    p->thread = pthread_self();
+    pthread_attr_t attr;
+    if (pthread_getattr_np(p->thread, &attr) == 0) {
+        void *addr;
+        size_t size;
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+            p->stack_low = reinterpret_cast<uintptr_t>(addr);
+            p->stack_high = p->stack_low + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    Profile *&slot = _threads[p->tid];
+    if (slot) {
+        //Attached twice: the new name wins.
+        disarm_locked(slot);
+        _ended.push_back(slot);
+    }
+    slot = p;
+    if (_running) {
+        arm_locked(p);
+    }
+}
+
+void Profiler::detach_current()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = _threads.find(pid_t(syscall(SYS_gettid)));
+    if (it != _threads.end()) {
+        disarm_locked(it->second);
+        _ended.push_back(it->second);
+        _threads.erase(it);
+    }
+}
+
+void Profiler::drain_locked(Profile *p)
+{
+    Ring *r = p->ring;
+    if (!r) {
+        return;
+    }
+    size_t h = r->head.load(std::memory_order_relaxed);
+    size_t t = r->tail.load(std::memory_order_acquire);
+    for (; h != t; h++) {
+        Ring::Sample &s = r->samples[h % Ring::SIZE];
+        _stacks[{p->tag, std::vector<void *>(s.pcs, s.pcs + s.depth)}]++;
+    }
+    r->head.store(h, std::memory_order_release);
+    _dropped += r->dropped.exchange(0);
+}
+
+std::string Profiler::collapsed()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    for (std::pair<const pid_t, Profile *> &t : _threads) {
+        drain_locked(t.second);
+    }
+    for (Profile *p : _ended) {
+        drain_locked(p);
+        delete p;
+    }
+    _ended.clear();
+
+    //Samples at different pcs of the same functions make one line.
+    std::map<std::string, size_t> lines;
+    for (auto &stack : _stacks) {
+        const std::vector<void *> &pcs = stack.first.second;
+        lines[stack.first.first + ";" + Symbolizer::get()->collapse(pcs.data(), int(pcs.size()), true)] += stack.second;
+    }
+    std::string out;
+    for (std::pair<const std::string, size_t> &l : lines) {
+        out += l.first + " " + std::to_string(l.second) + "\n";
+    }
+    return out;
+}
+
+void Profiler::clear()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    for (std::pair<const pid_t, Profile *> &t : _threads) {
+        if (Ring *r = t.second->ring) {
+            r->head.store(r->tail.load());
+        }
+    }
+    for (Profile *p : _ended) {
+        delete p;
+    }
+    _ended.clear();
+    _stacks.clear();
+    _dropped = 0;
+}
+}
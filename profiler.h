@@ -0,0 +1,68 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include "symbolizer.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#include <sys/types.h>
+
+namespace CppUtilities {
+
+/**
+ * Sampling CPU profiler. Each thread of the library (and the ones a
+ * ttached with attach_current()) gets a timer on its own CPU clock,
+ * delivering SIGPROF to it only: a thread is sampled hz times per s
+ * econd it runs, an idle one costs nothing. The handler copies the
+ * program counters into the thread's ring, with no lock and no symb
+ * ol; collapsed() symbolizes once per distinct stack, through the s
+ * hared cache of Symbolizer.
+ **/
+class Profiler
+{
+public:
+    static Profiler *get();
+
+    //Samples the attached threads, and the ones attached later, until stop(). Warns without STACK_FRAME_POINTERS: the
+    //handler is then not async-signal-safe.
+    bool start(int hz = 100);
+    void stop();
+    inline bool running() {return _running;};
+
+    //The threads of the library attach themselves when they start and detach when they end.
+    void attach_current(std::string name, int id = -1);
+    void detach_current();
+
+    //One line per distinct stack since the last clear(): "name[id];outermost;...;innermost count",
+    //as flamegraph.pl or speedscope read it.
+    std::string collapsed();
+    void clear();
+    //Samples lost because a ring was full between two collapsed().
+    inline size_t dropped() {return _dropped;};
+
+    struct Ring;
+    struct Profile;
+
+private:
+    Profiler() {};
+
+    void arm_locked(Profile *p);
+    void disarm_locked(Profile *p);
+    void drain_locked(Profile *p);
+
+    std::map<pid_t, Profile *> _threads;
+    //Ended threads, kept until their samples are taken.
+    std::vector<Profile *> _ended;
+    std::map<std::pair<std::string, std::vector<void *>>, size_t> _stacks;
+    std::atomic<bool> _running = {false};
+    std::atomic<size_t> _dropped = {0};
+    long _period_ns = 0;
+    std::mutex mtx;
+};
+
+}
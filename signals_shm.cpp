@@ -0,0 +1,204 @@
+#include "signals_shm.h"
+
+#include <iostream>
+#include <climits>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace CppUtilities {
+
+//A new object is zero filled, which is an empty ring: the first opener only has to set the sizes.
+struct SharedRing::Header {
+    std::atomic<uint32_t> record_size;
+    std::atomic<uint32_t> capacity;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> published; //Futex word, bumped on each publish.
+    std::atomic<uint32_t> waiters;
+};
+
+static std::string shm_path(std::string name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+//A writer of an older ticket still copying into a slot after this long is taken as stuck: the newer one drops its record.
+static const std::chrono::milliseconds stuck_after(100);
+
+static bool set_or_check(std::atomic<uint32_t> &field, uint32_t value)
+{
+    uint32_t expected = 0;
+    return field.compare_exchange_strong(expected, value) || expected == value;
+}
+
+SharedRing::SharedRing(std::string name, uint32_t record_size, uint32_t capacity)
+{
+    //The index is a mask of the ticket.
+    uint32_t cap = 1;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    _record_size = record_size;
+    _slot_size = (3 * sizeof(uint64_t) + record_size + 63) / 64 * 64;
+    _mask = cap - 1;
+    size_t header_size = (sizeof(Header) + 63) / 64 * 64;
+    _map_size = header_size + _slot_size * cap;
+
+    //Only the creator sizes the object: sizing it again would shrink it under the processes that map it.
+    std::string path = shm_path(name);
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        if (ftruncate(fd, _map_size) != 0) {
+            std::cout << "SharedRing [" << path << "] cannot be sized" << std::endl;
+            close(fd);
+            shm_unlink(path.c_str());
+            return;
+        }
+    } else {
+        fd = errno == EEXIST ? shm_open(path.c_str(), O_RDWR, 0600) : -1;
+        if (fd < 0) {
+            std::cout << "SharedRing [" << path << "] cannot be opened" << std::endl;
+            return;
+        }
+        //Still empty while its creator is about to size it.
+        struct stat st;
+        for (int i = 0; fstat(fd, &st) == 0 && st.st_size == 0 && i < 100; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) != _map_size) {
+            std::cout << "SharedRing [" << path << "] is used with another record size or capacity" << std::endl;
+            close(fd);
+            return;
+        }
+    }
+    void *m = mmap(nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        std::cout << "SharedRing [" << path << "] cannot be mapped" << std::endl;
+        return;
+    }
+
+    Header *h = static_cast<Header *>(m);
+    if (!set_or_check(h->record_size, record_size) || !set_or_check(h->capacity, cap)) {
+        std::cout << "SharedRing [" << path << "] is used with another record size or capacity" << std::endl;
+        munmap(m, _map_size);
+        return;
+    }
+    _header = h;
+    _records = static_cast<char *>(m) + header_size;
+}
+
+SharedRing::~SharedRing()
+{
+    if (_header) {
+        munmap(_header, _map_size);
+    }
+}
+
+void SharedRing::unlink(std::string name)
+{
+    shm_unlink(shm_path(name).c_str());
+}
+
+uint64_t SharedRing::head()
+{
+    return _header->tail.load();
+}
+
+void SharedRing::publish(const void *record)
+{
+    uint64_t ticket = _header->tail.fetch_add(1);
+    std::atomic<uint64_t> *seq = sequence(ticket);
+    uint64_t cur = seq->load();
+    uint32_t spins = 0;
+    std::chrono::steady_clock::time_point stuck_since;
+    for (;;) {
+        //Lapped by a writer of a newer ticket: this record would be overwritten anyway.
+        if (cur > 2 * ticket) {
+            break;
+        }
+        //A writer of an older ticket is still copying in there. Spin a little, then yield, until it has
+        //been there for stuck_after: it died or is stopped in there. It may still copy, so nothing else
+        //does: the record is dropped, and the readers told so.
+        if (cur & 1) {
+            bool known = cur == stuck(ticket)->load();
+            if (!known && ++spins < 64) {
+                cur = seq->load();
+                continue;
+            }
+            if (!known && spins == 64) {
+                stuck_since = std::chrono::steady_clock::now();
+            }
+            if (!known && std::chrono::steady_clock::now() - stuck_since < stuck_after) {
+                std::this_thread::yield();
+                cur = seq->load();
+                continue;
+            }
+            stuck(ticket)->store(cur);
+            uint64_t last = dropped(ticket)->load();
+            while (last < ticket + 1 && !dropped(ticket)->compare_exchange_weak(last, ticket + 1)) {}
+            break;
+        }
+        if (seq->compare_exchange_weak(cur, 2 * ticket + 1)) {
+            std::memcpy(data(ticket), record, _record_size);
+            seq->store(2 * ticket + 2, std::memory_order_release);
+            break;
+        }
+    }
+
+    _header->published.fetch_add(1);
+    if (_header->waiters.load() > 0) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_header->published), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+
+int SharedRing::read(uint64_t &cursor, void *out)
+{
+    std::atomic<uint64_t> *seq = sequence(cursor);
+    uint64_t before = seq->load(std::memory_order_acquire);
+    if (before < 2 * cursor + 2 && dropped(cursor)->load() <= cursor) {
+        return 0;
+    }
+    if (before == 2 * cursor + 2) {
+        std::memcpy(out, data(cursor), _record_size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq->load(std::memory_order_relaxed) == before) {
+            cursor++;
+            return 1;
+        }
+    }
+
+    uint64_t tail = _header->tail.load();
+    uint64_t oldest = tail > _mask + 1 ? tail - _mask - 1 : 0;
+    cursor = std::max(cursor + 1, oldest);
+    return -1;
+}
+
+void SharedRing::wake()
+{
+    _header->published.fetch_add(1);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_header->published), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void SharedRing::wait(uint64_t cursor, int timeout_ms)
+{
+    uint32_t published = _header->published.load();
+    if (_header->tail.load() > cursor) {
+        return;
+    }
+    timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    _header->waiters.fetch_add(1);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_header->published), FUTEX_WAIT, published, timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+    _header->waiters.fetch_sub(1);
+}
+
+/* Template type predefs */
+template class SignalShm<void, int>;
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include "signals_slots.h"
+#include "threading.h"
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace CppUtilities {
+
+/**
+ * Broadcast ring in a POSIX shared memory object, to signal between
+ * processes of the same host. Each record has a sequence number: od
+ * d while a writer copies it in, 2 * (ticket + 1) once it is there.
+ * Readers copy a record out and check the sequence did not change (
+ * seqlock), so nothing is locked and a slow reader cannot block the
+ * writers: it is overrun and skips to the oldest record still there.
+ * A slot left odd for too long (its writer died, or is stopped, wh
+ * ile copying) is never copied into again until that writer ends: t
+ * he writers after it drop their records and mark the slot, so that
+ * readers count them as overruns. Wake-ups go through a futex in th
+ * e shared header.
+ **/
+class SharedRing
+{
+public:
+    //Opens /name, created and sized if needed. Every process has to use the same record size and capacity.
+    SharedRing(std::string name, uint32_t record_size, uint32_t capacity);
+    ~SharedRing();
+    SharedRing(const SharedRing &) = delete;
+    SharedRing &operator=(const SharedRing &) = delete;
+
+    inline bool valid() const {return _header != nullptr;};
+    //Ticket of the next record to be published.
+    uint64_t head();
+
+    void publish(const void *record);
+    //1 when the record at cursor was copied in out (cursor moves on), 0 when it is not there yet, and
+    //-1 when it has been overwritten or dropped: cursor skips to the oldest record still in the ring.
+    int read(uint64_t &cursor, void *out);
+    //Sleeps until a record is published after cursor, or for timeout_ms (-1 for no timeout).
+    void wait(uint64_t cursor, int timeout_ms);
+    //Wakes the waiters of every process, which go back to sleep if nothing was published.
+    void wake();
+
+    //The object lives until unlinked and unmapped by everyone.
+    static void unlink(std::string name);
+
+private:
+    struct Header;
+
+    //A slot is its sequence, the odd sequence it was found stuck at, the last ticket dropped in it + 1, then the record.
+    inline std::atomic<uint64_t> *sequence(uint64_t ticket) {
+        return reinterpret_cast<std::atomic<uint64_t> *>(_records + (ticket & _mask) * _slot_size);
+    };
+    inline std::atomic<uint64_t> *stuck(uint64_t ticket) {return sequence(ticket) + 1;};
+    inline std::atomic<uint64_t> *dropped(uint64_t ticket) {return sequence(ticket) + 2;};
+    inline char *data(uint64_t ticket) {return _records + (ticket & _mask) * _slot_size + 3 * sizeof(uint64_t);};
+
+    Header *_header = nullptr;
+    char *_records = nullptr;
+    size_t _map_size = 0;
+    size_t _slot_size = 0;
+    uint32_t _record_size = 0;
+    uint64_t _mask = 0;
+};
+
+//Byte layout of the arguments in a record, each one at its alignment as in a struct.
+template<class ... T>
+struct ShmRecord
+{
+    static constexpr std::array<size_t, sizeof ... (T) + 1> layout() {
+        std::array<size_t, sizeof ... (T) + 1> o {};
+        size_t off = 0, i = 0;
+        ((off = (off + alignof(T) - 1) / alignof(T) * alignof(T), o[i++] = off, off += sizeof(T)), ...);
+        o[i] = off;
+        return o;
+    }
+
+    static constexpr std::array<size_t, sizeof ... (T) + 1> offsets = layout();
+    static constexpr size_t size = offsets[sizeof ... (T)];
+};
+
+/**
+ * SignalMulti whose emits go through a SharedRing: every process o
+ * pening the same name, this one too, gets them on its slots by po
+ * lling. Arguments are copied as bytes, so they have to be triviall
+ * y copyable (no pointers to the emitter's memory!). poll() can be d
+ * riven by a ThreadLooping with bind(), or by a thread sleeping in w
+ * ait(). The slots can have target threads as with any SignalMulti.
+ **/
+template<class C = void, class ... Args>
+class SignalShm : public SignalMulti<C, Args ...>
+{
+public:
+    using record_t = ShmRecord<std::decay_t<Args> ...>;
+
+    inline explicit SignalShm(std::string shm_name, uint32_t capacity = 1024, std::string sn = "Undefined");
+    inline ~SignalShm();
+
+    inline bool valid() const {return _ring.valid();};
+
+    //Published in the ring, the slots get it from poll(), in the emitting process too.
+    inline void emit(const Args & ... vals) override;
+    inline void emit(std::decay_t<Args> && ... vals) override;
+
+    //Delivers to this process's slots what was published since the last poll, returns the count.
+    inline size_t poll();
+    inline void wait(int timeout_ms = -1) {_ring.wait(_cursor, timeout_ms);};
+    //A thread of the signal sleeps on the ring, and queues a poll() to t when records come, until the signal is
+    //destroyed: t can sleep meanwhile. t has to outlive the signal, as a slot's target thread.
+    inline void bind(AbstractThread *t);
+
+    //Records missed because this process polled too slowly.
+    inline uint64_t overruns() {return _overruns;};
+
+private:
+    static_assert(sizeof ... (Args) > 0, "A shared memory signal carries at least one value");
+    static_assert(std::conjunction<std::is_trivially_copyable<std::decay_t<Args>> ...>::value, "Shared memory signals carry trivially copyable values only");
+
+    struct Binding {
+        std::mutex mtx;
+        SignalShm *sig;
+    };
+    struct Waker {
+        std::thread thread;
+        std::atomic<bool> queued {false};
+    };
+
+    template<std::size_t ... I> inline void _publish(std::index_sequence<I ...>, const std::decay_t<Args> & ... vals);
+    template<std::size_t ... I> inline void _deliver(unsigned char *buf, std::index_sequence<I ...>);
+
+    SharedRing _ring;
+    uint64_t _cursor = 0;
+    std::atomic<uint64_t> _overruns {0};
+    std::shared_ptr<Binding> _binding;
+    std::vector<std::shared_ptr<Waker>> _wakers;
+    std::atomic<bool> _unbinding {false};
+    std::mutex _poll_mtx;
+};
+
+
+
+template<class C, class ... Args> inline
+SignalShm<C, Args ...>::SignalShm(std::string shm_name, uint32_t capacity, std::string sn)
+    : SignalMulti<C, Args ...>(sn), _ring(shm_name, record_t::size, capacity)
+{
+    //Only what is emitted from now on.
+    if (_ring.valid()) {
+        _cursor = _ring.head();
+    }
+    _binding = std::make_shared<Binding>();
+    _binding->sig = this;
+}
+
+template<class C, class ... Args> inline
+SignalShm<C, Args ...>::~SignalShm()
+{
+    if (!_wakers.empty()) {
+        _unbinding.store(true);
+        _ring.wake();
+        for (std::shared_ptr<Waker> &w : _wakers) {
+            w->thread.join();
+        }
+    }
+    _binding->mtx.lock();
+    _binding->sig = nullptr;
+    _binding->mtx.unlock();
+}
+
+template<class C, class ... Args> inline
+void SignalShm<C, Args ...>::emit(const Args & ... vals)
+{
+    _publish(std::index_sequence_for<Args ...>{}, vals ...);
+}
+
+template<class C, class ... Args> inline
+void SignalShm<C, Args ...>::emit(std::decay_t<Args> && ... vals)
+{
+    _publish(std::index_sequence_for<Args ...>{}, vals ...);
+}
+
+template<class C, class ... Args> template<std::size_t ... I> inline
+void SignalShm<C, Args ...>::_publish(std::index_sequence<I ...>, const std::decay_t<Args> & ... vals)
+{
+    if (!_ring.valid()) {
+        return;
+    }
+    alignas(std::max_align_t) unsigned char buf[record_t::size] = {};
+    (std::memcpy(buf + record_t::offsets[I], &vals, sizeof(vals)), ...);
+    _ring.publish(buf);
+}
+
+//A slot polling this signal again would deadlock: the records are delivered in order, under a lock.
+template<class C, class ... Args> inline
+size_t SignalShm<C, Args ...>::poll()
+{
+    if (!_ring.valid()) {
+        return 0;
+    }
+    alignas(std::max_align_t) unsigned char buf[record_t::size];
+    size_t count = 0;
+    _poll_mtx.lock();
+    for (;;) {
+        int r = _ring.read(_cursor, buf);
+        if (r == 0) {
+            break;
+        } else if (r < 0) {
+            _overruns++;
+            continue;
+        }
+        _deliver(buf, std::index_sequence_for<Args ...>{});
+        count++;
+    }
+    _poll_mtx.unlock();
+    return count;
+}
+
+template<class C, class ... Args> template<std::size_t ... I> inline
+void SignalShm<C, Args ...>::_deliver(unsigned char *buf, std::index_sequence<I ...>)
+{
+    SignalMulti<C, Args ...>::emit(*std::launder(reinterpret_cast<std::decay_t<Args> *>(buf + record_t::offsets[I])) ...);
+}
+
+//One poll() queued at a time: the records coming meanwhile are delivered by it, or queue the next one.
+template<class C, class ... Args> inline
+void SignalShm<C, Args ...>::bind(AbstractThread *t)
+{
+    if (!_ring.valid()) {
+        return;
+    }
+    std::shared_ptr<Binding> b = _binding;
+    std::shared_ptr<Waker> w = std::make_shared<Waker>();
+    w->thread = std::thread([this, b, w, t]() {
+        uint64_t seen = _ring.head();
+        //The timeout bounds the destructor's wait when its wake() came between the check and the sleep.
+        while (!_unbinding.load()) {
+            _ring.wait(seen, 100);
+            uint64_t head = _ring.head();
+            if (head == seen || _unbinding.load()) {
+                continue;
+            }
+            seen = head;
+            if (!w->queued.exchange(true)) {
+                t->add_callback(new GenericExecutor<>([b, w]() {
+                    w->queued.store(false);
+                    b->mtx.lock();
+                    if (b->sig) {
+                        b->sig->poll();
+                    }
+                    b->mtx.unlock();
+                }));
+            }
+        }
+    });
+    _wakers.push_back(w);
+}
+}
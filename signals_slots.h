@@ -3,7 +3,11 @@
 #include "cpputilities_global.h"
 
 #include "threading.h"
-#include "cxxabi.h"
+#include "slot_map.h"
+#include "symbolizer.h"
+#include "alloc_profiler.h"
+#include "flight_recorder.h"
+#include "tracer.h"
 
 #include <iostream>
 #include <utility>
@@ -12,6 +16,13 @@
 #include <list>
 #include <map>
 #include <mutex>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <optional>
+#include <chrono>
+#include <vector>
+#include <condition_variable>
 
 namespace CppUtilities {
 class AbstractThread;
@@ -26,6 +37,16 @@ class AbstractThread;
 
 template<class C, class ... Args> class GenericFunctor;
 
+//Arguments are stored once in a payload (a tuple of their decayed types) and handed to the slots
+//the way their signature declares them: lvalue references bind to the stored value, anything else
+//is moved out when the payload has a single owner, or passed as a const ref when it is shared.
+template<class A> using owned_arg_t = std::conditional_t<std::is_lvalue_reference<A>::value, A, std::decay_t<A> &&>;
+template<class A> using shared_arg_t = std::conditional_t<std::is_lvalue_reference<A>::value && !std::is_const<std::remove_reference_t<A>>::value, A, const std::decay_t<A> &>;
+
+//A payload can be given to several receivers if none of them needs to own a non-copyable value.
+template<class ... Args>
+struct payload_shareable : std::conjunction<std::disjunction<std::is_lvalue_reference<Args>, std::is_copy_constructible<std::decay_t<Args>>> ...> {};
+
 //Signal/Slot Data Set
 // Use that for better accessibility
 class SSDSet
@@ -87,7 +108,20 @@ class AbstractExecutor : public SSDSet
 {
 public:
     inline explicit AbstractExecutor(std::string sn = "Undefined", size_t fsl = 0, std::list<std::string> sign = {}) : SSDSet(sn, fsl, sign) {};
+    inline ~AbstractExecutor() override {
+        if (cancel_record) {
+            CallbackToken::retire(cancel_record);
+        }
+    };
     virtual void execute() = 0;
+
+    //Set when queued with AbstractThread::add_cancellable_callback().
+    CallbackToken::Record *cancel_record = nullptr;
+#ifdef TIMELINE_TRACING
+    //Set when queued while the Tracer runs: the span it was queued in, and the flow to its run.
+    uint32_t trace_label = 0;
+    uint64_t trace_flow = 0;
+#endif
 };
 
 template<class C = void, class ... Args>
@@ -95,28 +129,50 @@ class GenericExecutor : public AbstractExecutor
 {
 public:
     using function_t = std::function<C(Args ...)>;
-    using binded_t = decltype(std::bind(std::declval<function_t>(), std::declval<Args>() ...));
+    using payload_t = std::tuple<std::decay_t<Args> ...>;
+    using shared_payload_t = std::shared_ptr<payload_t>;
+
+    //The values are forwarded into the payload: rvalues (and move-only types) are moved, never copied twice.
+    template<class ... Vals, class = std::enable_if_t<sizeof ... (Vals) == sizeof ... (Args)>>
+    inline explicit GenericExecutor(function_t func, Vals && ... vals);
+    template<class ... Vals, class = std::enable_if_t<sizeof ... (Vals) == sizeof ... (Args)>>
+    inline GenericExecutor(std::string, function_t func, Vals && ... vals);
+    template<class ... Vals, class = std::enable_if_t<sizeof ... (Vals) == sizeof ... (Args)>>
+    inline GenericExecutor(GenericFunctor<C, Args ...> *src, Vals && ... vals);
 
-    inline explicit GenericExecutor(function_t func, Args ... vals);
-    inline GenericExecutor(std::string, function_t func, Args ... vals);
-    inline GenericExecutor(GenericFunctor<C, Args ...> *src, Args ... vals);
+    //Shares an already built payload, e.g. the one of a signal emitted to several threads.
+    inline GenericExecutor(function_t func, shared_payload_t payload);
+    inline GenericExecutor(GenericFunctor<C, Args ...> *src, shared_payload_t payload);
 
     inline C run();
     inline void execute() override;
     inline std::string get_type() override;
 
+    //Calls func with the payload, moving the values out if this is its last owner.
+    static inline C invoke(function_t &func, shared_payload_t &payload);
+    //Calls func with the payload as shared (read only) values.
+    static inline C invoke_shared(function_t &func, payload_t &payload);
+
     static const std::tuple<Args ...> functor_model;
 
     inline explicit operator GenericExecutor<C> *() {
-        return new GenericExecutor<C>(_bind);
+        return new GenericExecutor<C>(bound());
     }
 
     inline operator GenericExecutor<C>() {
-        return GenericExecutor<C>(_bind);
+        return GenericExecutor<C>(bound());
     }
 
 private:
-    binded_t _bind;
+    template<std::size_t ... I> static inline C _invoke(function_t &func, shared_payload_t &payload, std::index_sequence<I ...>);
+    template<std::size_t ... I> static inline C _invoke_shared(function_t &func, payload_t &payload, std::index_sequence<I ...>);
+
+    inline std::function<C()> bound() {
+        return [func = _func, payload = _payload]() mutable {return invoke(func, payload);};
+    }
+
+    function_t _func;
+    shared_payload_t _payload;
 };
 
 template<class C>
@@ -149,6 +205,37 @@ private:
 };
 
 
+//A member function bound to its object without std::bind: an object pointer and a stub calling the method.
+//It is 16 bytes and trivially copyable, so a std::function keeps it inline (no allocation), and two delegates
+//on the same method and object compare equal. A free function (or captureless lambda) can be bound too.
+template<class C = void, class ... Args>
+class Delegate
+{
+public:
+    using stub_t = C (*)(void *, Args && ...);
+
+    inline Delegate() = default;
+    inline explicit Delegate(C (*func)(Args ...));
+
+    //Delegate<void, int>::bind<&Foo::bar>(&foo)
+    template<auto Method, class T> static inline Delegate bind(T *obj);
+    template<auto Func> static inline Delegate bind();
+
+    inline C operator()(Args ... vals) const {
+        return _stub(_obj, std::forward<Args>(vals) ...);
+    }
+
+    inline explicit operator bool() const {return _stub != nullptr;};
+    inline bool operator==(const Delegate &o) const {return _obj == o._obj && _stub == o._stub;};
+    inline bool operator!=(const Delegate &o) const {return !(*this == o);};
+
+private:
+    inline Delegate(void *obj, stub_t stub) : _obj(obj), _stub(stub) {};
+
+    void *_obj = nullptr;
+    stub_t _stub = nullptr;
+};
+
 //Overlay used for signals, e.g.: you want to pass a GenericFunctor<int>, or a GenericFunctor<int, int> to a SignalMulti<void, int>: use an AnonymousFunctor!
 //As the return type of GenericFunctor does not matter in a signal, it is ok to use int for a void or anything else.
 //For the signals, instead of passing arguments to GenericFunctor<int>, when it is GenericFunctor<void, int>, just don't pass the args :)
@@ -161,6 +248,14 @@ class AnonymousFunctor : public SSDSet
 public:
     inline explicit AnonymousFunctor(std::string sn, size_t fsl, std::list<std::string> sign) : SSDSet(sn, fsl, sign) {};
     template<class ... Args> inline void a_call(Args ... vals);
+
+    //Checks once that it takes <Args ...> (or no argument at all) and wraps it in a typed ftor calling aa_call()
+    //directly, which then owns it. If it does not fit, it is deleted after the mismatch notice and nullptr returned:
+    //either way the caller gave it away.
+    template<class C, class ... Args> inline GenericFunctor<C, Args ...> *to_functor();
+
+private:
+    template<class ... Args> inline void mismatch_notice();
 };
 
 template<class ... Args>
@@ -180,16 +275,36 @@ class GenericFunctor : public ArgsAnonymousFunctor<Args ...>
 {
 public:
     using function_t = std::function<C(Args ...)>;
+    using payload_t = typename GenericExecutor<C, Args ...>::payload_t;
+    using shared_payload_t = typename GenericExecutor<C, Args ...>::shared_payload_t;
+
     inline explicit GenericFunctor(function_t func);
     inline GenericFunctor(std::string sn, function_t func);
     inline GenericFunctor(AbstractThread *, std::string sn, function_t func);
     inline GenericFunctor(AbstractThread *, function_t func);
+    inline explicit GenericFunctor(Delegate<C, Args ...> d);
+    inline GenericFunctor(std::string sn, Delegate<C, Args ...> d);
+    inline GenericFunctor(AbstractThread *, std::string sn, Delegate<C, Args ...> d);
+    inline GenericFunctor(AbstractThread *, Delegate<C, Args ...> d);
 
     inline std::string get_type() override;
-    inline C call(Args ... vals);
+    //Queued, it takes a copy of the values: a non-copyable one has to be given as an rvalue.
+    template<class ... Vals> inline C call(Vals && ... vals);
+    //Direct or blocking call, the values used where they are and never copied: a queued ftor is called blocking.
+    template<class ... Vals> inline C call_in_place(Vals && ... vals);
+    //Same as call() but the values come from a payload shared with other receivers: queued, it is not copied.
+    inline void call_shared(const shared_payload_t &payload);
     inline void aa_call(Args ...) override;
 
     inline void set_thread(AbstractThread *t);
+    inline AbstractThread *target() {return thread;};
+    //Blocking-queued: a call from another thread waits until the target thread has run it, and gets
+    //its result. From the target thread itself, it is run inline. The target has to be running.
+    inline void set_blocking(bool b) {_blocking = b;};
+    inline bool blocking() {return _blocking;};
+    //Key of a queued call, for a ThreadGroup target: the calls with the same key go to the same member.
+    inline void set_affinity(std::function<size_t(const std::decay_t<Args> & ...)> key) {affinity = std::move(key);};
+    inline const std::function<size_t(const std::decay_t<Args> & ...)> &key() const {return affinity;};
 
     inline explicit operator GenericFunctor<void, Args ...> *() {
         return new GenericFunctor<void, Args ...>(SSDSet::name(), ftor);
@@ -200,13 +315,20 @@ public:
     }
 
     inline function_t &get() {return ftor;};
+    //Empty if the ftor was not built from a Delegate.
+    inline const Delegate<C, Args ...> &delegate() const {return dlg;};
 
 protected:
     static constexpr size_t gf_fsl {sizeof ... (Args)};
     AbstractThread *thread = nullptr;
+    bool _blocking = false;
+    std::function<size_t(const std::decay_t<Args> & ...)> affinity;
 
 private:
+    template<class ... Vals> inline C call_blocking(Vals && ... vals);
+
     function_t ftor;
+    Delegate<C, Args ...> dlg;
     friend class GenericExecutor<C, Args ...>;
 };
 
@@ -219,12 +341,20 @@ public:
     inline GenericFunctor(std::string sn, function_t func);
     inline GenericFunctor(AbstractThread *, std::string sn, function_t func);
     inline GenericFunctor(AbstractThread *, function_t func);
+    inline explicit GenericFunctor(Delegate<C> d);
+    inline GenericFunctor(std::string sn, Delegate<C> d);
+    inline GenericFunctor(AbstractThread *, std::string sn, Delegate<C> d);
+    inline GenericFunctor(AbstractThread *, Delegate<C> d);
 
     inline std::string get_type() override;
     inline C call();
+    inline C call_in_place() {return thread ? call_blocking() : ftor();};
     inline void aa_call() override;
 
     inline void set_thread(AbstractThread *t);
+    inline AbstractThread *target() {return thread;};
+    inline void set_blocking(bool b) {_blocking = b;};
+    inline bool blocking() {return _blocking;};
 
     inline explicit operator GenericFunctor<void> *() {
         return new GenericFunctor<void>(SSDSet::name(), ftor);
@@ -247,12 +377,18 @@ public:
     }
 
     inline function_t &get() {return ftor;};
+    //Empty if the ftor was not built from a Delegate.
+    inline const Delegate<C> &delegate() const {return dlg;};
 
 protected:
     AbstractThread *thread = nullptr;
+    bool _blocking = false;
 
 private:
+    inline C call_blocking();
+
     function_t ftor;
+    Delegate<C> dlg;
     friend class GenericExecutor<C>;
 };
 
@@ -275,21 +411,21 @@ public:
     static SignalTracker *get();
     static bool accessible();
 
-    inline std::list<int> get_availables() {return _available_ones;};
-    inline AbstractSignalTracking *get_signal(int id) {return mapped[id];};
-    inline int next_id();
+    //Walks the table, no lock taken: what registers meanwhile may be missed.
+    inline std::list<int> get_availables();
+    //Calls f(id, signal, tracked) on each signal, no allocation and no lock: a signal handler can call it.
+    template<class F> inline void for_each(F &&f);
+    inline AbstractSignalTracking *get_signal(int id) {return _signals.get(id);};
+    inline int next_id() {return _signals.issued() + 1;};
 
     inline void enable_track_on_registered(bool enable = true) {en_trk_on_reg = enable;};
     inline void track(int id, bool enable = true);
 
 private:
-    std::list<int> _available_ones;
-    std::map<int, AbstractSignalTracking *> mapped;
-    bool en_trk_on_reg = false;
+    IdTable<AbstractSignalTracking> _signals;
+    std::atomic<bool> en_trk_on_reg = {false};
 
-    std::mutex mtx;
-
-    inline void add_sig(int id, AbstractSignalTracking *sig);
+    inline int add_sig(AbstractSignalTracking *sig);
     inline void remove_sig(int id);
     friend class AbstractSignalTracking;
 };
@@ -303,11 +439,10 @@ public:
     inline int get_id() {return allocated_id;};
 
 protected:
-    bool tracking_enabled = false;
+    std::atomic<bool> tracking_enabled = {false};
 
 private:
     int allocated_id = -2;
-    inline static int last_id = 0;
     friend class SignalTracker;
 };
 #endif
@@ -332,42 +467,65 @@ public:
 #else
     SSDSet(sn, gs_fsl, {typeid(Args).name() ...})
 #endif
-    {};
+    {
+        set_lock_site(mtx, "GenericSignal::mtx", sn);
+    };
 
-    inline virtual ~GenericSignal() {
-#ifdef SIGSOT_TRACKING
-        AbstractSignalTracking::~AbstractSignalTracking();
-#endif
-    }
+    inline virtual ~GenericSignal() {}
 
-    inline virtual void emit(Args ... vals);
+    //Lvalues are given to the slots by reference, rvalues are moved once into the payload of the queued slots.
+    inline virtual void emit(const Args & ... vals);
+    inline virtual void emit(std::decay_t<Args> && ... vals);
 
-    inline virtual void connect(GenericFunctor<C, Args ...> *) {};
-    inline virtual void connect(function_t f) {connect(new GenericFunctor<C, Args ...>(f));};
+    //The signal owns the connected ftors, the returned handle disconnects in O(1).
+    inline virtual Connection connect(GenericFunctor<C, Args ...> *) {return Connection();};
+    inline virtual Connection connect(function_t f) {return connect(new GenericFunctor<C, Args ...>(f));};
     inline virtual void connect(function_t a, function_t b) {connect(a); connect(b);};
     inline virtual void connect(GenericFunctor<C, Args ...> *a, GenericFunctor<C, Args ...> *b) {connect(a); connect(b);};
 
+    inline virtual bool disconnect(Connection c) {return c.disconnect();};
     inline virtual void disconnect(GenericFunctor<C, Args ...> *) {};
-    inline virtual void disconnect(function_t f) {disconnect(new GenericFunctor<C, Args ...>(f));};
+    //std::functions cannot be compared: only the ones holding the same function pointer match.
+    inline virtual void disconnect(function_t) {};
     inline virtual void disconnect(function_t a, function_t b) {disconnect(a); disconnect(b);};
     inline virtual void disconnect(GenericFunctor<C, Args ...> *a, GenericFunctor<C, Args ...> *b) {disconnect(a); disconnect(b);};
 
+    //Delegates connect without allocating a bind, and are disconnected by identity (same method and object).
+    inline virtual Connection connect(Delegate<C, Args ...> d) {return connect(new GenericFunctor<C, Args ...>(d));};
+    inline virtual void disconnect(Delegate<C, Args ...>) {};
+
     //As in a signal returns mean nothing, we can pass other return types too by using anonymouses! Handle them as separated, they are not GenericFunctor deductible.
-    //But that is clearly not a reason to fully switch to anonymouses, while we can use the original GenericFunctor because it use less runtime checks.
-    inline virtual void connect(AnonymousFunctor *) {};
+    //Their arguments are checked once at connect (an empty Connection if they do not match), then they are called like any ftor.
+    inline virtual Connection connect(AnonymousFunctor *) {return Connection();};
     inline virtual void connect(AnonymousFunctor *a, AnonymousFunctor *b) {connect(a); connect(b);};
     inline virtual void disconnect(AnonymousFunctor *) {};
     inline virtual void disconnect(AnonymousFunctor *a, AnonymousFunctor *b) {disconnect(a); disconnect(b);};
 
 protected:
     static constexpr size_t gs_fsl {sizeof ... (Args)};
-    std::mutex mtx;
+    TrackedMutex mtx;
+#ifdef ALLOC_PROFILING
+    //What the slots allocate during an emit is attributed to the signal.
+    std::atomic<uint32_t> _alloc_label = {0};
+    inline AllocScope alloc_scope() {return AllocScope(_alloc_label, [this]() {return "signal " + this->name();});};
+#endif
+#ifdef TIMELINE_TRACING
+    std::atomic<uint32_t> _trace_label = {0};
+    inline TraceSpan trace_span() {return TraceSpan(TraceKind::Emit, _trace_label, [this]() {return this->name();});};
+#endif
 
     inline bool tracked() {
 #ifdef SIGSOT_TRACKING
         return tracking_enabled;
 #else
         return false;
+#endif
+    }
+    inline uint32_t flight_id() {
+#ifdef SIGSOT_TRACKING
+        return uint32_t(AbstractSignalTracking::get_id());
+#else
+        return 0;
 #endif
     }
 };
@@ -388,34 +546,47 @@ public:
 #else
     SSDSet(sn, gs_fsl, {})
 #endif
-    {};
+    {
+        set_lock_site(mtx, "GenericSignal::mtx", sn);
+    };
 
-    inline ~GenericSignal() {
-#ifdef SIGSOT_TRACKING
-        //AbstractSignalTracking::~AbstractSignalTracking();
-#endif
-    }
+    inline ~GenericSignal() {}
 
     inline virtual void emit();
 
-    inline virtual void connect(GenericFunctor<C> *) {};
-    inline virtual void connect(function_t f) {connect(new GenericFunctor<C>(f));};
+    //The signal owns the connected ftors, the returned handle disconnects in O(1).
+    inline virtual Connection connect(GenericFunctor<C> *) {return Connection();};
+    inline virtual Connection connect(function_t f) {return connect(new GenericFunctor<C>(f));};
     inline virtual void connect(function_t a, function_t b) {connect(a); connect(b);};
     inline virtual void connect(GenericFunctor<C> *a, GenericFunctor<C> *b) {connect(a); connect(b);};
 
+    inline virtual bool disconnect(Connection c) {return c.disconnect();};
     inline virtual void disconnect(GenericFunctor<C> *) {};
-    inline virtual void disconnect(function_t f) {disconnect(new GenericFunctor<C>(f));};
+    //std::functions cannot be compared: only the ones holding the same function pointer match.
+    inline virtual void disconnect(function_t) {};
     inline virtual void disconnect(function_t a, function_t b) {disconnect(a); disconnect(b);};
     inline virtual void disconnect(GenericFunctor<C> *a, GenericFunctor<C> *b) {disconnect(a); disconnect(b);};
 
-    inline virtual void connect(AnonymousFunctor *) {};
+    inline virtual Connection connect(Delegate<C> d) {return connect(new GenericFunctor<C>(d));};
+    inline virtual void disconnect(Delegate<C>) {};
+
+    inline virtual Connection connect(AnonymousFunctor *) {return Connection();};
     inline virtual void connect(AnonymousFunctor *a, AnonymousFunctor *b) {connect(a); connect(b);};
     inline virtual void disconnect(AnonymousFunctor *) {};
     inline virtual void disconnect(AnonymousFunctor *a, AnonymousFunctor *b) {disconnect(a); disconnect(b);};
 
 protected:
     static constexpr size_t gs_fsl {0};
-    std::mutex mtx;
+    TrackedMutex mtx;
+#ifdef ALLOC_PROFILING
+    //What the slots allocate during an emit is attributed to the signal.
+    std::atomic<uint32_t> _alloc_label = {0};
+    inline AllocScope alloc_scope() {return AllocScope(_alloc_label, [this]() {return "signal " + this->name();});};
+#endif
+#ifdef TIMELINE_TRACING
+    std::atomic<uint32_t> _trace_label = {0};
+    inline TraceSpan trace_span() {return TraceSpan(TraceKind::Emit, _trace_label, [this]() {return this->name();});};
+#endif
 
     inline bool tracked() {
 #ifdef SIGSOT_TRACKING
@@ -424,6 +595,119 @@ protected:
         return false;
 #endif
     }
+    inline uint32_t flight_id() {
+#ifdef SIGSOT_TRACKING
+        return uint32_t(AbstractSignalTracking::get_id());
+#else
+        return 0;
+#endif
+    }
+};
+
+//Slots of an emit_parallel(): the workers, and the thread waiting on the handle, each take the next
+//one until there are none left. The last one to finish wakes the waiters.
+class ParallelJob
+{
+public:
+    inline explicit ParallelJob(size_t count) : _count(count), _remaining(count) {};
+    inline virtual ~ParallelJob() {};
+
+    //Runs the next slot, false once they are all taken. A slot that throws still counts as done.
+    inline bool run_one() {
+        size_t i = _next.fetch_add(1);
+        if (i >= _count) {
+            return false;
+        }
+        struct Done {
+            ParallelJob *job;
+            inline ~Done() {
+                if (job->_remaining.fetch_sub(1) == 1) {
+                    job->mtx.lock();
+                    job->mtx.unlock();
+                    job->cv.notify_all();
+                }
+            };
+        } done {this};
+        run(i);
+        return true;
+    };
+
+    inline void wait() {
+        while (run_one()) {}
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this]() {return _remaining.load() == 0;});
+    };
+
+    inline bool done() {return _remaining.load() == 0;};
+
+protected:
+    virtual void run(size_t i) = 0;
+
+private:
+    const size_t _count;
+    std::atomic<size_t> _next {0};
+    std::atomic<size_t> _remaining;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+//Runs copies of the slots' functions, so the slot map is not kept entered while the job lasts.
+template<class C, class ... Args>
+class ParallelSlots : public ParallelJob
+{
+public:
+    using payload_t = std::tuple<std::decay_t<Args> ...>;
+    using function_t = std::function<C(Args ...)>;
+
+    inline ParallelSlots(std::vector<function_t> slots, std::shared_ptr<payload_t> payload)
+        : ParallelJob(slots.size()), _slots(std::move(slots)), _payload(std::move(payload)) {};
+
+protected:
+    inline void run(size_t i) override {
+        if constexpr (sizeof ... (Args) == 0) {
+            _slots[i]();
+        } else {
+            GenericExecutor<C, Args ...>::invoke_shared(_slots[i], *_payload);
+        }
+    };
+
+private:
+    std::vector<function_t> _slots;
+    std::shared_ptr<payload_t> _payload;
+};
+
+//Returned by emit_parallel(). wait() runs the slots no worker has taken yet, then waits for the others.
+//Dropped without wait(), it still runs the slots no worker has taken, but does not wait for the others.
+class EmitHandle
+{
+public:
+    inline EmitHandle() {};
+    inline explicit EmitHandle(std::shared_ptr<ParallelJob> job) : _job(std::move(job)) {};
+    inline EmitHandle(EmitHandle &&other) : _job(std::move(other._job)) {};
+    inline EmitHandle &operator=(EmitHandle &&other) {
+        if (this != &other) {
+            run_left();
+            _job = std::move(other._job);
+        }
+        return *this;
+    };
+    inline ~EmitHandle() {run_left();};
+
+    inline void wait() {
+        if (_job) {
+            _job->wait();
+        }
+    };
+    inline bool done() {return !_job || _job->done();};
+
+private:
+    inline void run_left() {
+        if (_job) {
+            while (_job->run_one()) {}
+        }
+    };
+
+    std::shared_ptr<ParallelJob> _job;
 };
 
 template<class C = void, class ... Args>
@@ -432,22 +716,38 @@ class SignalMulti : public GenericSignal<C, Args ...>
 public:
     using function_t = std::function<C(Args ...)>;
     inline explicit SignalMulti(std::string sn = "Undefined");
-    inline ~SignalMulti() {
-#ifdef SIGSOT_TRACKING
-        this->GenericSignal<C, Args ...>::~GenericSignal();
-#endif
-    }
-
-    inline void emit(Args ... vals) override;
-
-    inline void connect(GenericFunctor<C, Args ...> *f) override;
+    inline ~SignalMulti() {}
+
+    inline void emit(const Args & ... vals) override;
+    inline void emit(std::decay_t<Args> && ... vals) override;
+    //Queued slots need a copy of the values: emitting a non-copyable lvalue does not compile, emit it as an rvalue.
+    template<class ... Vals, std::enable_if_t<sizeof ... (Vals) == sizeof ... (Args) &&
+                                              !std::is_constructible<std::tuple<std::decay_t<Args> ...>, Vals && ...>::value, int> = 0>
+    void emit(Vals && ... vals) = delete;
+    //Spreads the direct slots over the workers (one callback each), the queued ones go to their target
+    //thread as usual. The values are copied (or moved) once, for all of them.
+    template<class ... Vals> inline EmitHandle emit_parallel(const std::vector<AbstractThread *> &workers, Vals && ... vals);
+
+    using GenericSignal<C, Args ...>::connect;
+    using GenericSignal<C, Args ...>::disconnect;
+    inline Connection connect(GenericFunctor<C, Args ...> *f) override;
     inline void disconnect(GenericFunctor<C, Args ...> *f) override;
-    inline void connect(AnonymousFunctor *f) override;
+    inline void disconnect(function_t f) override;
+    inline void disconnect(Delegate<C, Args ...> d) override;
+    inline Connection connect(AnonymousFunctor *f) override;
     inline void disconnect(AnonymousFunctor *f) override;
 
+    inline size_t slots_count() {return _slots->size();};
+
+protected:
+    std::shared_ptr<SlotMap<GenericFunctor<C, Args ...>>> _slots = std::make_shared<SlotMap<GenericFunctor<C, Args ...>>>();
+
 private:
-    std::list<GenericFunctor<C, Args ...> *> _callbacks;
-    std::list<AnonymousFunctor *> _a_callbacks;
+    static_assert(payload_shareable<Args ...>::value, "SignalMulti gives the same values to several slots: take non-copyable types by reference");
+
+    template<class ... Vals> inline void _emit(Vals && ... vals);
+
+    std::list<std::pair<AnonymousFunctor *, Connection>> _a_callbacks;
 };
 
 template<class C>
@@ -456,27 +756,190 @@ class SignalMulti<C> : public GenericSignal<C>
 public:
     using function_t = std::function<C()>;
     inline explicit SignalMulti(std::string sn = "Undefined");
-    inline ~SignalMulti() {
-#ifdef SIGSOT_TRACKING
-        //this->GenericSignal<C>::~GenericSignal();
-#endif
-    }
+    inline ~SignalMulti() {}
 
     inline void emit() override;
+    inline EmitHandle emit_parallel(const std::vector<AbstractThread *> &workers);
 
-    inline void connect(GenericFunctor<C> *f) override;
+    using GenericSignal<C>::connect;
+    using GenericSignal<C>::disconnect;
+    inline Connection connect(GenericFunctor<C> *f) override;
     inline void disconnect(GenericFunctor<C> *f) override;
-    inline void connect(AnonymousFunctor *f) override;
+    inline void disconnect(function_t f) override;
+    inline void disconnect(Delegate<C> d) override;
+    inline Connection connect(AnonymousFunctor *f) override;
     inline void disconnect(AnonymousFunctor *f) override;
 
+    inline size_t slots_count() {return _slots->size();};
+
+protected:
+    std::shared_ptr<SlotMap<GenericFunctor<C>>> _slots = std::make_shared<SlotMap<GenericFunctor<C>>>();
+
 private:
-    std::list<GenericFunctor<C> *> _callbacks;
-    std::list<AnonymousFunctor *> _a_callbacks;
+    std::list<std::pair<AnonymousFunctor *, Connection>> _a_callbacks;
+};
+
+
+//How a SignalCoalesced delivers to the slots which have a target thread. Each target thread has at most
+//one pending delivery, carrying the last emitted values (overwritten in place), so its queue does not grow
+//with the emit rate. Throttle and Debounce post it for the time it is due (add_callback_at()). A mailbox is
+//dropped once idle, or if its delivery is deleted with its thread.
+//The slots without a target thread have no loop to drive them: they are called on every emit.
+enum class CoalescePolicy {
+    Latest,     //On the next pass of the target loop.
+    Throttle,   //At most once per interval.
+    Debounce    //Once no emit happened for the interval.
 };
 
+template<class C, class ... Args>
+class CoalescedDelivery : public std::enable_shared_from_this<CoalescedDelivery<C, Args ...>>
+{
+public:
+    using payload_t = std::tuple<std::decay_t<Args> ...>;
+    using slots_t = SlotMap<GenericFunctor<C, Args ...>>;
+
+    inline CoalescedDelivery(std::weak_ptr<slots_t> slots, CoalescePolicy policy, std::chrono::nanoseconds interval)
+        : _slots(std::move(slots)), _policy(policy), _interval(interval) {};
 
+    template<class ... Vals> inline void emit(slots_t &slots, Vals & ... vals);
+
+private:
+    struct Mailbox {
+        std::mutex mtx;
+        std::optional<payload_t> latest;
+        std::optional<payload_t> delivered;
+        uint64_t stamp = 0;
+        bool fresh = false;
+        bool posted = false;
+        bool dropped = false;
+        std::chrono::steady_clock::time_point last_emit;
+        std::chrono::steady_clock::time_point last_delivery;
+    };
+
+    //A posted delivery: deleted without running (with its thread), it drops the mailbox.
+    struct Posting {
+        inline Posting(std::shared_ptr<CoalescedDelivery> s, std::shared_ptr<Mailbox> b, AbstractThread *t) : self(std::move(s)), box(std::move(b)), thread(t) {};
+        Posting(const Posting &) = delete;
+
+        std::shared_ptr<CoalescedDelivery> self;
+        std::shared_ptr<Mailbox> box;
+        AbstractThread *thread;
+        bool ran = false;
+        inline ~Posting() {
+            if (!ran) {
+                box->mtx.lock();
+                self->drop_locked(box, thread);
+                box->mtx.unlock();
+            }
+        };
+    };
+
+    inline std::shared_ptr<Mailbox> mailbox(AbstractThread *t);
+    //At when, now if it is not set.
+    inline void post(std::shared_ptr<Mailbox> box, AbstractThread *t, std::chrono::steady_clock::time_point when = {});
+    inline void flush(std::shared_ptr<Mailbox> box, AbstractThread *t);
+    inline void drop_locked(const std::shared_ptr<Mailbox> &box, AbstractThread *t);
+
+    std::weak_ptr<slots_t> _slots;
+    const CoalescePolicy _policy;
+    const std::chrono::nanoseconds _interval;
+    std::atomic<uint64_t> _stamp {0};
+    std::map<AbstractThread *, std::shared_ptr<Mailbox>> _boxes;
+    std::mutex mtx;
+};
+
+template<class C = void, class ... Args>
+class SignalCoalesced : public SignalMulti<C, Args ...>
+{
+public:
+    inline explicit SignalCoalesced(std::string sn = "Undefined", CoalescePolicy policy = CoalescePolicy::Latest, std::chrono::nanoseconds interval = std::chrono::nanoseconds(0))
+        : SignalMulti<C, Args ...>(sn), _delivery(std::make_shared<CoalescedDelivery<C, Args ...>>(this->_slots, policy, interval)) {};
+
+    inline void emit(const Args & ... vals) override;
+    inline void emit(std::decay_t<Args> && ... vals) override;
+
+private:
+    std::shared_ptr<CoalescedDelivery<C, Args ...>> _delivery;
+};
+
+template<class C>
+class SignalCoalesced<C> : public SignalMulti<C>
+{
+public:
+    inline explicit SignalCoalesced(std::string sn = "Undefined", CoalescePolicy policy = CoalescePolicy::Latest, std::chrono::nanoseconds interval = std::chrono::nanoseconds(0))
+        : SignalMulti<C>(sn), _delivery(std::make_shared<CoalescedDelivery<C>>(this->_slots, policy, interval)) {};
+
+    inline void emit() override;
+
+private:
+    std::shared_ptr<CoalescedDelivery<C>> _delivery;
+};
+
+template<class C = void, class ... Args>
+class SignalLatest : public SignalCoalesced<C, Args ...>
+{
+public:
+    inline explicit SignalLatest(std::string sn = "Undefined") : SignalCoalesced<C, Args ...>(sn, CoalescePolicy::Latest) {};
+};
+
+template<class C = void, class ... Args>
+class SignalThrottled : public SignalCoalesced<C, Args ...>
+{
+public:
+    inline SignalThrottled(std::string sn, std::chrono::nanoseconds interval) : SignalCoalesced<C, Args ...>(sn, CoalescePolicy::Throttle, interval) {};
+    inline explicit SignalThrottled(std::chrono::nanoseconds interval) : SignalThrottled("Undefined", interval) {};
+};
+
+template<class C = void, class ... Args>
+class SignalDebounced : public SignalCoalesced<C, Args ...>
+{
+public:
+    inline SignalDebounced(std::string sn, std::chrono::nanoseconds interval) : SignalCoalesced<C, Args ...>(sn, CoalescePolicy::Debounce, interval) {};
+    inline explicit SignalDebounced(std::chrono::nanoseconds interval) : SignalDebounced("Undefined", interval) {};
+};
+
+//Signal whose slots are fixed at compile time: function pointers, or addresses of static GenericFunctors
+//or signals (then called with call()/emit()). emit() unrolls to the sequence of calls, so it can be fully
+//inlined: no allocation, no lock, no virtual call, and no tracking or outputs either.
+//functor() wraps it in a GenericFunctor, to connect the whole static list to a dynamic signal.
+template<auto ... Slots>
+class StaticSignal
+{
+public:
+    template<class ... Vals> static inline void emit(Vals && ... vals);
+
+    template<class C = void, class ... Args> static inline GenericFunctor<C, Args ...> *functor(std::string sn = "StaticSignal");
+
+private:
+    template<auto Slot, class ... Vals> static inline void _call(Vals & ... vals);
+};
 
 //Now here is the source.
+/******** Delegate *******/
+template<class C, class ... Args> inline
+Delegate<C, Args ...>::Delegate(C (*func)(Args ...)) : _obj(reinterpret_cast<void *>(func))
+{
+    _stub = [](void *f, Args && ... vals) -> C {
+        return reinterpret_cast<C (*)(Args ...)>(f)(std::forward<Args>(vals) ...);
+    };
+}
+
+template<class C, class ... Args> template<auto Method, class T> inline
+Delegate<C, Args ...> Delegate<C, Args ...>::bind(T *obj)
+{
+    return Delegate(const_cast<void *>(static_cast<const void *>(obj)), [](void *o, Args && ... vals) -> C {
+        return (static_cast<T *>(o)->*Method)(std::forward<Args>(vals) ...);
+    });
+}
+
+template<class C, class ... Args> template<auto Func> inline
+Delegate<C, Args ...> Delegate<C, Args ...>::bind()
+{
+    return Delegate(nullptr, [](void *, Args && ... vals) -> C {
+        return Func(std::forward<Args>(vals) ...);
+    });
+}
+
 /******** Functor ********/
 
 //Abstract layer
@@ -486,18 +949,52 @@ void AnonymousFunctor::a_call(Args ... vals)
     if (ArgsAnonymousFunctor<Args ...> *c = dynamic_cast<ArgsAnonymousFunctor<Args ...> *>(this)) {
         c->aa_call(vals ...);
     } else {
-        std::list<std::string> sign_a {typeid(Args).name() ...};
-        std::list<std::string> sign_b = signature();
-        std::cout << "Anonymous function transformation failed: invalid arguments:\n" << "[" << name() << "] [";
-        for (std::string v : sign_b) {
-            std::cout << v << " - ";
-        }
-        std::cout << "] to [";
-        for (std::string v : sign_a) {
-            std::cout << v << " - ";
+        mismatch_notice<Args ...>();
+    }
+}
+
+template<class C, class ... Args> inline
+GenericFunctor<C, Args ...> *AnonymousFunctor::to_functor()
+{
+    if (ArgsAnonymousFunctor<Args ...> *c = dynamic_cast<ArgsAnonymousFunctor<Args ...> *>(this)) {
+        std::shared_ptr<AnonymousFunctor> owned(this);
+        return new GenericFunctor<C, Args ...>(name(), [c, owned](Args ... vals) -> C {
+            c->aa_call(std::forward<Args>(vals) ...);
+            if constexpr (!std::is_void<C>::value) {
+                return C();
+            }
+        });
+    }
+    if constexpr (sizeof ... (Args) > 0) {
+        if (ArgsAnonymousFunctor<> *c = dynamic_cast<ArgsAnonymousFunctor<> *>(this)) {
+            std::shared_ptr<AnonymousFunctor> owned(this);
+            return new GenericFunctor<C, Args ...>(name(), [c, owned](Args ...) -> C {
+                c->aa_call();
+                if constexpr (!std::is_void<C>::value) {
+                    return C();
+                }
+            });
         }
-        std::cout << "]" << std::endl;
     }
+    mismatch_notice<Args ...>();
+    delete this;
+    return nullptr;
+}
+
+template<class ... Args> inline
+void AnonymousFunctor::mismatch_notice()
+{
+    std::list<std::string> sign_a {typeid(Args).name() ...};
+    std::list<std::string> sign_b = signature();
+    std::cout << "Anonymous function transformation failed: invalid arguments:\n" << "[" << name() << "] [";
+    for (std::string v : sign_b) {
+        std::cout << v << " - ";
+    }
+    std::cout << "] to [";
+    for (std::string v : sign_a) {
+        std::cout << v << " - ";
+    }
+    std::cout << "]" << std::endl;
 }
 
 // The specialised one
@@ -528,28 +1025,67 @@ GenericFunctor<C>::GenericFunctor(AbstractThread *t, std::function<C()> func) :
     thread = t;
 }
 
+template<class C> inline
+GenericFunctor<C>::GenericFunctor(Delegate<C> d) : GenericFunctor<C>("Undefined", d)
+{
+}
+
+template<class C> inline
+GenericFunctor<C>::GenericFunctor(std::string sn, Delegate<C> d) : ArgsAnonymousFunctor<>(sn, 0, {})
+{
+    ftor = d;
+    dlg = d;
+}
+
+template<class C> inline
+GenericFunctor<C>::GenericFunctor(AbstractThread *t, std::string sn, Delegate<C> d) : GenericFunctor<C>(sn, d)
+{
+    thread = t;
+}
+
+template<class C> inline
+GenericFunctor<C>::GenericFunctor(AbstractThread *t, Delegate<C> d) : GenericFunctor<C>("Undefined", d)
+{
+    thread = t;
+}
+
 template<class C> inline
 std::string GenericFunctor<C>::get_type()
 {
-    int status;
-    const char *t = typeid(this).name();
-    char *dem = abi::__cxa_demangle(t,0,0,&status);
-    if (status == 0) {
-        return std::string(dem);
-    } else {
-        return std::string(t);
-    }
+    //Demangled once per type, not at each call.
+    return Symbolizer::get()->demangle(typeid(this).name());
 }
 
 template<class C> inline
 C GenericFunctor<C>::call() {
-    if (thread) {
+    if (thread && _blocking) {
+        return call_blocking();
+    } else if (thread) {
         thread->add_callback(new GenericExecutor<C>(ftor));
     } else {
         return ftor();
     }
 }
 
+template<class C> inline
+C GenericFunctor<C>::call_blocking() {
+    if (thread->in_thread()) {
+        return ftor();
+    }
+    Latch *latch = Latch::acquire();
+    if constexpr (std::is_void<C>::value) {
+        thread->add_callback(new GenericExecutor<>([&]() {ftor(); latch->open();}));
+        latch->wait();
+        Latch::release(latch);
+    } else {
+        std::optional<C> result;
+        thread->add_callback(new GenericExecutor<>([&]() {result.emplace(ftor()); latch->open();}));
+        latch->wait();
+        Latch::release(latch);
+        return std::move(*result);
+    }
+}
+
 template<class C> inline
 void GenericFunctor<C>::aa_call() {
     call();
@@ -582,44 +1118,124 @@ GenericFunctor<C, Args ...>::GenericFunctor(AbstractThread *t, std::function<C(A
     thread = t;
 }
 
+template<class C, class ... Args> inline
+GenericFunctor<C, Args ...>::GenericFunctor(Delegate<C, Args ...> d) : GenericFunctor<C, Args ...>("Undefined", d)
+{
+}
+
+template<class C, class ... Args> inline
+GenericFunctor<C, Args ...>::GenericFunctor(std::string sn, Delegate<C, Args ...> d) : ArgsAnonymousFunctor<Args ...>(sn, gf_fsl, {typeid(Args).name() ...})
+{
+    ftor = d;
+    dlg = d;
+}
+
+template<class C, class ... Args> inline
+GenericFunctor<C, Args ...>::GenericFunctor(AbstractThread *t, std::string sn, Delegate<C, Args ...> d) : GenericFunctor<C, Args ...>(sn, d)
+{
+    thread = t;
+}
+
+template<class C, class ... Args> inline
+GenericFunctor<C, Args ...>::GenericFunctor(AbstractThread *t, Delegate<C, Args ...> d) : GenericFunctor<C, Args ...>("Undefined", d)
+{
+    thread = t;
+}
+
 template<class C, class ... Args> inline
 std::string GenericFunctor<C, Args ...>::get_type()
 {
-    int status;
-    const char *t = typeid(this).name();
-    char *dem = abi::__cxa_demangle(t,0,0,&status);
-    if (status == 0) {
-        return std::string(dem);
+    //Demangled once per type, not at each call.
+    return Symbolizer::get()->demangle(typeid(this).name());
+}
+
+template<class C, class ... Args> template<class ... Vals> inline
+C GenericFunctor<C, Args ...>::call(Vals && ... vals) {
+    static_assert(std::is_constructible<payload_t, Vals && ...>::value,
+                  "A queued call needs a copy of the values: pass a non-copyable one as an rvalue, or use call_in_place()");
+    if (thread && _blocking) {
+        return call_blocking(std::forward<Vals>(vals) ...);
+    } else if (thread) {
+        if (affinity) {
+            size_t key = affinity(vals ...);
+            thread->add_callback(new GenericExecutor<C, Args ...>(ftor, std::forward<Vals>(vals) ...), key);
+        } else {
+            thread->add_callback(new GenericExecutor<C, Args ...>(ftor, std::forward<Vals>(vals) ...));
+        }
     } else {
-        return std::string(t);
+        return ftor(std::forward<Vals>(vals) ...);
     }
 }
 
-template<class C, class ... Args> inline
-C GenericFunctor<C, Args ...>::call(Args ... vals) {
+template<class C, class ... Args> template<class ... Vals> inline
+C GenericFunctor<C, Args ...>::call_in_place(Vals && ... vals) {
     if (thread) {
-        thread->add_callback(new GenericExecutor<C, Args ...>(ftor, vals ...));
+        return call_blocking(std::forward<Vals>(vals) ...);
+    }
+    return ftor(std::forward<Vals>(vals) ...);
+}
+
+//The caller waits, so the values are used where they are: no copy, no allocation but the callback.
+template<class C, class ... Args> template<class ... Vals> inline
+C GenericFunctor<C, Args ...>::call_blocking(Vals && ... vals) {
+    if (thread->in_thread()) {
+        return ftor(std::forward<Vals>(vals) ...);
+    }
+    Latch *latch = Latch::acquire();
+    if constexpr (std::is_void<C>::value) {
+        thread->add_callback(new GenericExecutor<>([&]() {ftor(std::forward<Vals>(vals) ...); latch->open();}));
+        latch->wait();
+        Latch::release(latch);
+    } else {
+        std::optional<C> result;
+        thread->add_callback(new GenericExecutor<>([&]() {result.emplace(ftor(std::forward<Vals>(vals) ...)); latch->open();}));
+        latch->wait();
+        Latch::release(latch);
+        return std::move(*result);
+    }
+}
+
+template<class C, class ... Args> inline
+void GenericFunctor<C, Args ...>::call_shared(const shared_payload_t &payload) {
+    if (thread && _blocking) {
+        if (thread->in_thread()) {
+            GenericExecutor<C, Args ...>::invoke_shared(ftor, *payload);
+            return;
+        }
+        Latch *latch = Latch::acquire();
+        thread->add_callback(new GenericExecutor<>([&]() {GenericExecutor<C, Args ...>::invoke_shared(ftor, *payload); latch->open();}));
+        latch->wait();
+        Latch::release(latch);
+    } else if (thread && affinity) {
+        thread->add_callback(new GenericExecutor<C, Args ...>(ftor, payload), std::apply(affinity, *payload));
+    } else if (thread) {
+        thread->add_callback(new GenericExecutor<C, Args ...>(ftor, payload));
     } else {
-        return ftor(vals ...);
+        GenericExecutor<C, Args ...>::invoke_shared(ftor, *payload);
     }
 }
 
+//Values that cannot be copied for a queued call are given blocking.
 template<class C, class ... Args> inline
 void GenericFunctor<C, Args ...>::aa_call(Args ... vals)
 {
-    call(vals ...);
+    if constexpr (std::is_constructible<payload_t, Args && ...>::value) {
+        call(std::forward<Args>(vals) ...);
+    } else {
+        call_in_place(std::forward<Args>(vals) ...);
+    }
 }
 
 
 
 /******** Executor ********/
 template<class C> inline
-GenericExecutor<C>::GenericExecutor(std::function<C()> func) : AbstractExecutor(), _bind(func)
+GenericExecutor<C>::GenericExecutor(std::function<C()> func) : AbstractExecutor(), _bind(std::move(func))
 {
 }
 
 template<class C> inline
-GenericExecutor<C>::GenericExecutor(std::string sn, std::function<C()> func) : AbstractExecutor(sn), _bind(func)
+GenericExecutor<C>::GenericExecutor(std::string sn, std::function<C()> func) : AbstractExecutor(sn), _bind(std::move(func))
 {
 }
 
@@ -643,105 +1259,141 @@ C GenericExecutor<C>::run()
 template<class C> inline
 std::string GenericExecutor<C>::get_type()
 {
-    int status;
-    const char *t = typeid(this).name();
-    char *dem = abi::__cxa_demangle(t,0,0,&status);
-    if (status == 0) {
-        return std::string(dem);
-    } else {
-        return std::string(t);
-    }
+    //Demangled once per type, not at each call.
+    return Symbolizer::get()->demangle(typeid(this).name());
 }
 
 
-template<class C, class ... Args> inline
-GenericExecutor<C, Args ...>::GenericExecutor(std::function<C(Args ...)> func, Args ... vals) : AbstractExecutor(), _bind(func, vals ...)
+template<class C, class ... Args> template<class ... Vals, class> inline
+GenericExecutor<C, Args ...>::GenericExecutor(std::function<C(Args ...)> func, Vals && ... vals) : AbstractExecutor(), _func(std::move(func)), _payload(std::make_shared<payload_t>(std::forward<Vals>(vals) ...))
+{
+}
+
+template<class C, class ... Args> template<class ... Vals, class> inline
+GenericExecutor<C, Args ...>::GenericExecutor(std::string sn, std::function<C(Args ...)> func, Vals && ... vals) : AbstractExecutor(sn), _func(std::move(func)), _payload(std::make_shared<payload_t>(std::forward<Vals>(vals) ...))
+{
+}
+
+template<class C, class ... Args> template<class ... Vals, class> inline
+GenericExecutor<C, Args ...>::GenericExecutor(GenericFunctor<C, Args ...> *src, Vals && ... vals) : AbstractExecutor(src->name()), _func(src->get()), _payload(std::make_shared<payload_t>(std::forward<Vals>(vals) ...))
 {
 }
 
 template<class C, class ... Args> inline
-GenericExecutor<C, Args ...>::GenericExecutor(std::string sn, std::function<C(Args ...)> func, Args ... vals) : AbstractExecutor(sn), _bind(func, vals ...)
+GenericExecutor<C, Args ...>::GenericExecutor(std::function<C(Args ...)> func, shared_payload_t payload) : AbstractExecutor(), _func(std::move(func)), _payload(std::move(payload))
 {
 }
 
 template<class C, class ... Args> inline
-GenericExecutor<C, Args ...>::GenericExecutor(GenericFunctor<C, Args ...> *src, Args ... vals) : AbstractExecutor(src->name()), _bind(src->get(), vals ...)
+GenericExecutor<C, Args ...>::GenericExecutor(GenericFunctor<C, Args ...> *src, shared_payload_t payload) : AbstractExecutor(src->name()), _func(src->get()), _payload(std::move(payload))
 {
 }
 
 template<class C, class ... Args> inline
 void GenericExecutor<C, Args ...>::execute()
 {
-    _bind();
+    invoke(_func, _payload);
 }
 
 template<class C, class ... Args> inline
 C GenericExecutor<C, Args ...>::run()
 {
-    return _bind();
+    return invoke(_func, _payload);
 }
 
 template<class C, class ... Args> inline
-std::string GenericExecutor<C, Args ...>::get_type()
+C GenericExecutor<C, Args ...>::invoke(function_t &func, shared_payload_t &payload)
 {
-    int status;
-    const char *t = typeid(this).name();
-    char *dem = abi::__cxa_demangle(t,0,0,&status);
-    if (status == 0) {
-        return std::string(dem);
-    } else {
-        return std::string(t);
+    return _invoke(func, payload, std::index_sequence_for<Args ...>{});
+}
+
+template<class C, class ... Args> inline
+C GenericExecutor<C, Args ...>::invoke_shared(function_t &func, payload_t &payload)
+{
+    return _invoke_shared(func, payload, std::index_sequence_for<Args ...>{});
+}
+
+template<class C, class ... Args> template<std::size_t ... I> inline
+C GenericExecutor<C, Args ...>::_invoke(function_t &func, shared_payload_t &payload, std::index_sequence<I ...>)
+{
+    //Another receiver still holds the payload: read it, do not steal it. A count of 1 is final, as only a holder
+    //can take a new reference (there is no weak_ptr to it); the count is read relaxed, the fence orders the other
+    //receivers' reads, done before they dropped theirs (acq_rel), before the move.
+    if constexpr (payload_shareable<Args ...>::value) {
+        if (payload.use_count() != 1) {
+            return _invoke_shared(func, *payload, std::index_sequence<I ...>{});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
     }
+    return func(static_cast<owned_arg_t<Args>>(std::get<I>(*payload)) ...);
+}
+
+template<class C, class ... Args> template<std::size_t ... I> inline
+C GenericExecutor<C, Args ...>::_invoke_shared(function_t &func, payload_t &payload, std::index_sequence<I ...>)
+{
+    static_assert(payload_shareable<Args ...>::value, "A non-copyable value taken by value cannot be shared");
+    return func(static_cast<shared_arg_t<Args>>(std::get<I>(payload)) ...);
+}
+
+template<class C, class ... Args> inline
+std::string GenericExecutor<C, Args ...>::get_type()
+{
+    //Demangled once per type, not at each call.
+    return Symbolizer::get()->demangle(typeid(this).name());
 }
 
 
 
 /***** Sig Tracking ******/
 #ifdef SIGSOT_TRACKING
-inline int SignalTracker::next_id()
+inline std::list<int> SignalTracker::get_availables()
 {
-    return AbstractSignalTracking::last_id;
+    std::list<int> ids;
+    _signals.for_each([&ids](int id, AbstractSignalTracking *, int) {ids.push_back(id);});
+    return ids;
 }
 
-inline void SignalTracker::add_sig(int id, AbstractSignalTracking *sig)
+template<class F> inline
+void SignalTracker::for_each(F &&f)
 {
-    mtx.lock();
+    _signals.for_each([&f](int id, AbstractSignalTracking *s, int) {f(id, s, s->tracking_enabled.load());});
+}
 
+inline int SignalTracker::add_sig(AbstractSignalTracking *sig)
+{
+    int id = _signals.insert(sig);
+#ifdef TRACKING_OUTPUTS
     std::cout << "SIGSOT_TRACKING > [" << id << "] [" << ((SSDSet *)sig)->name() << "] [REGISTERED]" << std::endl;
-
-    mapped.insert({id, sig});
-    _available_ones.push_back(id);
-
+#endif
     if (en_trk_on_reg) {
-        track(id);
+        sig->tracking_enabled = true;
     }
-
-    mtx.unlock();
+    return id;
 }
 
 inline void SignalTracker::remove_sig(int id)
 {
-    mtx.lock();
-    _available_ones.remove(id);
-    std::string sn = mapped[id]->name();
-    mapped.erase(id);
-    std::cout << "SIGSOT_TRACKING > [" << id << "] [" << sn << "] [UNREGISTERED]" << std::endl;
-    mtx.unlock();
+#ifdef TRACKING_OUTPUTS
+    if (AbstractSignalTracking *sig = _signals.get(id)) {
+        std::cout << "SIGSOT_TRACKING > [" << id << "] [" << ((SSDSet *)sig)->name() << "] [UNREGISTERED]" << std::endl;
+    }
+#endif
+    _signals.remove(id);
 }
 
 inline void SignalTracker::track(int id, bool enable)
 {
-    if (AbstractSignalTracking *t = mapped[id]) {
+    if (AbstractSignalTracking *t = _signals.get(id)) {
         t->tracking_enabled = enable;
+#ifdef TRACKING_OUTPUTS
         std::cout << "SIGSOT_TRACKING > [" << id << "] [" << ((SSDSet *)t)->name() << "] [TRACK] [" << (enable ? "ENABLED" : "DISABLED") << "]" << std::endl;
+#endif
     }
 }
 
 AbstractSignalTracking::AbstractSignalTracking(std::string sn, size_t fsl, std::list<std::string> l) : SSDSet(sn, fsl, l)
 {
-    last_id++;
-    allocated_id = last_id;
-    SignalTracker::get()->add_sig(allocated_id, this);
+    allocated_id = SignalTracker::get()->add_sig(this);
 }
 
 inline AbstractSignalTracking::~AbstractSignalTracking()
@@ -757,8 +1409,11 @@ inline AbstractSignalTracking::~AbstractSignalTracking()
 
 /******** Sig Gen ********/
 template<class C, class ... Args> inline
-void GenericSignal<C, Args ...>::emit(Args ...)
+void GenericSignal<C, Args ...>::emit(const Args & ...)
 {
+#ifdef FLIGHT_RECORDER
+    FlightRecorder::record(FlightEvent::Emit, flight_id(), this);
+#endif
 #ifdef SIGSOT_TRACKING
     if (tracked()) {
         std::cout << "SIGSOT_TRACKING > [" << AbstractSignalTracking::get_id() << "] [" << name() << "] [EMITED]" << std::endl;
@@ -767,9 +1422,18 @@ void GenericSignal<C, Args ...>::emit(Args ...)
 #endif
 }
 
+template<class C, class ... Args> inline
+void GenericSignal<C, Args ...>::emit(std::decay_t<Args> && ... vals)
+{
+    GenericSignal<C, Args ...>::emit(static_cast<const Args &>(vals) ...);
+}
+
 template<class C> inline
 void GenericSignal<C>::emit()
 {
+#ifdef FLIGHT_RECORDER
+    FlightRecorder::record(FlightEvent::Emit, flight_id(), this);
+#endif
 #ifdef SIGSOT_TRACKING
     if (tracked()) {
         std::cout << "SIGSOT_TRACKING > [" << AbstractSignalTracking::get_id() << "] [" << name() << "] [EMITED]" << std::endl;
@@ -787,45 +1451,160 @@ SignalMulti<C, Args ...>::SignalMulti(std::string sn) : GenericSignal<C, Args ..
 }
 
 template<class C, class ... Args> inline
-void SignalMulti<C, Args ...>::emit(Args ... vals)
+void SignalMulti<C, Args ...>::emit(const Args & ... vals)
+{
+    _emit(vals ...);
+}
+
+template<class C, class ... Args> inline
+void SignalMulti<C, Args ...>::emit(std::decay_t<Args> && ... vals)
+{
+    _emit(std::move(vals) ...);
+}
+
+//The queued slots share one payload, built when the first of them is met. From then on, the direct
+//slots read it too, as the values might have been moved in.
+template<class C, class ... Args> template<class ... Vals> inline
+void SignalMulti<C, Args ...>::_emit(Vals && ... vals)
 {
+#ifdef ALLOC_PROFILING
+    AllocScope scope = this->alloc_scope();
+#endif
+#ifdef TIMELINE_TRACING
+    TraceSpan span = this->trace_span();
+#endif
+    using payload_t = typename GenericExecutor<C, Args ...>::payload_t;
+    typename GenericExecutor<C, Args ...>::shared_payload_t payload;
+
     GenericSignal<C, Args ...>::emit(vals ...);
-    for (GenericFunctor<C, Args ...> *ftor : _callbacks) {
+    _slots->for_each([&](GenericFunctor<C, Args ...> *ftor) {
+#ifdef SSCALL_OUTPUTS
         std::cout << "                > [CALLED] [" << ftor->name() << "] [" << ftor->get_type() << "]" << std::endl;
-        ftor->call(vals ...);
+#endif
+#ifdef FLIGHT_RECORDER
+        FlightRecorder::record(FlightEvent::SlotCall, this->flight_id(), ftor, false);
+#endif
+#ifdef TIMELINE_TRACING
+        TraceSpan slot(TraceKind::Slot, TraceSpan::current);
+#endif
+        if (payload) {
+            ftor->call_shared(payload);
+        } else if (ftor->target() && !ftor->blocking()) {
+            //Only a const lvalue gets here uncopyable (a plain one does not compile, the virtual emit() takes it
+            //in): the slot cannot have its copy, it is refused rather than called blocking.
+            if constexpr (std::is_constructible<payload_t, Vals && ...>::value) {
+                payload = std::make_shared<payload_t>(std::forward<Vals>(vals) ...);
+                ftor->call_shared(payload);
+            } else {
+                std::cout << "Queued call refused: [" << GenericSignal<C, Args ...>::name() << "] cannot copy its values to ["
+                          << ftor->name() << "], emit them as rvalues or connect it blocking" << std::endl;
+            }
+        } else {
+            ftor->call_in_place(vals ...);
+        }
+    });
+}
+
+//Without workers, or if no worker gets to them before, the slots are run by wait().
+template<class C, class ... Args> template<class ... Vals> inline
+EmitHandle SignalMulti<C, Args ...>::emit_parallel(const std::vector<AbstractThread *> &workers, Vals && ... vals)
+{
+#ifdef ALLOC_PROFILING
+    AllocScope scope = this->alloc_scope();
+#endif
+#ifdef TIMELINE_TRACING
+    TraceSpan span = this->trace_span();
+#endif
+    using payload_t = typename GenericExecutor<C, Args ...>::payload_t;
+    static_assert(std::is_constructible<payload_t, Vals && ...>::value, "emit_parallel() needs a copy of the values for the workers");
+
+    GenericSignal<C, Args ...>::emit(vals ...);
+    typename GenericExecutor<C, Args ...>::shared_payload_t payload = std::make_shared<payload_t>(std::forward<Vals>(vals) ...);
+    std::vector<function_t> direct;
+    _slots->enter();
+    _slots->for_each([&](GenericFunctor<C, Args ...> *ftor) {
+#ifdef SSCALL_OUTPUTS
+        std::cout << "                > [CALLED] [" << ftor->name() << "] [" << ftor->get_type() << "]" << std::endl;
+#endif
+#ifdef FLIGHT_RECORDER
+        FlightRecorder::record(FlightEvent::SlotCall, this->flight_id(), ftor, false);
+#endif
+#ifdef TIMELINE_TRACING
+        TraceSpan slot(TraceKind::Slot, TraceSpan::current);
+#endif
+        if (ftor->target()) {
+            ftor->call_shared(payload);
+        } else {
+            direct.push_back(ftor->get());
+        }
+    });
+    _slots->leave();
+    if (direct.empty()) {
+        return EmitHandle();
+    }
+
+    size_t count = direct.size();
+    std::shared_ptr<ParallelJob> job = std::make_shared<ParallelSlots<C, Args ...>>(std::move(direct), payload);
+    for (size_t i = 0; i < std::min(workers.size(), count); i++) {
+        workers[i]->add_callback(new GenericExecutor<>([job]() {while (job->run_one()) {}}));
     }
+    return EmitHandle(job);
 }
 
-//Do not go too fast, use mutexes!
 template<class C, class ... Args> inline
-void SignalMulti<C, Args ...>::connect(GenericFunctor<C, Args ...> *cb)
+Connection SignalMulti<C, Args ...>::connect(GenericFunctor<C, Args ...> *cb)
 {
-    GenericSignal<C, Args ...>::mtx.lock();
-    _callbacks.push_back(cb);
-    GenericSignal<C, Args ...>::mtx.unlock();
+    typename SlotMap<GenericFunctor<C, Args ...>>::Key k = _slots->insert(cb, true);
+    return Connection(_slots, k.index, k.generation);
 }
 
+//The next ones are full scans, prefer the Connection handles.
 template<class C, class ... Args> inline
 void SignalMulti<C, Args ...>::disconnect(GenericFunctor<C, Args ...> *cb)
 {
-    GenericSignal<C, Args ...>::mtx.lock();
-    _callbacks.remove(cb);
-    GenericSignal<C, Args ...>::mtx.unlock();
+    _slots->release_if([cb](GenericFunctor<C, Args ...> *f) {return f == cb;});
+}
+
+template<class C, class ... Args> inline
+void SignalMulti<C, Args ...>::disconnect(function_t func)
+{
+    using fptr_t = C (*)(Args ...);
+    if (const fptr_t *target = func.template target<fptr_t>()) {
+        _slots->release_if([target](GenericFunctor<C, Args ...> *f) {
+            const fptr_t *t = f->get().template target<fptr_t>();
+            return t && *t == *target;
+        });
+    }
+}
+
+template<class C, class ... Args> inline
+void SignalMulti<C, Args ...>::disconnect(Delegate<C, Args ...> d)
+{
+    _slots->release_if([&d](GenericFunctor<C, Args ...> *f) {return f->delegate() == d;});
 }
 
 template<class C, class ... Args> inline
-void SignalMulti<C, Args ...>::connect(AnonymousFunctor *f)
+Connection SignalMulti<C, Args ...>::connect(AnonymousFunctor *f)
 {
+    GenericFunctor<C, Args ...> *thunk = f->template to_functor<C, Args ...>();
+    if (!thunk) {
+        return Connection();
+    }
+
+    Connection c = connect(thunk);
     GenericSignal<C, Args ...>::mtx.lock();
-    _a_callbacks.push_back(f);
+    _a_callbacks.push_back({f, c});
     GenericSignal<C, Args ...>::mtx.unlock();
+    return c;
 }
 
 template<class C, class ... Args> inline
 void SignalMulti<C, Args ...>::disconnect(AnonymousFunctor *f)
 {
     GenericSignal<C, Args ...>::mtx.lock();
-    _a_callbacks.remove(f);
+    _a_callbacks.remove_if([f](std::pair<AnonymousFunctor *, Connection> &a) {
+        return a.first == f && (a.second.disconnect(), true);
+    });
     GenericSignal<C, Args ...>::mtx.unlock();
 }
 
@@ -837,42 +1616,337 @@ SignalMulti<C>::SignalMulti(std::string sn) : GenericSignal<C> (sn)
 template<class C> inline
 void SignalMulti<C>::emit()
 {
+#ifdef ALLOC_PROFILING
+    AllocScope scope = this->alloc_scope();
+#endif
+#ifdef TIMELINE_TRACING
+    TraceSpan span = this->trace_span();
+#endif
     GenericSignal<C>::emit();
-    for (GenericFunctor<C> *ftor : _callbacks) {
+    _slots->for_each([this](GenericFunctor<C> *ftor) {
+#ifdef SSCALL_OUTPUTS
         std::cout << "                > [CALLED] [" << ftor->name() << "] [" << ftor->get_type() << "]" << std::endl;
+#endif
+#ifdef FLIGHT_RECORDER
+        FlightRecorder::record(FlightEvent::SlotCall, this->flight_id(), ftor, false);
+#endif
+#ifdef TIMELINE_TRACING
+        TraceSpan slot(TraceKind::Slot, TraceSpan::current);
+#endif
         ftor->call();
+    });
+}
+
+template<class C> inline
+EmitHandle SignalMulti<C>::emit_parallel(const std::vector<AbstractThread *> &workers)
+{
+#ifdef ALLOC_PROFILING
+    AllocScope scope = this->alloc_scope();
+#endif
+#ifdef TIMELINE_TRACING
+    TraceSpan span = this->trace_span();
+#endif
+    GenericSignal<C>::emit();
+    std::vector<function_t> direct;
+    _slots->enter();
+    _slots->for_each([&](GenericFunctor<C> *ftor) {
+#ifdef SSCALL_OUTPUTS
+        std::cout << "                > [CALLED] [" << ftor->name() << "] [" << ftor->get_type() << "]" << std::endl;
+#endif
+#ifdef FLIGHT_RECORDER
+        FlightRecorder::record(FlightEvent::SlotCall, this->flight_id(), ftor, false);
+#endif
+#ifdef TIMELINE_TRACING
+        TraceSpan slot(TraceKind::Slot, TraceSpan::current);
+#endif
+        if (ftor->target()) {
+            ftor->call();
+        } else {
+            direct.push_back(ftor->get());
+        }
+    });
+    _slots->leave();
+    if (direct.empty()) {
+        return EmitHandle();
     }
+
+    size_t count = direct.size();
+    std::shared_ptr<ParallelJob> job = std::make_shared<ParallelSlots<C>>(std::move(direct), nullptr);
+    for (size_t i = 0; i < std::min(workers.size(), count); i++) {
+        workers[i]->add_callback(new GenericExecutor<>([job]() {while (job->run_one()) {}}));
+    }
+    return EmitHandle(job);
 }
 
 template<class C> inline
-void SignalMulti<C>::connect(GenericFunctor<C> *cb)
+Connection SignalMulti<C>::connect(GenericFunctor<C> *cb)
 {
-    GenericSignal<C>::mtx.lock();
-    _callbacks.push_back(cb);
-    GenericSignal<C>::mtx.unlock();
+    typename SlotMap<GenericFunctor<C>>::Key k = _slots->insert(cb, true);
+    return Connection(_slots, k.index, k.generation);
 }
 
 template<class C> inline
 void SignalMulti<C>::disconnect(GenericFunctor<C> *cb)
 {
-    GenericSignal<C>::mtx.lock();
-    _callbacks.remove(cb);
-    GenericSignal<C>::mtx.unlock();
+    _slots->release_if([cb](GenericFunctor<C> *f) {return f == cb;});
 }
 
 template<class C> inline
-void SignalMulti<C>::connect(AnonymousFunctor *f)
+void SignalMulti<C>::disconnect(function_t func)
 {
+    using fptr_t = C (*)();
+    if (const fptr_t *target = func.template target<fptr_t>()) {
+        _slots->release_if([target](GenericFunctor<C> *f) {
+            const fptr_t *t = f->get().template target<fptr_t>();
+            return t && *t == *target;
+        });
+    }
+}
+
+template<class C> inline
+void SignalMulti<C>::disconnect(Delegate<C> d)
+{
+    _slots->release_if([&d](GenericFunctor<C> *f) {return f->delegate() == d;});
+}
+
+template<class C> inline
+Connection SignalMulti<C>::connect(AnonymousFunctor *f)
+{
+    GenericFunctor<C> *thunk = f->template to_functor<C>();
+    if (!thunk) {
+        return Connection();
+    }
+
+    Connection c = connect(thunk);
     GenericSignal<C>::mtx.lock();
-    _a_callbacks.push_back(f);
+    _a_callbacks.push_back({f, c});
     GenericSignal<C>::mtx.unlock();
+    return c;
 }
 
 template<class C> inline
 void SignalMulti<C>::disconnect(AnonymousFunctor *f)
 {
     GenericSignal<C>::mtx.lock();
-    _a_callbacks.remove(f);
+    _a_callbacks.remove_if([f](std::pair<AnonymousFunctor *, Connection> &a) {
+        return a.first == f && (a.second.disconnect(), true);
+    });
     GenericSignal<C>::mtx.unlock();
 }
+
+/****** Coalescing *******/
+template<class C, class ... Args> template<class ... Vals> inline
+void CoalescedDelivery<C, Args ...>::emit(slots_t &slots, Vals & ... vals)
+{
+    static_assert(std::is_constructible<std::tuple<std::decay_t<Args> ...>, Vals & ...>::value, "Coalesced slots need a copy of the values");
+    uint64_t stamp = ++_stamp;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    slots.for_each([&](GenericFunctor<C, Args ...> *ftor) {
+#ifdef SSCALL_OUTPUTS
+        std::cout << "                > [CALLED] [" << ftor->name() << "] [" << ftor->get_type() << "]" << std::endl;
+#endif
+#ifdef FLIGHT_RECORDER
+        FlightRecorder::record(FlightEvent::SlotCall, 0, ftor, false);
+#endif
+#ifdef TIMELINE_TRACING
+        TraceSpan slot(TraceKind::Slot, TraceSpan::current);
+#endif
+        AbstractThread *t = ftor->target();
+        if (!t) {
+            ftor->call_in_place(vals ...);
+            return;
+        }
+
+        std::shared_ptr<Mailbox> box = mailbox(t);
+        box->mtx.lock();
+        while (box->dropped) {
+            box->mtx.unlock();
+            box = mailbox(t);
+            box->mtx.lock();
+        }
+        //Several slots on the same thread: one mailbox update per emit.
+        if (box->stamp == stamp) {
+            box->mtx.unlock();
+            return;
+        }
+        box->stamp = stamp;
+        if (box->latest) {
+            std::apply([&](auto & ... v) {((v = vals), ...);}, *box->latest);
+        } else {
+            box->latest.emplace(vals ...);
+        }
+        box->fresh = true;
+        box->last_emit = now;
+        bool post_it = !box->posted;
+        box->posted = true;
+        box->mtx.unlock();
+
+        if (post_it) {
+            post(box, t);
+        }
+    });
+}
+
+template<class C, class ... Args> inline
+std::shared_ptr<typename CoalescedDelivery<C, Args ...>::Mailbox> CoalescedDelivery<C, Args ...>::mailbox(AbstractThread *t)
+{
+    mtx.lock();
+    std::shared_ptr<Mailbox> &box = _boxes[t];
+    if (!box) {
+        box = std::make_shared<Mailbox>();
+    }
+    std::shared_ptr<Mailbox> found = box;
+    mtx.unlock();
+    return found;
+}
+
+template<class C, class ... Args> inline
+void CoalescedDelivery<C, Args ...>::post(std::shared_ptr<Mailbox> box, AbstractThread *t, std::chrono::steady_clock::time_point when)
+{
+    std::shared_ptr<Posting> posting = std::make_shared<Posting>(this->shared_from_this(), std::move(box), t);
+    AbstractExecutor *cb = new GenericExecutor<>([posting]() {
+        posting->ran = true;
+        posting->self->flush(posting->box, posting->thread);
+    });
+    if (when == std::chrono::steady_clock::time_point()) {
+        t->add_callback(cb);
+    } else {
+        t->add_callback_at(cb, when);
+    }
+}
+
+//Under the box's lock. A new emit for the thread then makes a new one.
+template<class C, class ... Args> inline
+void CoalescedDelivery<C, Args ...>::drop_locked(const std::shared_ptr<Mailbox> &box, AbstractThread *t)
+{
+    box->dropped = true;
+    box->posted = false;
+    mtx.lock();
+    auto it = _boxes.find(t);
+    if (it != _boxes.end() && it->second == box) {
+        _boxes.erase(it);
+    }
+    mtx.unlock();
+}
+
+template<class C, class ... Args> inline
+void CoalescedDelivery<C, Args ...>::flush(std::shared_ptr<Mailbox> box, AbstractThread *t)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    box->mtx.lock();
+    //The end of a throttle window with nothing emitted in it.
+    if (!box->fresh) {
+        drop_locked(box, t);
+        box->mtx.unlock();
+        return;
+    }
+    std::chrono::steady_clock::time_point due = _policy == CoalescePolicy::Throttle ? box->last_delivery + _interval
+                                              : _policy == CoalescePolicy::Debounce ? box->last_emit + _interval : now;
+    if (due > now) {
+        box->mtx.unlock();
+        post(box, t, due);
+        return;
+    }
+    //The emits keep writing in the other buffer while this one is delivered.
+    std::swap(box->latest, box->delivered);
+    box->fresh = false;
+    box->last_delivery = now;
+    box->mtx.unlock();
+
+    if (std::shared_ptr<slots_t> slots = _slots.lock()) {
+        slots->for_each([&](GenericFunctor<C, Args ...> *ftor) {
+            if (ftor->target() != t) {
+                return;
+            }
+            if constexpr (sizeof ... (Args) == 0) {
+                ftor->get()();
+            } else {
+                GenericExecutor<C, Args ...>::invoke_shared(ftor->get(), *box->delivered);
+            }
+        });
+    }
+
+    //Emitted during the delivery: still at most one pending, this one. A throttled mailbox is kept to the end of
+    //its window, for its last delivery time.
+    box->mtx.lock();
+    if (!box->fresh && _policy != CoalescePolicy::Throttle) {
+        drop_locked(box, t);
+        box->mtx.unlock();
+        return;
+    }
+    std::chrono::steady_clock::time_point next = _policy == CoalescePolicy::Throttle ? box->last_delivery + _interval
+                                               : _policy == CoalescePolicy::Debounce ? box->last_emit + _interval
+                                               : std::chrono::steady_clock::time_point();
+    box->mtx.unlock();
+    post(box, t, next);
+}
+
+template<class C, class ... Args> inline
+void SignalCoalesced<C, Args ...>::emit(const Args & ... vals)
+{
+#ifdef ALLOC_PROFILING
+    AllocScope scope = this->alloc_scope();
+#endif
+#ifdef TIMELINE_TRACING
+    TraceSpan span = this->trace_span();
+#endif
+    GenericSignal<C, Args ...>::emit(vals ...);
+    _delivery->emit(*this->_slots, vals ...);
+}
+
+template<class C, class ... Args> inline
+void SignalCoalesced<C, Args ...>::emit(std::decay_t<Args> && ... vals)
+{
+#ifdef ALLOC_PROFILING
+    AllocScope scope = this->alloc_scope();
+#endif
+#ifdef TIMELINE_TRACING
+    TraceSpan span = this->trace_span();
+#endif
+    GenericSignal<C, Args ...>::emit(vals ...);
+    _delivery->emit(*this->_slots, vals ...);
+}
+
+template<class C> inline
+void SignalCoalesced<C>::emit()
+{
+#ifdef ALLOC_PROFILING
+    AllocScope scope = this->alloc_scope();
+#endif
+#ifdef TIMELINE_TRACING
+    TraceSpan span = this->trace_span();
+#endif
+    GenericSignal<C>::emit();
+    _delivery->emit(*this->_slots);
+}
+
+/***** Static Signal *****/
+template<auto ... Slots> template<class ... Vals> inline
+void StaticSignal<Slots ...>::emit(Vals && ... vals)
+{
+    (_call<Slots>(vals ...), ...);
+}
+
+template<auto ... Slots> template<auto Slot, class ... Vals> inline
+void StaticSignal<Slots ...>::_call(Vals & ... vals)
+{
+    if constexpr (std::is_invocable<decltype(Slot), Vals & ...>::value) {
+        Slot(vals ...);
+    } else if constexpr (std::is_base_of<AnonymousFunctor, std::remove_pointer_t<decltype(Slot)>>::value) {
+        Slot->call(vals ...);
+    } else {
+        Slot->emit(vals ...);
+    }
+}
+
+template<auto ... Slots> template<class C, class ... Args> inline
+GenericFunctor<C, Args ...> *StaticSignal<Slots ...>::functor(std::string sn)
+{
+    return new GenericFunctor<C, Args ...>(sn, [](Args ... vals) -> C {
+        emit(vals ...);
+        if constexpr (!std::is_void<C>::value) {
+            return C();
+        }
+    });
+}
 }
@@ -0,0 +1,530 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CppUtilities {
+
+//What a Connection needs from a SlotMap, without knowing the stored type.
+class AbstractSlotMap
+{
+public:
+    inline virtual ~AbstractSlotMap() {};
+    virtual bool release(uint32_t index, uint32_t generation) = 0;
+    virtual bool alive(uint32_t index, uint32_t generation) = 0;
+};
+
+/**
+ * Slot storage with O(1) insertion and release by key (index + gen
+ * eration). The entries live in segments of doubling size that nev
+ * er move, so for_each() can run while other threads insert or rel
+ * ease: a value released during an iteration is deleted (if owned)
+ * and its index reused only when the last running iteration ends.
+ * A freed index gets a new generation, so an old key cannot release
+ * whatever is stored there afterwards. Iteration is in index order.
+ **/
+template<class T>
+class SlotMap : public AbstractSlotMap
+{
+public:
+    struct Key {
+        uint32_t index;
+        uint32_t generation;
+    };
+
+    inline SlotMap() {};
+    inline ~SlotMap() override;
+    SlotMap(const SlotMap &) = delete;
+    SlotMap &operator=(const SlotMap &) = delete;
+
+    inline Key insert(T *value, bool owned);
+    inline bool release(uint32_t index, uint32_t generation) override;
+    inline bool alive(uint32_t index, uint32_t generation) override;
+    inline T *get(uint32_t index, uint32_t generation);
+
+    //Releases all the values matching pred(T *), it is a full scan.
+    template<class P> inline void release_if(P &&pred);
+    //Calls f(T *) on every value present when it starts.
+    template<class F> inline void for_each(F &&f);
+
+    //for_each() brackets, to keep the values alive while they are used outside of it.
+    inline void enter() {_iterating++;};
+    inline void leave();
+
+    inline size_t size() {return _count;};
+
+private:
+    struct Entry {
+        std::atomic<T *> value {nullptr};
+        std::atomic<uint32_t> generation {0};
+        uint32_t next_free = npos;
+        bool owned = false;
+        T *retired = nullptr;
+    };
+
+    static constexpr uint32_t npos = UINT32_MAX;
+    static constexpr uint32_t seg_base = 16;
+    static constexpr int max_segments = 27;
+
+    inline static int segment_of(uint32_t index) {return 31 - __builtin_clz(index / seg_base + 1);};
+    inline static uint32_t segment_first(int seg) {return seg_base * ((1u << seg) - 1);};
+    inline Entry *entry(uint32_t index);
+
+    inline bool release_locked(uint32_t index, uint32_t generation);
+    inline void free_locked(uint32_t index);
+
+    std::atomic<Entry *> _segments[max_segments] = {};
+    std::atomic<uint32_t> _used {0};
+    std::atomic<size_t> _count {0};
+    std::atomic<int> _iterating {0};
+    uint32_t _free = npos;
+    std::vector<uint32_t> _retired;
+    std::mutex mtx;
+};
+
+//Handle on a slot of a SlotMap, it can be copied and outlive the map (the signal) without harm.
+class Connection
+{
+public:
+    inline Connection() {};
+    inline Connection(std::weak_ptr<AbstractSlotMap> map, uint32_t index, uint32_t generation)
+        : _map(std::move(map)), _index(index), _generation(generation) {};
+
+    inline bool connected() const {
+        std::shared_ptr<AbstractSlotMap> m = _map.lock();
+        return m && m->alive(_index, _generation);
+    };
+
+    //O(1), and safe during an emit: the slot is not called anymore and deleted after it.
+    inline bool disconnect() {
+        std::shared_ptr<AbstractSlotMap> m = _map.lock();
+        return m && m->release(_index, _generation);
+    };
+
+private:
+    std::weak_ptr<AbstractSlotMap> _map;
+    uint32_t _index = 0;
+    uint32_t _generation = 0;
+};
+
+//Disconnects when it goes out of scope.
+class ScopedConnection : public Connection
+{
+public:
+    inline ScopedConnection() {};
+    inline ScopedConnection(Connection c) : Connection(std::move(c)) {};
+    inline ScopedConnection(ScopedConnection &&) = default;
+    inline ScopedConnection &operator=(ScopedConnection &&o) {
+        if (this != &o) {
+            disconnect();
+            Connection::operator=(std::move(o));
+        }
+        return *this;
+    };
+    ScopedConnection(const ScopedConnection &) = delete;
+    ScopedConnection &operator=(const ScopedConnection &) = delete;
+    inline ~ScopedConnection() {disconnect();};
+
+    //Gives up the scope, the connection stays.
+    inline Connection release() {
+        Connection c = *this;
+        Connection::operator=(Connection());
+        return c;
+    };
+};
+
+/**
+ * Registry of objects by int id, without lock: an id packs a slot i
+ * ndex (20 bits) and its generation (11 bits), so a stale id finds n
+ * othing for a while. Freed slots are recycled through a lock-free l
+ * ist, tagged against ABA, and lookups and walks only read atomics:
+ * they can run while other threads register. The values are not own
+ * ed. Each entry has a small state, free for the user to define.
+ **/
+template<class T>
+class IdTable
+{
+public:
+    inline IdTable() {};
+    inline ~IdTable();
+    IdTable(const IdTable &) = delete;
+    IdTable &operator=(const IdTable &) = delete;
+
+    inline int insert(T *value, int state = 0);
+    inline bool remove(int id);
+    inline T *get(int id);
+    inline bool set_state(int id, int state);
+    //-1 if there is nothing at this id.
+    inline int state(int id);
+
+    //Calls f(id, T *, state) on the values present, what is added or removed meanwhile may be seen or not.
+    template<class F> inline void for_each(F &&f);
+
+    inline size_t size() {return _count;};
+    //Ids given since the start, which never decreases.
+    inline int issued() {return _issued;};
+
+private:
+    struct Entry {
+        std::atomic<T *> value {nullptr};
+        std::atomic<uint32_t> generation {0};
+        std::atomic<int> state {0};
+        std::atomic<uint32_t> next_free {0};
+    };
+
+    static constexpr int index_bits = 20;
+    static constexpr uint32_t index_mask = (1u << index_bits) - 1;
+    static constexpr uint32_t generation_mask = 0x7FF;
+    static constexpr uint32_t seg_base = 16;
+    static constexpr int max_segments = 16;
+
+    inline static int segment_of(uint32_t index) {return 31 - __builtin_clz(index / seg_base + 1);};
+    inline static uint32_t segment_first(int seg) {return seg_base * ((1u << seg) - 1);};
+    inline static int make_id(uint32_t index, uint32_t generation) {return ((generation & generation_mask) << index_bits) | (index + 1);};
+    //nullptr if the id is not a valid one.
+    inline Entry *entry_of(int id, uint32_t &generation);
+    inline Entry *entry(uint32_t index);
+
+    //The free list head is the slot index + 1 (0 for empty) and a tag in the high half.
+    inline bool pop_free(uint32_t &index);
+    inline void push_free(uint32_t index);
+
+    std::atomic<Entry *> _segments[max_segments] = {};
+    std::atomic<uint32_t> _used {0};
+    std::atomic<uint64_t> _free {0};
+    std::atomic<size_t> _count {0};
+    std::atomic<int> _issued {0};
+};
+
+
+
+template<class T> inline
+SlotMap<T>::~SlotMap()
+{
+    for (int s = 0; s < max_segments; s++) {
+        Entry *seg = _segments[s].load();
+        if (!seg) {
+            break;
+        }
+        for (uint32_t i = 0; i < (seg_base << s); i++) {
+            if (seg[i].owned) {
+                delete seg[i].value.load();
+            }
+            delete seg[i].retired;
+        }
+        delete[] seg;
+    }
+}
+
+template<class T> inline
+typename SlotMap<T>::Entry *SlotMap<T>::entry(uint32_t index)
+{
+    int s = segment_of(index);
+    return _segments[s].load(std::memory_order_acquire) + (index - segment_first(s));
+}
+
+template<class T> inline
+typename SlotMap<T>::Key SlotMap<T>::insert(T *value, bool owned)
+{
+    mtx.lock();
+    uint32_t index = _free;
+    if (index != npos) {
+        _free = entry(index)->next_free;
+    } else {
+        index = _used.load();
+        int s = segment_of(index);
+        if (!_segments[s].load()) {
+            _segments[s].store(new Entry[seg_base << s](), std::memory_order_release);
+        }
+    }
+
+    Entry *e = entry(index);
+    e->owned = owned;
+    e->next_free = npos;
+    uint32_t gen = e->generation.load();
+    e->value.store(value, std::memory_order_release);
+    if (index == _used.load()) {
+        _used.store(index + 1, std::memory_order_release);
+    }
+    _count++;
+    mtx.unlock();
+    return {index, gen};
+}
+
+template<class T> inline
+bool SlotMap<T>::release(uint32_t index, uint32_t generation)
+{
+    mtx.lock();
+    bool done = release_locked(index, generation);
+    mtx.unlock();
+    return done;
+}
+
+template<class T> inline
+bool SlotMap<T>::release_locked(uint32_t index, uint32_t generation)
+{
+    if (index >= _used.load()) {
+        return false;
+    }
+    Entry *e = entry(index);
+    if (e->generation.load() != generation || !e->value.load()) {
+        return false;
+    }
+
+    T *v = e->value.exchange(nullptr);
+    e->generation.fetch_add(1);
+    _count--;
+    //An iteration which started before the exchange may be calling it right now.
+    if (_iterating.load() > 0) {
+        e->retired = e->owned ? v : nullptr;
+        _retired.push_back(index);
+    } else {
+        if (e->owned) {
+            delete v;
+        }
+        free_locked(index);
+    }
+    return true;
+}
+
+template<class T> inline
+void SlotMap<T>::free_locked(uint32_t index)
+{
+    entry(index)->next_free = _free;
+    _free = index;
+}
+
+template<class T> inline
+bool SlotMap<T>::alive(uint32_t index, uint32_t generation)
+{
+    return get(index, generation) != nullptr;
+}
+
+template<class T> inline
+T *SlotMap<T>::get(uint32_t index, uint32_t generation)
+{
+    if (index >= _used.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    Entry *e = entry(index);
+    T *v = e->value.load(std::memory_order_acquire);
+    return e->generation.load() == generation ? v : nullptr;
+}
+
+template<class T> template<class P> inline
+void SlotMap<T>::release_if(P &&pred)
+{
+    mtx.lock();
+    uint32_t used = _used.load();
+    for (uint32_t i = 0; i < used; i++) {
+        Entry *e = entry(i);
+        T *v = e->value.load();
+        if (v && pred(v)) {
+            release_locked(i, e->generation.load());
+        }
+    }
+    mtx.unlock();
+}
+
+template<class T> template<class F> inline
+void SlotMap<T>::for_each(F &&f)
+{
+    enter();
+    uint32_t used = _used.load(std::memory_order_acquire);
+    for (int s = 0; s < max_segments && segment_first(s) < used; s++) {
+        Entry *seg = _segments[s].load(std::memory_order_acquire);
+        uint32_t end = std::min(used - segment_first(s), seg_base << s);
+        for (uint32_t i = 0; i < end; i++) {
+            if (T *v = seg[i].value.load(std::memory_order_acquire)) {
+                f(v);
+            }
+        }
+    }
+    leave();
+}
+
+template<class T> inline
+void SlotMap<T>::leave()
+{
+    if (_iterating.fetch_sub(1) != 1) {
+        return;
+    }
+
+    mtx.lock();
+    //Someone may have started another iteration meanwhile, then it will clean up.
+    if (_iterating.load() == 0) {
+        for (uint32_t index : _retired) {
+            Entry *e = entry(index);
+            delete e->retired;
+            e->retired = nullptr;
+            free_locked(index);
+        }
+        _retired.clear();
+    }
+    mtx.unlock();
+}
+
+template<class T> inline
+IdTable<T>::~IdTable()
+{
+    for (int s = 0; s < max_segments; s++) {
+        delete[] _segments[s].load();
+    }
+}
+
+template<class T> inline
+typename IdTable<T>::Entry *IdTable<T>::entry(uint32_t index)
+{
+    int s = segment_of(index);
+    Entry *seg = _segments[s].load(std::memory_order_acquire);
+    return seg ? seg + (index - segment_first(s)) : nullptr;
+}
+
+template<class T> inline
+typename IdTable<T>::Entry *IdTable<T>::entry_of(int id, uint32_t &generation)
+{
+    if (id <= 0) {
+        return nullptr;
+    }
+    uint32_t index = (uint32_t(id) & index_mask) - 1;
+    generation = uint32_t(id) >> index_bits;
+    if (index >= _used.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return entry(index);
+}
+
+template<class T> inline
+bool IdTable<T>::pop_free(uint32_t &index)
+{
+    uint64_t head = _free.load(std::memory_order_acquire);
+    while (uint32_t top = uint32_t(head)) {
+        uint32_t next = entry(top - 1)->next_free.load();
+        uint64_t tag = (head >> 32) + 1;
+        if (_free.compare_exchange_weak(head, (tag << 32) | next)) {
+            index = top - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class T> inline
+void IdTable<T>::push_free(uint32_t index)
+{
+    uint64_t head = _free.load();
+    uint64_t tag;
+    do {
+        entry(index)->next_free.store(uint32_t(head));
+        tag = (head >> 32) + 1;
+    } while (!_free.compare_exchange_weak(head, (tag << 32) | (index + 1), std::memory_order_release));
+}
+
+template<class T> inline
+int IdTable<T>::insert(T *value, int state)
+{
+    uint32_t index;
+    if (!pop_free(index)) {
+        index = _used.load();
+        //Claims the index, the segment may have to be made first.
+        for (;;) {
+            //The segments end a little before the ids would (index_mask - 1).
+            if (index >= segment_first(max_segments)) {
+                return -1;
+            }
+            int s = segment_of(index);
+            if (!_segments[s].load()) {
+                Entry *seg = new Entry[seg_base << s]();
+                Entry *none = nullptr;
+                if (!_segments[s].compare_exchange_strong(none, seg)) {
+                    delete[] seg;
+                }
+            }
+            if (_used.compare_exchange_weak(index, index + 1)) {
+                break;
+            }
+        }
+    }
+
+    Entry *e = entry(index);
+    e->state.store(state);
+    e->value.store(value, std::memory_order_release);
+    _count++;
+    _issued++;
+    return make_id(index, e->generation.load());
+}
+
+template<class T> inline
+bool IdTable<T>::remove(int id)
+{
+    uint32_t gen;
+    Entry *e = entry_of(id, gen);
+    if (!e || (e->generation.load() & generation_mask) != gen || !e->value.load()) {
+        return false;
+    }
+    e->value.store(nullptr);
+    e->generation.fetch_add(1);
+    _count--;
+    push_free((uint32_t(id) & index_mask) - 1);
+    return true;
+}
+
+template<class T> inline
+T *IdTable<T>::get(int id)
+{
+    uint32_t gen;
+    Entry *e = entry_of(id, gen);
+    if (!e) {
+        return nullptr;
+    }
+    T *v = e->value.load(std::memory_order_acquire);
+    return (e->generation.load() & generation_mask) == gen ? v : nullptr;
+}
+
+template<class T> inline
+bool IdTable<T>::set_state(int id, int state)
+{
+    uint32_t gen;
+    Entry *e = entry_of(id, gen);
+    if (!e || (e->generation.load() & generation_mask) != gen) {
+        return false;
+    }
+    e->state.store(state);
+    return true;
+}
+
+template<class T> inline
+int IdTable<T>::state(int id)
+{
+    uint32_t gen;
+    Entry *e = entry_of(id, gen);
+    if (!e || !e->value.load() || (e->generation.load() & generation_mask) != gen) {
+        return -1;
+    }
+    return e->state.load();
+}
+
+template<class T> template<class F> inline
+void IdTable<T>::for_each(F &&f)
+{
+    uint32_t used = _used.load(std::memory_order_acquire);
+    for (int s = 0; s < max_segments && segment_first(s) < used; s++) {
+        Entry *seg = _segments[s].load(std::memory_order_acquire);
+        if (!seg) {
+            continue;
+        }
+        uint32_t end = std::min(used - segment_first(s), seg_base << s);
+        for (uint32_t i = 0; i < end; i++) {
+            if (T *v = seg[i].value.load(std::memory_order_acquire)) {
+                f(make_id(segment_first(s) + i, seg[i].generation.load()), v, seg[i].state.load());
+            }
+        }
+    }
+}
+}
@@ -0,0 +1,743 @@
+#include "symbolizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include <cxxabi.h>
+#include <elf.h>
+#include <link.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <pthread.h>
+
+namespace CppUtilities {
+
+struct Symbolizer::Symbol {
+    uintptr_t addr;
+    uintptr_t size;
+    const char *name; //In the mapped file.
+};
+
+struct Symbolizer::LineRow {
+    uintptr_t addr;
+    uint32_t file;
+    uint32_t line;
+    bool end; //First address after a sequence.
+};
+
+//Addresses in the index are relative to base, as in the file.
+struct Symbolizer::Module {
+    ~Module() {
+        if (map) {
+            munmap(const_cast<char *>(map), map_size);
+        }
+    }
+
+    std::string path;
+    uintptr_t base = 0;
+    std::vector<std::pair<uintptr_t, uintptr_t>> ranges; //Loaded segments, absolute.
+    const char *map = nullptr;
+    size_t map_size = 0;
+    std::vector<Symbol> symbols;
+    bool lines_read = false;
+    std::vector<LineRow> lines;
+    std::vector<std::string> files;
+};
+
+Symbolizer::Symbolizer()
+{
+}
+
+Symbolizer::~Symbolizer()
+{
+}
+
+Symbolizer *Symbolizer::get()
+{
+    //Never deleted: a crash or an atexit handler may still symbolize.
+    static Symbolizer *inst = new Symbolizer;
+    return inst;
+}
+
+std::string Symbolizer::executable()
+{
+    char path[1024 + 1] = {0};
+    ssize_t n = readlink("/proc/self/exe", path, 1024);
+    return n > 0 ? std::string(path, size_t(n)) : "";
+}
+
+bool Symbolizer::resolve(const void *addr, SymbolInfo &info, bool lines)
+{
+    uintptr_t a = reinterpret_cast<uintptr_t>(addr);
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!_loaded) {
+        load_locked();
+    }
+    Module *m = find_locked(a);
+    if (!m) {
+        //Loaded since?
+        load_locked();
+        m = find_locked(a);
+    }
+    return m && resolve_locked(m, a - m->base, info, lines);
+}
+
+bool Symbolizer::resolve_file(const std::string &path, uintptr_t file_offset, SymbolInfo &info, bool lines)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    std::unique_ptr<Module> &m = _files[path];
+    if (!m) {
+        m.reset(new Module);
+        m->path = path;
+        read_symbols(*m);
+    }
+    if (!m->map) {
+        return false;
+    }
+    //The offset to the address the file's segments are linked at, as the index is.
+    const Elf64_Ehdr *eh = reinterpret_cast<const Elf64_Ehdr *>(m->map);
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64
+            || eh->e_phoff + eh->e_phnum * sizeof(Elf64_Phdr) > m->map_size) {
+        return false;
+    }
+    const Elf64_Phdr *ph = reinterpret_cast<const Elf64_Phdr *>(m->map + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD && file_offset >= ph[i].p_offset && file_offset < ph[i].p_offset + ph[i].p_filesz) {
+            return resolve_locked(m.get(), file_offset - ph[i].p_offset + ph[i].p_vaddr, info, lines);
+        }
+    }
+    return false;
+}
+
+bool Symbolizer::resolve_locked(Module *m, uintptr_t rel, SymbolInfo &info, bool lines)
+{
+    info.module = m->path;
+    info.module_offset = rel;
+
+    auto sym = std::upper_bound(m->symbols.begin(), m->symbols.end(), rel, [](uintptr_t v, const Symbol &s) {return v < s.addr;});
+    if (sym != m->symbols.begin() && ((--sym)->size == 0 || rel < sym->addr + sym->size)) {
+        int status = -1;
+        char *demangled = sym->name[0] == '_' ? abi::__cxa_demangle(sym->name, nullptr, nullptr, &status) : nullptr;
+        info.function = status == 0 ? demangled : sym->name;
+        info.offset = rel - sym->addr;
+        free(demangled);
+    }
+
+    if (lines) {
+        if (!m->lines_read) {
+            read_lines(*m);
+            m->lines_read = true;
+        }
+        auto row = std::upper_bound(m->lines.begin(), m->lines.end(), rel, [](uintptr_t v, const LineRow &r) {return v < r.addr;});
+        if (row != m->lines.begin() && !(--row)->end) {
+            info.file = m->files[row->file];
+            info.line = int(row->line);
+        }
+    }
+    return true;
+}
+
+const SymbolInfo &Symbolizer::lookup(const void *addr)
+{
+    uintptr_t key = reinterpret_cast<uintptr_t>(addr);
+    Shard &s = shard(key);
+    s.mtx.lock();
+    auto it = s.symbols.find(key);
+    if (it != s.symbols.end()) {
+        //Nodes never move nor go away.
+        const SymbolInfo &info = it->second;
+        s.mtx.unlock();
+        return info;
+    }
+    s.mtx.unlock();
+
+    //Not under the shard's lock: the first line lookup of a module decodes its table.
+    SymbolInfo info;
+    resolve(addr, info);
+    s.mtx.lock();
+    const SymbolInfo &cached = s.symbols.emplace(key, std::move(info)).first->second;
+    s.mtx.unlock();
+    return cached;
+}
+
+const std::string &Symbolizer::demangle(const char *mangled)
+{
+    Shard &s = shard(reinterpret_cast<uintptr_t>(mangled));
+    std::lock_guard<std::mutex> lock(s.mtx);
+    auto it = s.names.find(mangled);
+    if (it == s.names.end()) {
+        int status = -1;
+        char *demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+        it = s.names.emplace(mangled, status == 0 ? demangled : mangled).first;
+        free(demangled);
+    }
+    return it->second;
+}
+
+std::string Symbolizer::format(void *const *pcs, int count, int first_index)
+{
+    std::string out;
+    char buf[64];
+    for (int i = 0; i < count; i++) {
+        //Return addresses: the call is the byte before.
+        const SymbolInfo &info = lookup(static_cast<char *>(pcs[i]) - 1);
+        snprintf(buf, sizeof(buf), "%-3d %*p ", first_index + i, int(2 + sizeof(void *) * 2), pcs[i]);
+        out += buf;
+        if (!info.function.empty()) {
+            out += info.function + " + " + std::to_string(info.offset + 1);
+        } else if (!info.module.empty()) {
+            snprintf(buf, sizeof(buf), " + 0x%zx", size_t(info.module_offset + 1));
+            out += info.module + buf;
+        } else {
+            out += "??";
+        }
+        if (!info.file.empty()) {
+            out += " at " + info.file + ":" + std::to_string(info.line);
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+std::string Symbolizer::collapse(void *const *pcs, int count, bool first_is_pc)
+{
+    std::string out;
+    char buf[32];
+    for (int i = count - 1; i >= 0; i--) {
+        const SymbolInfo &info = lookup(static_cast<char *>(pcs[i]) - (i == 0 && first_is_pc ? 0 : 1));
+        if (!out.empty()) {
+            out += ";";
+        }
+        if (!info.function.empty()) {
+            out += info.function;
+        } else if (!info.module.empty()) {
+            snprintf(buf, sizeof(buf), "+0x%zx", size_t(info.module_offset));
+            out += info.module.substr(info.module.rfind('/') + 1) + buf;
+        } else {
+            out += "??";
+        }
+    }
+    return out;
+}
+
+//Never inlined: its own frame is the one it drops first.
+__attribute__((noinline)) int StackTrace::capture(void **pcs, int max, int skip)
+{
+    int count = 0;
+#ifdef STACK_FRAME_POINTERS
+    //The frames are chained from the current one, each one above its callee in the thread's stack.
+    static thread_local uintptr_t stack_low = 0, stack_high = 0;
+    if (!stack_high) {
+        pthread_attr_t attr;
+        void *addr;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+                stack_low = reinterpret_cast<uintptr_t>(addr);
+                stack_high = stack_low + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
+    //The first return address is the caller's: nothing of this frame to drop.
+    void **fp = static_cast<void **>(__builtin_frame_address(0));
+    while (count < max) {
+        uintptr_t f = reinterpret_cast<uintptr_t>(fp);
+        if (f < stack_low || f + 2 * sizeof(void *) > stack_high || f % sizeof(void *) || !fp[1]) {
+            break;
+        }
+        if (skip > 0) {
+            skip--;
+        } else {
+            pcs[count++] = fp[1];
+        }
+        void **next = static_cast<void **>(fp[0]);
+        if (next <= fp) {
+            break;
+        }
+        fp = next;
+    }
+#else
+    void *all[UNWIND_FRAMES];
+    int n = backtrace(all, std::min(max + skip + 1, UNWIND_FRAMES));
+    for (int i = skip + 1; i < n; i++) {
+        pcs[count++] = all[i];
+    }
+#endif
+    return count;
+}
+
+__attribute__((noinline)) StackTrace StackTrace::capture(int skip)
+{
+    StackTrace st;
+    st.size = capture(st.frames, MAX_FRAMES, skip + 1);
+    return st;
+}
+
+__attribute__((noinline)) int StackTrace::capture_context(const void *context, void **pcs, int max, uintptr_t stack_low, uintptr_t stack_high)
+{
+    const ucontext_t *uc = static_cast<const ucontext_t *>(context);
+    int count = 0;
+#if defined(STACK_FRAME_POINTERS) && (defined(__x86_64__) || defined(__aarch64__))
+#if defined(__x86_64__)
+    uintptr_t pc = uintptr_t(uc->uc_mcontext.gregs[REG_RIP]);
+    void **fp = reinterpret_cast<void **>(uc->uc_mcontext.gregs[REG_RBP]);
+#else
+    uintptr_t pc = uintptr_t(uc->uc_mcontext.pc);
+    void **fp = reinterpret_cast<void **>(uc->uc_mcontext.regs[29]);
+#endif
+    //The frame chain from the interrupted code, within the thread's stack.
+    if (max > 0) {
+        pcs[count++] = reinterpret_cast<void *>(pc);
+    }
+    while (count < max) {
+        uintptr_t f = reinterpret_cast<uintptr_t>(fp);
+        if (f < stack_low || f + 2 * sizeof(void *) > stack_high || f % sizeof(void *) || !fp[1]) {
+            break;
+        }
+        pcs[count++] = fp[1];
+        void **next = static_cast<void **>(fp[0]);
+        if (next <= fp) {
+            break;
+        }
+        fp = next;
+    }
+#else
+    //The unwinder goes through the signal frame: what comes before the interrupted pc is this function, the
+    //handler and the kernel's trampoline.
+    (void)stack_low;
+    (void)stack_high;
+    void *all[128 + 8];
+    int n = backtrace(all, std::min(max, 128) + 8);
+#if defined(__x86_64__)
+    void *pc = reinterpret_cast<void *>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+    void *pc = reinterpret_cast<void *>(uc->uc_mcontext.pc);
+#else
+    void *pc = nullptr;
+    (void)uc;
+#endif
+    int first = n > 3 ? 3 : n;
+    for (int i = 0; i < n; i++) {
+        if (all[i] == pc) {
+            first = i;
+            break;
+        }
+    }
+    for (int i = first; i < n && count < max; i++) {
+        pcs[count++] = all[i];
+    }
+#endif
+    return count;
+}
+
+void Symbolizer::reload()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    load_locked();
+}
+
+Symbolizer::Module *Symbolizer::find_locked(uintptr_t addr)
+{
+    for (std::unique_ptr<Module> &m : _modules) {
+        for (std::pair<uintptr_t, uintptr_t> &r : m->ranges) {
+            if (addr >= r.first && addr < r.second) {
+                return m.get();
+            }
+        }
+    }
+    return nullptr;
+}
+
+//Keeps the modules still loaded at the same place, maps the new ones.
+void Symbolizer::load_locked()
+{
+    std::vector<std::unique_ptr<Module>> found;
+    std::string exe = executable();
+    struct Walk {
+        std::vector<std::unique_ptr<Module>> *found;
+        const std::string *exe;
+    } walk = {&found, &exe};
+
+    dl_iterate_phdr([](dl_phdr_info *dl, size_t, void *data) {
+        Walk *w = static_cast<Walk *>(data);
+        Module *m = new Module;
+        //The executable comes first, with no name.
+        m->path = dl->dlpi_name && dl->dlpi_name[0] ? dl->dlpi_name : (w->found->empty() ? *w->exe : "");
+        m->base = dl->dlpi_addr;
+        for (int i = 0; i < dl->dlpi_phnum; i++) {
+            if (dl->dlpi_phdr[i].p_type == PT_LOAD) {
+                uintptr_t start = dl->dlpi_addr + dl->dlpi_phdr[i].p_vaddr;
+                m->ranges.push_back({start, start + dl->dlpi_phdr[i].p_memsz});
+            }
+        }
+        w->found->emplace_back(m);
+        return 0;
+    }, &walk);
+
+    for (std::unique_ptr<Module> &m : found) {
+        auto same = std::find_if(_modules.begin(), _modules.end(), [&m](const std::unique_ptr<Module> &o) {
+            return o && o->path == m->path && o->base == m->base;
+        });
+        if (same != _modules.end()) {
+            m = std::move(*same);
+        } else {
+            read_symbols(*m);
+        }
+    }
+    _modules.swap(found);
+    _loaded = true;
+}
+
+static const Elf64_Shdr *find_section(const char *map, const Elf64_Ehdr *eh, const char *name)
+{
+    const Elf64_Shdr *sh = reinterpret_cast<const Elf64_Shdr *>(map + eh->e_shoff);
+    const char *names = map + sh[eh->e_shstrndx].sh_offset;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        //Compressed sections would need zlib: no line table rather.
+        if (strcmp(names + sh[i].sh_name, name) == 0 && sh[i].sh_type != SHT_NOBITS && !(sh[i].sh_flags & SHF_COMPRESSED)) {
+            return &sh[i];
+        }
+    }
+    return nullptr;
+}
+
+void Symbolizer::read_symbols(Module &m)
+{
+    if (m.path.empty()) {
+        return; //vdso
+    }
+    int fd = open(m.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    m.map = static_cast<const char *>(map);
+    m.map_size = size_t(st.st_size);
+
+    const Elf64_Ehdr *eh = reinterpret_cast<const Elf64_Ehdr *>(m.map);
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 || eh->e_shoff == 0
+            || eh->e_shoff + eh->e_shnum * sizeof(Elf64_Shdr) > m.map_size) {
+        return;
+    }
+    const Elf64_Shdr *sh = reinterpret_cast<const Elf64_Shdr *>(m.map + eh->e_shoff);
+    //The full table if not stripped, else the exported functions.
+    const Elf64_Shdr *table = nullptr;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type == SHT_SYMTAB || (sh[i].sh_type == SHT_DYNSYM && !table)) {
+            table = &sh[i];
+        }
+    }
+    if (!table || table->sh_link >= eh->e_shnum) {
+        return;
+    }
+    const Elf64_Sym *syms = reinterpret_cast<const Elf64_Sym *>(m.map + table->sh_offset);
+    const char *strtab = m.map + sh[table->sh_link].sh_offset;
+    size_t count = table->sh_size / sizeof(Elf64_Sym);
+    for (size_t i = 0; i < count; i++) {
+        unsigned type = ELF64_ST_TYPE(syms[i].st_info);
+        if ((type == STT_FUNC || type == STT_GNU_IFUNC) && syms[i].st_shndx != SHN_UNDEF && syms[i].st_value) {
+            m.symbols.push_back({syms[i].st_value, syms[i].st_size, strtab + syms[i].st_name});
+        }
+    }
+    //Aliases: the sized one first, so it is the one kept.
+    std::sort(m.symbols.begin(), m.symbols.end(), [](const Symbol &a, const Symbol &b) {
+        return a.addr != b.addr ? a.addr < b.addr : a.size > b.size;
+    });
+    m.symbols.erase(std::unique(m.symbols.begin(), m.symbols.end(), [](const Symbol &a, const Symbol &b) {return a.addr == b.addr;}), m.symbols.end());
+}
+
+namespace {
+//Bounds checked reads in a DWARF section.
+struct DwarfReader
+{
+    const uint8_t *p;
+    const uint8_t *end;
+
+    inline bool ok() const {return p <= end;};
+    template<class T> inline T fixed() {
+        T v = 0;
+        if (p + sizeof(T) <= end) {
+            memcpy(&v, p, sizeof(T));
+        }
+        p += sizeof(T);
+        return v;
+    }
+    inline uint64_t sized(size_t n) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < n && p + i < end; i++) {
+            v |= uint64_t(p[i]) << (8 * i);
+        }
+        p += n;
+        return v;
+    }
+    inline uint64_t uleb() {
+        uint64_t v = 0;
+        for (unsigned shift = 0; p < end; shift += 7) {
+            uint8_t b = *p++;
+            v |= uint64_t(b & 0x7f) << (shift & 63);
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        return v;
+    }
+    inline int64_t sleb() {
+        int64_t v = 0;
+        unsigned shift = 0;
+        uint8_t b = 0;
+        while (p < end) {
+            b = *p++;
+            v |= int64_t(b & 0x7f) << (shift & 63);
+            shift += 7;
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        if (shift < 64 && (b & 0x40)) {
+            v |= -(int64_t(1) << shift);
+        }
+        return v;
+    }
+    inline const char *str() {
+        const char *s = reinterpret_cast<const char *>(p);
+        while (p < end && *p) {
+            p++;
+        }
+        p++;
+        return s;
+    }
+};
+
+struct DwarfStrings {
+    const char *line_str = nullptr;
+    size_t line_str_size = 0;
+    const char *str = nullptr;
+    size_t str_size = 0;
+};
+
+//One attribute of a DWARF 5 directory or file entry: a string, or an index (else 0).
+const char *read_entry_form(DwarfReader &r, uint64_t form, bool dwarf64, const DwarfStrings &strs, uint64_t &value)
+{
+    value = 0;
+    switch (form) {
+        case 0x08: return r.str();                                              //DW_FORM_string
+        case 0x1f: {                                                            //DW_FORM_line_strp
+            uint64_t off = dwarf64 ? r.fixed<uint64_t>() : r.fixed<uint32_t>();
+            return strs.line_str && off < strs.line_str_size ? strs.line_str + off : "";
+        }
+        case 0x0e: {                                                            //DW_FORM_strp
+            uint64_t off = dwarf64 ? r.fixed<uint64_t>() : r.fixed<uint32_t>();
+            return strs.str && off < strs.str_size ? strs.str + off : "";
+        }
+        case 0x0b: value = r.fixed<uint8_t>(); return nullptr;                  //DW_FORM_data1
+        case 0x05: value = r.fixed<uint16_t>(); return nullptr;                 //DW_FORM_data2
+        case 0x06: value = r.fixed<uint32_t>(); return nullptr;                 //DW_FORM_data4
+        case 0x07: value = r.fixed<uint64_t>(); return nullptr;                 //DW_FORM_data8
+        case 0x0f: value = r.uleb(); return nullptr;                            //DW_FORM_udata
+        case 0x1e: r.p += 16; return nullptr;                                   //DW_FORM_data16
+        case 0x09: r.p += r.uleb(); return nullptr;                             //DW_FORM_block
+        default: r.p = r.end + 1; return nullptr;                               //Unknown size: gives up the unit.
+    }
+}
+
+std::string join_path(const std::string &dir, const char *name)
+{
+    if (!name || !*name) {
+        return "??";
+    }
+    if (name[0] == '/' || dir.empty()) {
+        return name;
+    }
+    return dir + "/" + name;
+}
+}
+
+//Runs the line number programs of .debug_line (DWARF 2 to 5) into rows sorted by address.
+void Symbolizer::read_lines(Module &m)
+{
+    if (!m.map) {
+        return;
+    }
+    const Elf64_Ehdr *eh = reinterpret_cast<const Elf64_Ehdr *>(m.map);
+    const Elf64_Shdr *debug_line = find_section(m.map, eh, ".debug_line");
+    if (!debug_line || debug_line->sh_offset + debug_line->sh_size > m.map_size) {
+        return;
+    }
+    DwarfStrings strs;
+    if (const Elf64_Shdr *s = find_section(m.map, eh, ".debug_line_str")) {
+        strs.line_str = m.map + s->sh_offset;
+        strs.line_str_size = s->sh_size;
+    }
+    if (const Elf64_Shdr *s = find_section(m.map, eh, ".debug_str")) {
+        strs.str = m.map + s->sh_offset;
+        strs.str_size = s->sh_size;
+    }
+
+    const uint8_t *section = reinterpret_cast<const uint8_t *>(m.map + debug_line->sh_offset);
+    DwarfReader unit = {section, section + debug_line->sh_size};
+    while (unit.p < unit.end) {
+        uint64_t length = unit.fixed<uint32_t>();
+        bool dwarf64 = length == 0xffffffff;
+        if (dwarf64) {
+            length = unit.fixed<uint64_t>();
+        }
+        if (length == 0 || length > uint64_t(unit.end - unit.p)) {
+            break;
+        }
+        DwarfReader r = {unit.p, unit.p + length};
+        unit.p += length;
+
+        uint16_t version = r.fixed<uint16_t>();
+        if (version < 2 || version > 5) {
+            continue;
+        }
+        uint8_t address_size = 8;
+        if (version >= 5) {
+            address_size = r.fixed<uint8_t>();
+            r.fixed<uint8_t>(); //Segment selector size.
+        }
+        uint64_t header_length = dwarf64 ? r.fixed<uint64_t>() : r.fixed<uint32_t>();
+        const uint8_t *program = r.p + header_length;
+        uint8_t min_inst_length = r.fixed<uint8_t>();
+        if (version >= 4) {
+            r.fixed<uint8_t>(); //Maximum operations per instruction, VLIW only.
+        }
+        r.fixed<uint8_t>(); //Default is_stmt, every row is kept.
+        int8_t line_base = r.fixed<int8_t>();
+        uint8_t line_range = r.fixed<uint8_t>();
+        uint8_t opcode_base = r.fixed<uint8_t>();
+        if (line_range == 0 || opcode_base == 0) {
+            continue;
+        }
+        std::vector<uint8_t> opcode_lengths(opcode_base);
+        for (int i = 1; i < opcode_base; i++) {
+            opcode_lengths[i] = r.fixed<uint8_t>();
+        }
+
+        //Files of the unit, made module wide: DWARF 5 counts them from 0, the older versions from 1.
+        std::vector<std::string> dirs;
+        uint32_t first_file = uint32_t(m.files.size());
+        if (version >= 5) {
+            std::vector<std::pair<uint64_t, uint64_t>> format;
+            for (int list = 0; list < 2 && r.ok(); list++) {
+                format.clear();
+                uint8_t format_count = r.fixed<uint8_t>();
+                for (int i = 0; i < format_count; i++) {
+                    uint64_t type = r.uleb();
+                    format.push_back({type, r.uleb()});
+                }
+                uint64_t count = r.uleb();
+                for (uint64_t e = 0; e < count && r.ok(); e++) {
+                    const char *path = nullptr;
+                    uint64_t dir = 0;
+                    for (std::pair<uint64_t, uint64_t> &f : format) {
+                        uint64_t value;
+                        const char *s = read_entry_form(r, f.second, dwarf64, strs, value);
+                        if (f.first == 1) {         //DW_LNCT_path
+                            path = s;
+                        } else if (f.first == 2) {  //DW_LNCT_directory_index
+                            dir = value;
+                        }
+                    }
+                    if (list == 0) {
+                        dirs.push_back(path ? path : "");
+                    } else {
+                        m.files.push_back(join_path(dir < dirs.size() ? dirs[dir] : "", path));
+                    }
+                }
+            }
+        } else {
+            dirs.push_back("");
+            while (r.p < r.end && *r.p) {
+                dirs.push_back(r.str());
+            }
+            r.p++;
+            m.files.push_back("??"); //Index 0 is not used.
+            while (r.p < r.end && *r.p) {
+                const char *name = r.str();
+                uint64_t dir = r.uleb();
+                r.uleb();
+                r.uleb();
+                m.files.push_back(join_path(dir < dirs.size() ? dirs[dir] : "", name));
+            }
+        }
+        if (!r.ok() || program > r.end) {
+            continue;
+        }
+        uint32_t file_count = uint32_t(m.files.size()) - first_file;
+
+        r.p = program;
+        uintptr_t address = 0;
+        uint32_t file = 1, line = 1;
+        //Sequences at 0 are functions the linker dropped.
+        bool valid = false;
+        auto emit = [&](bool end) {
+            if (valid && file < file_count) {
+                m.lines.push_back({address, first_file + file, line, end});
+            }
+        };
+        while (r.p < r.end) {
+            uint8_t op = r.fixed<uint8_t>();
+            if (op >= opcode_base) {
+                uint8_t adj = op - opcode_base;
+                address += (adj / line_range) * min_inst_length;
+                line += line_base + adj % line_range;
+                emit(false);
+                continue;
+            }
+            switch (op) {
+                case 0: {
+                    uint64_t len = r.uleb();
+                    const uint8_t *next = r.p + len;
+                    uint8_t ext = len ? r.fixed<uint8_t>() : 0;
+                    if (ext == 1) {         //DW_LNE_end_sequence
+                        emit(true);
+                        address = 0;
+                        file = 1;
+                        line = 1;
+                        valid = false;
+                    } else if (ext == 2) {  //DW_LNE_set_address
+                        address = r.sized(len - 1 < 8 ? len - 1 : address_size);
+                        valid = address != 0;
+                    }
+                    r.p = next;
+                    break;
+                }
+                case 1: emit(false); break;                                                 //DW_LNS_copy
+                case 2: address += r.uleb() * min_inst_length; break;                      //DW_LNS_advance_pc
+                case 3: line += int32_t(r.sleb()); break;                                   //DW_LNS_advance_line
+                case 4: file = uint32_t(r.uleb()); break;                                   //DW_LNS_set_file
+                case 5: r.uleb(); break;                                                    //DW_LNS_set_column
+                case 6: break;                                                              //DW_LNS_negate_stmt
+                case 7: break;                                                              //DW_LNS_set_basic_block
+                case 8: address += ((255 - opcode_base) / line_range) * min_inst_length; break; //DW_LNS_const_add_pc
+                case 9: address += r.fixed<uint16_t>(); break;                             //DW_LNS_fixed_advance_pc
+                default:
+                    for (int i = 0; i < opcode_lengths[op]; i++) {
+                        r.uleb();
+                    }
+            }
+        }
+    }
+
+    //A sequence ending where another one starts: the end first, so a lookup lands on the start.
+    std::sort(m.lines.begin(), m.lines.end(), [](const LineRow &a, const LineRow &b) {
+        return a.addr != b.addr ? a.addr < b.addr : a.end > b.end;
+    });
+}
+}
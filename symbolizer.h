@@ -0,0 +1,121 @@
+#pragma once
+
+#include "cpputilities_global.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+namespace CppUtilities {
+
+struct SymbolInfo
+{
+    std::string module;
+    uintptr_t module_offset = 0;
+    //Demangled, empty when no symbol covers the address.
+    std::string function;
+    uintptr_t offset = 0; //From the start of the function.
+    //From the DWARF line table, empty when there is none.
+    std::string file;
+    int line = 0;
+};
+
+/**
+ * Symbolizes addresses in the process, without running addr2line: t
+ * he executable and each loaded shared object are mapped once (from
+ * dl_iterate_phdr), their .symtab (or .dynsym) functions sorted by a
+ * ddress, and their .debug_line, when there is one, decoded into so
+ * rted rows the first time a line is asked for. An address is then
+ * a binary search. Not for signal handlers: it locks and allocates.
+ **/
+class Symbolizer
+{
+public:
+    static Symbolizer *get();
+
+    //Give a return address minus one to get the line of the call.
+    bool resolve(const void *addr, SymbolInfo &info, bool lines = true);
+    //For an address of another process, e.g. from a crash report: file_offset is where it is in the file at path, as
+    //the maps give it (address - start + offset). The file is mapped once, and kept.
+    bool resolve_file(const std::string &path, uintptr_t file_offset, SymbolInfo &info, bool lines = true);
+    //Looks at the loaded objects again, e.g. after a dlopen (also done when an address is in none of them).
+    void reload();
+    //Path of the running executable.
+    std::string executable();
+
+    //Cached: the first lookup of an address resolves it, the next ones are a hash lookup. The entry lives
+    //as long as the process.
+    const SymbolInfo &lookup(const void *addr);
+    //Cached as well, by the name's address: for the static names of typeid().
+    const std::string &demangle(const char *mangled);
+    //One line per program counter (return addresses): "index pc function + offset at file:line".
+    std::string format(void *const *pcs, int count, int first_index = 0);
+    //Function names from the outermost frame to the innermost, ';' separated, for the collapsed stacks of the
+    //profilers. first_is_pc when pcs[0] is an interrupted instruction rather than a return address.
+    std::string collapse(void *const *pcs, int count, bool first_is_pc = false);
+
+private:
+    Symbolizer();
+    ~Symbolizer();
+
+    struct Symbol;
+    struct LineRow;
+    struct Module;
+
+    void load_locked();
+    Module *find_locked(uintptr_t addr);
+    bool resolve_locked(Module *m, uintptr_t rel, SymbolInfo &info, bool lines);
+    static void read_symbols(Module &m);
+    static void read_lines(Module &m);
+
+    //By address, so threads symbolizing different frames rarely wait on each other.
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_map<uintptr_t, SymbolInfo> symbols;
+        std::unordered_map<const char *, std::string> names;
+    };
+    static const size_t SHARDS = 16;
+    inline Shard &shard(uintptr_t key) {return _shards[(key * 0x9E3779B97F4A7C15ull) >> 60];};
+
+    std::vector<std::unique_ptr<Module>> _modules;
+    std::unordered_map<std::string, std::unique_ptr<Module>> _files;
+    bool _loaded = false;
+    std::mutex mtx;
+    Shard _shards[SHARDS];
+};
+
+//Program counters of a stack, to resolve later or never: a capture costs no symbolization, nor any allocation.
+struct StackTrace
+{
+    static const int MAX_FRAMES = 32;
+    //The unwinder sees that many frames at most, capture()'s own and the skipped ones included.
+    static const int UNWIND_FRAMES = 128;
+
+    //The caller's stack, skip frames less. Walks the frame pointers with STACK_FRAME_POINTERS, else unwinds.
+    static StackTrace capture(int skip = 0);
+    //Same, into pcs: returns the count.
+    static int capture(void **pcs, int max, int skip = 0);
+    //The most frames capture(pcs, max, skip) can give: a stack that deep may have been cut.
+    static inline int capture_limit(int max, int skip = 0) {
+#ifdef STACK_FRAME_POINTERS
+        (void)skip;
+        return max;
+#else
+        return max < UNWIND_FRAMES - skip - 1 ? max : UNWIND_FRAMES - skip - 1;
+#endif
+    };
+    //From a signal handler, the stack of the code it interrupted (context is the handler's ucontext_t): its pc, then
+    //the return addresses. The frame pointers are followed within the stack bounds. Async-signal-safe with
+    //STACK_FRAME_POINTERS only: else it calls backtrace(), which is not, and can deadlock in the unwinder.
+    static int capture_context(const void *context, void **pcs, int max, uintptr_t stack_low, uintptr_t stack_high);
+
+    inline std::string to_string(int first_index = 0) const {return Symbolizer::get()->format(frames, size, first_index);};
+
+    void *frames[MAX_FRAMES];
+    int size = 0;
+};
+
+}
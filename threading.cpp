@@ -1,75 +1,286 @@
 #include "threading.h"
+#include "channel.h"
+#include "debuging.h"
+#include "profiler.h"
+#include "alloc_profiler.h"
+#include "flight_recorder.h"
+#include "tracer.h"
 
 #include <iostream>
 #include <chrono>
+#include <vector>
+#include <climits>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 namespace CppUtilities {
 
+static std::mutex latch_pool_mtx;
+static std::vector<Latch *> &latch_pool = *new std::vector<Latch *>;
+
+//The callbacks of add_callback_at(), all threads together, soonest first. Never destroyed: the timer thread is
+//detached and may still wait at exit.
+static std::mutex &delayed_mtx = *new std::mutex;
+static std::condition_variable &delayed_cv = *new std::condition_variable;
+static std::multimap<std::chrono::steady_clock::time_point, std::pair<AbstractThread *, AbstractExecutor *>> &delayed =
+    *new std::multimap<std::chrono::steady_clock::time_point, std::pair<AbstractThread *, AbstractExecutor *>>;
+static bool delayed_started = false;
+
+//First and last things a thread of the library does. The end touches nothing of the object, which may be gone.
+static void thread_begins(AbstractThread *t)
+{
+    setup_thread_sig_stack(t->name().c_str(), t->get_id());
+    Profiler::get()->attach_current(t->name(), t->get_id());
+#ifdef ALLOC_PROFILING
+    AllocProfiler::get()->set_thread(t->name(), t->get_id());
+#endif
+#ifdef FLIGHT_RECORDER
+    FlightRecorder::set_thread(t->name(), t->get_id());
+#endif
+#ifdef TIMELINE_TRACING
+    Tracer::set_thread(t->name(), t->get_id());
+#endif
+}
+
+static void thread_ends()
+{
+    Profiler::get()->detach_current();
+}
+
+//Adds each callback under the lock: its thread cannot be destroyed meanwhile, the destructor takes it to cancel them.
+//Each class's destructor does so first, before its own state goes: add_callback() is virtual.
+static void delayed_loop()
+{
+    std::unique_lock<std::mutex> lock(delayed_mtx);
+    for (;;) {
+        if (delayed.empty()) {
+            delayed_cv.wait(lock);
+        } else if (delayed.begin()->first > std::chrono::steady_clock::now()) {
+            //A copy: the entry can be cancelled meanwhile.
+            std::chrono::steady_clock::time_point next = delayed.begin()->first;
+            delayed_cv.wait_until(lock, next);
+        } else {
+            std::pair<AbstractThread *, AbstractExecutor *> due = delayed.begin()->second;
+            delayed.erase(delayed.begin());
+            due.first->add_callback(due.second);
+        }
+    }
+}
+
+static void cancel_delayed(AbstractThread *t)
+{
+    std::vector<AbstractExecutor *> cancelled;
+    delayed_mtx.lock();
+    for (auto it = delayed.begin(); it != delayed.end();) {
+        if (it->second.first == t) {
+            cancelled.push_back(it->second.second);
+            it = delayed.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    delayed_mtx.unlock();
+    for (AbstractExecutor *cb : cancelled) {
+        delete cb;
+    }
+}
+
+void Latch::wait()
+{
+    int s = Closed;
+    if (!_state.compare_exchange_strong(s, Waiting) && s == Opened) {
+        return;
+    }
+    while (_state.load() != Opened) {
+        syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAIT_PRIVATE, Waiting, nullptr, nullptr, 0);
+    }
+}
+
+void Latch::open()
+{
+    if (_state.exchange(Opened) == Waiting) {
+        syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+}
+
+//Latches are never freed: the opener may still be in its wake syscall when the waiter gives it back.
+Latch *Latch::acquire()
+{
+    Latch *l = nullptr;
+    latch_pool_mtx.lock();
+    if (!latch_pool.empty()) {
+        l = latch_pool.back();
+        latch_pool.pop_back();
+    }
+    latch_pool_mtx.unlock();
+    if (!l) {
+        l = new Latch;
+    }
+    l->_state.store(Closed);
+    return l;
+}
+
+void Latch::release(Latch *l)
+{
+    latch_pool_mtx.lock();
+    latch_pool.push_back(l);
+    latch_pool_mtx.unlock();
+}
+
+//Generation << 2 | state. Only the generation of a free record is kept.
+struct CallbackToken::Record {
+    enum : uint64_t {Pending, Running, Cancelled};
+    std::atomic<uint64_t> word = {0};
+};
+
+static std::mutex token_pool_mtx;
+static std::vector<CallbackToken::Record *> &token_pool = *new std::vector<CallbackToken::Record *>;
+
+bool CallbackToken::cancel()
+{
+    if (!_record) {
+        return false;
+    }
+    uint64_t expected = _gen << 2 | Record::Pending;
+    return _record->word.compare_exchange_strong(expected, _gen << 2 | Record::Cancelled);
+}
+
+bool CallbackToken::pending() const
+{
+    return _record && _record->word.load() == (_gen << 2 | Record::Pending);
+}
+
+//Records are never freed: a token may outlive its callback.
+CallbackToken::Record *CallbackToken::acquire(uint64_t &gen)
+{
+    Record *r = nullptr;
+    token_pool_mtx.lock();
+    if (!token_pool.empty()) {
+        r = token_pool.back();
+        token_pool.pop_back();
+    }
+    token_pool_mtx.unlock();
+    if (!r) {
+        r = new Record;
+    }
+    gen = r->word.load() >> 2;
+    return r;
+}
+
+bool CallbackToken::claim(Record *r)
+{
+    uint64_t w = r->word.load();
+    return (w & 3) == Record::Pending && r->word.compare_exchange_strong(w, (w & ~uint64_t(3)) | Record::Running);
+}
+
+void CallbackToken::retire(Record *r)
+{
+    r->word.store(((r->word.load() >> 2) + 1) << 2 | Record::Pending);
+    token_pool_mtx.lock();
+    token_pool.push_back(r);
+    token_pool_mtx.unlock();
+}
+
 #ifdef THREAD_TRACKING
 
 std::list<int> ThreadTracker::get_running()
 {
-    return running_ones;
+    std::list<int> ids;
+    _threads.for_each([&ids](int id, AbstractThread *, int state) {
+        if (state == Running) {
+            ids.push_back(id);
+        }
+    });
+    return ids;
+}
+
+size_t ThreadTracker::count(bool running)
+{
+    size_t count = 0;
+    _threads.for_each([&count, running](int, AbstractThread *, int state) {
+        count += (state == Running) == running;
+    });
+    return count;
 }
 
 std::list<int> ThreadTracker::get_stopped()
 {
-    return stopped_ones;
+    std::list<int> ids;
+    _threads.for_each([&ids](int id, AbstractThread *, int state) {
+        if (state == Stopped) {
+            ids.push_back(id);
+        }
+    });
+    return ids;
 }
 
 int ThreadTracker::next_id()
 {
-    return AbstractThreadTracking::last_id + 1;
+    return _threads.issued() + 1;
 }
 
 AbstractThread *ThreadTracker::get_thread(int id)
 {
-    return mapped[id];
+    return _threads.get(id);
 }
 
-void ThreadTracker::add_thread(int id, AbstractThread *t)
+int ThreadTracker::add_thread(AbstractThread *t)
 {
-    mtx.lock();
-    mapped.insert({id, t});
-    mtx.unlock();
+    return _threads.insert(t, Stopped);
 }
 
 void ThreadTracker::ran(int id)
 {
-    mtx.lock();
-    stopped_ones.remove(id);
-    running_ones.push_back(id);
-    mtx.unlock();
+    _threads.set_state(id, Running);
 }
 
 void ThreadTracker::stopped(int id)
 {
-    mtx.lock();
-    running_ones.remove(id);
-    stopped_ones.push_back(id);
-    mtx.unlock();
+    _threads.set_state(id, Stopped);
 }
 
 void ThreadTracker::remove_thread(int id)
 {
-    mtx.lock();
-    mapped.erase(id);
-    stopped_ones.remove(id);
-    running_ones.remove(id);
-    mtx.unlock();
+    _threads.remove(id);
+}
+
+std::list<ThreadTracker::ScalingEvent> ThreadTracker::get_scaling_events()
+{
+    events_mtx.lock();
+    std::list<ScalingEvent> events = _events;
+    events_mtx.unlock();
+    return events;
+}
+
+void ThreadTracker::scaled(int id, size_t from, size_t to, std::string reason)
+{
+#ifdef TRACKING_OUTPUTS
+    AbstractThread *t = get_thread(id);
+    std::cout << "THREAD_TRACKING > [" << id << "] [" << (t ? t->name() : "") << "] [SCALED] [" << from << " -> " << to << "] [" << reason << "]" << std::endl;
+#endif
+    events_mtx.lock();
+    _events.push_back({id, from, to, reason, std::chrono::steady_clock::now()});
+    //The recent ones only.
+    if (_events.size() > 256) {
+        _events.pop_front();
+    }
+    events_mtx.unlock();
 }
 
 AbstractThread::AbstractThread(std::string sn) : AbstractThreadTracking()
 {
     _name = sn;
-    last_id++;
-    allocated_id = last_id;
-    ThreadTracker::get()->add_thread(allocated_id, this);
+    set_lock_site(mtx, "AbstractThread::mtx", sn);
+    allocated_id = ThreadTracker::get()->add_thread(this);
 }
 #else
 AbstractThread::AbstractThread(std::string sn)
 {
     _name = sn;
+    set_lock_site(mtx, "AbstractThread::mtx", sn);
 }
 #endif
 
@@ -78,6 +289,7 @@ AbstractThread::~AbstractThread()
     if (loop) {
         stop();
     }
+    cancel_delayed(this);
     for (AbstractExecutor *cb : cb_schd_list) {
         delete cb;
     }
@@ -107,6 +319,11 @@ bool AbstractThread::is_running()
     return loop_enable;
 }
 
+bool AbstractThread::in_thread()
+{
+    return loop && std::this_thread::get_id() == loop->get_id();
+}
+
 void AbstractThread::pause_s(int secs)
 {
     waits_list.push_back(new GenericExecutor<>(std::bind(
@@ -129,22 +346,51 @@ void AbstractThread::pause_ms(int msecs)
 
 void AbstractThread::process()
 {
-    for (AbstractExecutor *cb : cb_schd_list) {
-        cb->execute();
-        delete cb;
+    //Take the pending ones at once: what they post runs on the next pass, and nothing added meanwhile is lost.
+    std::list<AbstractExecutor *> pending;
+    mtx.lock();
+    pending.swap(cb_schd_list);
+    mtx.unlock();
+
+    for (AbstractExecutor *cb : pending) {
+        run_callback(cb);
         for (AbstractExecutor *wait : waits_list) {
             wait->execute();
             delete wait;
         }
         waits_list.clear();
     }
-    cb_schd_list.clear();
+}
+
+void AbstractThread::run_callback(AbstractExecutor *cb)
+{
+    if (cb->cancel_record && !CallbackToken::claim(cb->cancel_record)) {
+        _cancelled++;
+    } else {
+#ifdef FLIGHT_RECORDER
+        FlightRecorder::record(FlightEvent::ExecuteBegin, uint32_t(get_id()), cb);
+#endif
+#ifdef TIMELINE_TRACING
+        TraceSpan span(TraceKind::Callback, cb->trace_label);
+        Tracer::flow_in(cb->trace_flow);
+#endif
+        cb->execute();
+#ifdef FLIGHT_RECORDER
+        FlightRecorder::record(FlightEvent::ExecuteEnd, uint32_t(get_id()), cb);
+#endif
+        _executed++;
+    }
+    delete cb;
+    _queued--;
 }
 
 void AbstractThread::stop()
 {
     mtx.lock();
     loop_enable = false; // should be modified inside mutex lock
+    mtx.unlock();
+    notify();
+    //Not joined under the lock: the loop takes it to process its callbacks.
     if (loop) {
         if (std::this_thread::get_id() == loop->get_id()) {
             //Means it came from inside!
@@ -160,8 +406,6 @@ void AbstractThread::stop()
 #ifdef THREAD_TRACKING
     ThreadTracker::get()->stopped(allocated_id);
 #endif
-
-    mtx.unlock();
 }
 
 void AbstractThread::wait_for_ends()
@@ -184,20 +428,386 @@ void AbstractThread::start()
 
     if (loop == nullptr) {
         loop_enable = true;
-        loop = new std::thread([this](){this->looping();});
+        loop = new std::thread([this](){thread_begins(this); this->looping(); thread_ends();});
     } else if (stopped_its) {
         loop->~thread();
         delete loop;
         loop_enable = true;
-        loop = new std::thread([this](){this->looping();});
+        loop = new std::thread([this](){thread_begins(this); this->looping(); thread_ends();});
     }
 }
 
 void AbstractThread::add_callback(AbstractExecutor *cb)
 {
+#ifdef FLIGHT_RECORDER
+    FlightRecorder::record(FlightEvent::AddCallback, uint32_t(get_id()), cb);
+#endif
+#ifdef TIMELINE_TRACING
+    if (Tracer::running()) {
+        cb->trace_label = TraceSpan::current;
+        cb->trace_flow = Tracer::flow_out();
+    }
+#endif
+    _queued++;
     mtx.lock();
     cb_schd_list.push_back(cb);
     mtx.unlock();
+    notify();
+}
+
+//The work was published before: either the loop, once registered as a sleeper, sees it, or this sees the sleeper.
+void AbstractThread::notify()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleepers.load(std::memory_order_relaxed) > 0) {
+        _doorbell.fetch_add(1);
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_doorbell), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+
+void AbstractThread::wait_notified(uint32_t seen)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_doorbell), FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+}
+
+CallbackToken AbstractThread::add_cancellable_callback(AbstractExecutor *cb)
+{
+    uint64_t gen;
+    cb->cancel_record = CallbackToken::acquire(gen);
+    CallbackToken token(cb->cancel_record, gen);
+    add_callback(cb);
+    return token;
+}
+
+void AbstractThread::add_callback_at(AbstractExecutor *cb, std::chrono::steady_clock::time_point when)
+{
+    delayed_mtx.lock();
+    if (!delayed_started) {
+        delayed_started = true;
+        std::thread(delayed_loop).detach();
+    }
+    delayed.emplace(when, std::make_pair(this, cb));
+    delayed_cv.notify_one();
+    delayed_mtx.unlock();
+}
+
+ThreadGroup::ThreadGroup(std::string sn, GroupPolicy policy) : AbstractThread(sn), _policy(policy)
+{
+}
+
+//A delayed callback dispatched later would pick a member from the vectors going away.
+ThreadGroup::~ThreadGroup()
+{
+    cancel_delayed(this);
+}
+
+void ThreadGroup::add_member(AbstractThread *t, unsigned weight)
+{
+    mtx.lock();
+    _members.push_back({t, weight ? weight : 1});
+
+    //Smooth weighted round-robin, played once for a whole cycle: a heavy member is not given its turns in a row.
+    unsigned total = 0;
+    for (Member &m : _members) {
+        total += m.weight;
+    }
+    std::vector<int> current(_members.size(), 0);
+    _schedule.clear();
+    for (unsigned turn = 0; turn < total; turn++) {
+        size_t best = 0;
+        for (size_t i = 0; i < _members.size(); i++) {
+            current[i] += _members[i].weight;
+            if (current[i] > current[best]) {
+                best = i;
+            }
+        }
+        current[best] -= total;
+        _schedule.push_back(_members[best].thread);
+    }
+    mtx.unlock();
+}
+
+AbstractThread *ThreadGroup::pick()
+{
+    size_t turn = _turn.fetch_add(1, std::memory_order_relaxed);
+    if (_policy == GroupPolicy::RoundRobin) {
+        return _schedule[turn % _schedule.size()];
+    }
+
+    //Starting at the turn, so that equal members share the calls.
+    AbstractThread *best = nullptr;
+    double best_load = 0;
+    for (size_t n = 0; n < _members.size(); n++) {
+        Member &m = _members[(turn + n) % _members.size()];
+        double load = double(m.thread->queue_depth()) / m.weight;
+        if (!best || load < best_load) {
+            best = m.thread;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+void ThreadGroup::add_callback(AbstractExecutor *cb)
+{
+    if (_members.empty()) {
+        std::cout << "ThreadGroup [" << name() << "] has no member, callback dropped" << std::endl;
+        delete cb;
+        return;
+    }
+    pick()->add_callback(cb);
+}
+
+void ThreadGroup::add_callback(AbstractExecutor *cb, size_t key)
+{
+    if (_members.empty()) {
+        std::cout << "ThreadGroup [" << name() << "] has no member, callback dropped" << std::endl;
+        delete cb;
+        return;
+    }
+    //Mixed, as keys are often small consecutive numbers.
+    key *= 0x9E3779B97F4A7C15ull;
+    _schedule[(key >> 32) % _schedule.size()]->add_callback(cb);
+}
+
+size_t ThreadGroup::queue_depth()
+{
+    size_t depth = 0;
+    for (Member &m : _members) {
+        depth += m.thread->queue_depth();
+    }
+    return depth;
+}
+
+size_t ThreadGroup::executed_count()
+{
+    size_t count = 0;
+    for (Member &m : _members) {
+        count += m.thread->executed_count();
+    }
+    return count;
+}
+
+size_t ThreadGroup::cancelled_count()
+{
+    size_t count = 0;
+    for (Member &m : _members) {
+        count += m.thread->cancelled_count();
+    }
+    return count;
+}
+
+bool ThreadGroup::is_running()
+{
+    for (Member &m : _members) {
+        if (m.thread->is_running()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadGroup::in_thread()
+{
+    for (Member &m : _members) {
+        if (m.thread->in_thread()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadGroup::start()
+{
+    for (Member &m : _members) {
+        m.thread->start();
+    }
+}
+
+void ThreadGroup::stop()
+{
+    for (Member &m : _members) {
+        m.thread->stop();
+    }
+}
+
+ElasticGroup::ElasticGroup(std::string sn, ElasticPolicy policy) : AbstractThread(sn), _policy(policy)
+{
+}
+
+ElasticGroup::~ElasticGroup()
+{
+    //Before the queue goes: the timer thread would add to it.
+    cancel_delayed(this);
+    stop();
+    for (Queued &q : _queue) {
+        delete q.cb;
+    }
+    _queue.clear();
+}
+
+void ElasticGroup::add_callback(AbstractExecutor *cb)
+{
+#ifdef FLIGHT_RECORDER
+    FlightRecorder::record(FlightEvent::AddCallback, uint32_t(get_id()), cb);
+#endif
+#ifdef TIMELINE_TRACING
+    if (Tracer::running()) {
+        cb->trace_label = TraceSpan::current;
+        cb->trace_flow = Tracer::flow_out();
+    }
+#endif
+    _queued++;
+    mtx.lock();
+    _queue.push_back({cb, std::chrono::steady_clock::now()});
+    mtx.unlock();
+    _ready.notify_one();
+}
+
+size_t ElasticGroup::workers()
+{
+    mtx.lock();
+    size_t count = _workers.size();
+    mtx.unlock();
+    return count;
+}
+
+bool ElasticGroup::in_thread()
+{
+    std::thread::id self = std::this_thread::get_id();
+    mtx.lock();
+    bool in = std::any_of(_workers.begin(), _workers.end(), [self](const std::unique_ptr<Worker> &w) {return w->thread.get_id() == self;});
+    mtx.unlock();
+    return in;
+}
+
+void ElasticGroup::start()
+{
+    mtx.lock();
+    size_t from = _workers.size();
+    if (from < _policy.min_workers) {
+        spawn_locked(_policy.min_workers);
+    }
+    size_t to = _workers.size();
+    mtx.unlock();
+    if (to != from) {
+        report(from, to, "started");
+    }
+    //The supervisor.
+    AbstractThread::start();
+}
+
+void ElasticGroup::stop()
+{
+    mtx.lock();
+    loop_enable = false;
+    mtx.unlock();
+    _tick.notify_all();
+    AbstractThread::stop();
+
+    mtx.lock();
+    std::vector<std::unique_ptr<Worker>> retired;
+    retired.swap(_workers);
+    for (std::unique_ptr<Worker> &w : retired) {
+        w->retire = true;
+    }
+    mtx.unlock();
+    _ready.notify_all();
+    for (std::unique_ptr<Worker> &w : retired) {
+        //A worker's callback stopping the group cannot wait for itself.
+        if (w->thread.get_id() == std::this_thread::get_id()) {
+            w->thread.detach();
+            w.release();
+        } else {
+            w->thread.join();
+        }
+    }
+    if (!retired.empty()) {
+        report(retired.size(), 0, "stopped");
+    }
+}
+
+void ElasticGroup::spawn_locked(size_t to)
+{
+    while (_workers.size() < to) {
+        Worker *w = new Worker;
+        _workers.emplace_back(w);
+        w->thread = std::thread([this, w]() {thread_begins(this); this->work(w); thread_ends();});
+    }
+}
+
+void ElasticGroup::report(size_t from, size_t to, std::string reason)
+{
+#ifdef THREAD_TRACKING
+    ThreadTracker::get()->scaled(get_id(), from, to, reason);
+#else
+    (void)from;
+    (void)to;
+    (void)reason;
+#endif
+}
+
+void ElasticGroup::work(Worker *w)
+{
+    std::unique_lock<TrackedMutex> lock(mtx);
+    while (!w->retire) {
+        if (_queue.empty()) {
+            if (!w->idle) {
+                w->idle = true;
+                w->idle_since = std::chrono::steady_clock::now();
+            }
+            _ready.wait(lock);
+            continue;
+        }
+        AbstractExecutor *cb = _queue.front().cb;
+        _queue.pop_front();
+        w->idle = false;
+        lock.unlock();
+        run_callback(cb);
+        lock.lock();
+    }
+}
+
+void ElasticGroup::looping()
+{
+    std::unique_lock<TrackedMutex> lock(mtx);
+    while (loop_enable) {
+        _tick.wait_for(lock, _policy.check_interval);
+        if (!loop_enable) {
+            break;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        size_t count = _workers.size();
+        size_t depth = _queue.size();
+        std::chrono::steady_clock::duration waited = depth ? now - _queue.front().at : std::chrono::steady_clock::duration::zero();
+
+        if (count < _policy.max_workers && (depth > _policy.max_depth * count || waited > _policy.max_latency)) {
+            //Enough workers for the depth, one more at least for the latency.
+            size_t to = std::min(_policy.max_workers, std::max(count + 1, (depth + _policy.max_depth - 1) / std::max<size_t>(_policy.max_depth, 1)));
+            spawn_locked(to);
+            std::string reason = depth > _policy.max_depth * count
+                    ? "depth " + std::to_string(depth)
+                    : "latency " + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(waited).count()) + "us";
+            lock.unlock();
+            report(count, to, reason);
+            lock.lock();
+        } else if (count > _policy.min_workers && now - _last_retire >= _policy.idle_cooldown) {
+            for (auto it = _workers.begin(); it != _workers.end(); ++it) {
+                if ((*it)->idle && now - (*it)->idle_since >= _policy.idle_cooldown) {
+                    std::unique_ptr<Worker> w = std::move(*it);
+                    _workers.erase(it);
+                    w->retire = true;
+                    _last_retire = now;
+                    lock.unlock();
+                    _ready.notify_all();
+                    w->thread.join();
+                    report(count, count - 1, "idle");
+                    lock.lock();
+                    break;
+                }
+            }
+        }
+    }
 }
 
 ThreadLooping::ThreadLooping(std::string sn) : AbstractThread(sn)
@@ -206,27 +816,95 @@ ThreadLooping::ThreadLooping(std::string sn) : AbstractThread(sn)
 
 ThreadLooping::~ThreadLooping()
 {
+    cancel_delayed(this);
+    //The loop goes over the routines and the sources: it ends before they go.
+    if (loop) {
+        stop();
+    }
+    rout_list.splice(rout_list.end(), rout_added);
     for (AbstractExecutor *r : rout_list) {
         delete r;
     }
     rout_list.clear();
-    AbstractThread::~AbstractThread();
+    for (std::pair<AbstractChannel *, size_t> &src : src_list) {
+        src.first->_consumer.store(nullptr);
+    }
+    src_list.clear();
 }
 
 void ThreadLooping::add_routine(AbstractExecutor *exec)
 {
     mtx.lock();
-    rout_list.push_back(exec);
+    rout_added.push_back(exec);
+    _routine_added.store(true);
+    mtx.unlock();
+    //The loop may be asleep, having had nothing to poll.
+    notify();
+}
+
+void ThreadLooping::add_source(AbstractChannel *channel, size_t batch)
+{
+    mtx.lock();
+    src_list.push_back({channel, batch ? batch : 1});
     mtx.unlock();
+    channel->_consumer.store(this, std::memory_order_release);
+    //What was pushed before has rung no one.
+    notify();
+}
+
+size_t ThreadLooping::drain_sources()
+{
+    size_t count = 0;
+    for (std::pair<AbstractChannel *, size_t> &src : src_list) {
+        count += src.first->dispatch(src.second);
+    }
+    return count;
+}
+
+//A wake-up costs the notifier a syscall: polls a little before sleeping.
+void ThreadLooping::idle()
+{
+    for (int i = 0; i < 256; i++) {
+        if (queue_depth() || drain_sources()) {
+            return;
+        }
+    }
+    uint32_t bell = _doorbell.load();
+    _sleepers.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    //A routine added before this registered as a sleeper rang no one.
+    if (loop_enable && !_routine_added.load() && !queue_depth() && !drain_sources()) {
+        wait_notified(bell);
+    }
+    _sleepers.fetch_sub(1);
 }
 
 void ThreadLooping::looping()
 {
     while (loop_enable) {
-        for (AbstractExecutor *r : rout_list) {
-            r->execute();
-            //Process all between a routine all the time, ensures good responding with cbs and waits.
+        if (_routine_added.load()) {
+            mtx.lock();
+            rout_list.splice(rout_list.end(), rout_added);
+            _routine_added.store(false);
+            mtx.unlock();
+        }
+        if (!rout_list.empty()) {
+#ifdef TIMELINE_TRACING
+            TraceSpan pass(TraceKind::Routines, 0);
+#endif
+            for (AbstractExecutor *r : rout_list) {
+                r->execute();
+                //Process all between a routine all the time, ensures good responding with cbs and waits.
+                AbstractThread::looping();
+                drain_sources();
+            }
+        }
+        //Nothing to poll: sleeps until a callback, a value on a source or stop() rings.
+        if (rout_list.empty()) {
             AbstractThread::looping();
+            if (!drain_sources() && loop_enable) {
+                idle();
+            }
         }
     }
 }
@@ -249,6 +927,7 @@ SingleLooping::SingleLooping(AbstractExecutor *executor, bool del) : SingleLoopi
 
 SingleLooping::~SingleLooping()
 {
+    cancel_delayed(this);
     AbstractThread::~AbstractThread();
 }
 
@@ -5,9 +5,15 @@
 #include <mutex>
 #include <atomic>
 #include <map>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <condition_variable>
 
 #include "cpputilities_global.h"
-#include "signals_slots.h"
+#include "slot_map.h"
+#include "lock_profiler.h"
 
 namespace CppUtilities {
 
@@ -18,6 +24,54 @@ template<class C, class ... Args> class GenericExecutor;
 class ThreadLooping;
 class SingleLooping;
 class AbstractThread;
+class AbstractChannel;
+class ElasticGroup;
+
+//One-shot wake-up of a waiting thread, on a futex: wait() makes no syscall if it is already open, else
+//one to sleep and one to wake. Taken from a pool and given back, so a blocking call allocates nothing.
+class Latch
+{
+public:
+    void wait();
+    void open();
+
+    static Latch *acquire();
+    static void release(Latch *l);
+
+private:
+    enum : int {Closed, Waiting, Opened};
+    std::atomic<int> _state = {Closed};
+};
+
+//Revokes a callback while it is still queued: cancel() is a single compare-and-swap, and the thread then
+//deletes the callback without running it. Records are pooled and never freed, a generation tells reuses apart.
+class CallbackToken
+{
+public:
+    CallbackToken() {};
+
+    //False when the callback already ran, is running, or was cancelled.
+    bool cancel();
+    bool pending() const;
+    inline bool valid() const {return _record != nullptr;};
+
+    struct Record;
+
+private:
+    inline CallbackToken(Record *r, uint64_t gen) : _record(r), _gen(gen) {};
+
+    static Record *acquire(uint64_t &gen);
+    //Pending to running, false when cancelled.
+    static bool claim(Record *r);
+    //The callback is deleted: its tokens are stale from now on.
+    static void retire(Record *r);
+
+    Record *_record = nullptr;
+    uint64_t _gen = 0;
+
+    friend class AbstractThread;
+    friend class AbstractExecutor;
+};
 
 #ifdef THREAD_TRACKING
 
@@ -31,30 +85,49 @@ public:
         return inst;
     }
 
+    //Walk the table, no lock taken: a thread starting or stopping meanwhile may be in either.
     std::list<int> get_running();
     std::list<int> get_stopped();
+    //No allocation and no lock, a signal handler can call it.
+    size_t count(bool running);
+    //Calls f(id, thread, running) on each thread, no allocation and no lock either.
+    template<class F> inline void for_each(F &&f) {
+        _threads.for_each([&f](int id, AbstractThread *t, int state) {f(id, t, state == Running);});
+    }
     int next_id();
     AbstractThread *get_thread(int id);
 
+    struct ScalingEvent {
+        int thread;
+        size_t from;
+        size_t to;
+        std::string reason;
+        std::chrono::steady_clock::time_point when;
+    };
+    //The last scaling events of the elastic groups, oldest first.
+    std::list<ScalingEvent> get_scaling_events();
+
 private:
-    std::list<int> running_ones;
-    std::list<int> stopped_ones;
-    std::map<int, AbstractThread *> mapped;
+    inline ThreadTracker() {set_lock_site(events_mtx, "ThreadTracker::events_mtx", "");};
 
-    void add_thread(int id, AbstractThread *t);
+    enum : int {Stopped, Running};
+    IdTable<AbstractThread> _threads;
+    std::list<ScalingEvent> _events;
+    TrackedMutex events_mtx;
+
+    int add_thread(AbstractThread *t);
     void ran(int);
     void stopped(int);
     void remove_thread(int id);
-
-    std::mutex mtx;
+    void scaled(int id, size_t from, size_t to, std::string reason);
 
     friend class AbstractThread;
+    friend class ElasticGroup;
 };
 
 class AbstractThreadTracking
 {
 public:
-    inline static int last_id = 0;
     int allocated_id = -2;
     friend class ThreadTracker;
 };
@@ -71,7 +144,19 @@ public:
 
     //Be aware that when a callback is done, it is deleted! And the execution depends on the implementation!
     virtual void add_callback(AbstractExecutor *to_execute);
+    //The key means something for a ThreadGroup only: same key, same member thread.
+    inline virtual void add_callback(AbstractExecutor *to_execute, size_t) {add_callback(to_execute);};
     template<class C = void> inline void add_callback(GenericFunctor<C> *to_execute);
+    //Same, the token can revoke it until it runs.
+    CallbackToken add_cancellable_callback(AbstractExecutor *to_execute);
+    //Added to the thread when the time comes, by a timer thread of the library; deleted unrun if the thread goes first.
+    void add_callback_at(AbstractExecutor *to_execute, std::chrono::steady_clock::time_point when);
+    template<class C = void> inline CallbackToken add_cancellable_callback(GenericFunctor<C> *to_execute);
+    //Callbacks added and not done yet.
+    inline virtual size_t queue_depth() {return _queued.load(std::memory_order_relaxed);};
+    //Callbacks run, and cancelled ones dropped, since the thread was created.
+    inline virtual size_t executed_count() {return _executed.load(std::memory_order_relaxed);};
+    inline virtual size_t cancelled_count() {return _cancelled.load(std::memory_order_relaxed);};
 
     virtual void start();
     virtual void stop();
@@ -79,6 +164,10 @@ public:
     virtual void pause_s(int secs);
     virtual void pause_ms(int msecs);
     virtual void process();
+    //True when called from the thread's own loop.
+    virtual bool in_thread();
+    //Rings the doorbell: wakes the loop if it sleeps for want of work (a callback added does it).
+    void notify();
 
     int get_id();
 
@@ -97,11 +186,20 @@ public:
 
 protected:
     virtual void looping();
+    //Runs it unless cancelled, deletes it and counts it.
+    void run_callback(AbstractExecutor *cb);
+    //Sleeps unless the doorbell rang since seen was read. Register in _sleepers and check for work again first.
+    void wait_notified(uint32_t seen);
     std::thread *loop = nullptr;
     std::atomic<bool> loop_enable = {false};
     std::list<AbstractExecutor *> cb_schd_list;
     std::list<AbstractExecutor *> waits_list;
-    mutable std::mutex mtx;
+    mutable TrackedMutex mtx;
+    std::atomic<size_t> _queued = {0};
+    std::atomic<size_t> _executed = {0};
+    std::atomic<size_t> _cancelled = {0};
+    std::atomic<uint32_t> _doorbell = {0}; //Futex word, bumped by notify() when there are sleepers.
+    std::atomic<uint32_t> _sleepers = {0};
     bool is_waiting = false;
     bool stopped_its = false; //In case the thread itself wanted to stop (a func running in thread called stop()), so enable delete() and new() recycle later by using this.
 
@@ -122,12 +220,135 @@ public:
 
     void add_routine(AbstractExecutor *routine);
     template<class C> inline void add_routine(GenericFunctor<C> *to_execute);
+    //The thread drains the channel by batches of at most batch values, and sleeps when there is no routine and
+    //no data. It is its only consumer; the channel is not owned and must stay alive as long as the thread.
+    void add_source(AbstractChannel *channel, size_t batch = 64);
+    template<class Ch, class F> inline void add_source(Ch *channel, F &&handler, size_t batch = 64);
 
 protected:
     void looping() override;
 
 private:
+    size_t drain_sources();
+    void idle();
+
     std::list<AbstractExecutor *> rout_list;
+    //Added meanwhile: the loop takes them into rout_list itself, between two passes.
+    std::list<AbstractExecutor *> rout_added;
+    std::atomic<bool> _routine_added = {false};
+    std::list<std::pair<AbstractChannel *, size_t>> src_list;
+};
+
+enum class GroupPolicy {
+    RoundRobin,     //In turn, by weight.
+    ShortestQueue   //To the member with the fewest callbacks pending for its weight.
+};
+
+/**
+ * Several threads seen as one: a ftor targeting the group has each c
+ * all run by one member, picked by the policy, or by the key for the
+ * calls having one (see GenericFunctor::set_affinity()). A member of
+ * weight 2 takes twice the calls of a member of weight 1. The membe
+ * rs are not owned, start() and stop() are forwarded to them. Add th
+ * e members before the group is used.
+ **/
+class ThreadGroup : public AbstractThread
+{
+public:
+    explicit ThreadGroup(std::string sn = "Undefined", GroupPolicy policy = GroupPolicy::RoundRobin);
+    ~ThreadGroup() override;
+
+    void add_member(AbstractThread *t, unsigned weight = 1);
+
+    using AbstractThread::add_callback;
+    void add_callback(AbstractExecutor *to_execute) override;
+    void add_callback(AbstractExecutor *to_execute, size_t key) override;
+    size_t queue_depth() override;
+    size_t executed_count() override;
+    size_t cancelled_count() override;
+
+    bool is_running() override;
+    bool in_thread() override;
+    void start() override;
+    void stop() override;
+    void process() override {};
+
+private:
+    AbstractThread *pick();
+
+    struct Member {
+        AbstractThread *thread;
+        unsigned weight;
+    };
+
+    const GroupPolicy _policy;
+    std::vector<Member> _members;
+    //Members in weighted round-robin order, each one as many times as its weight, interleaved.
+    std::vector<AbstractThread *> _schedule;
+    std::atomic<size_t> _turn = {0};
+};
+
+struct ElasticPolicy {
+    size_t min_workers = 1;
+    size_t max_workers = 8;
+    //Grows when the queue holds more callbacks per worker than max_depth, or when the oldest one waited longer than max_latency.
+    size_t max_depth = 64;
+    std::chrono::microseconds max_latency = std::chrono::milliseconds(10);
+    //A worker idle for that long is retired, one per cooldown at most.
+    std::chrono::milliseconds idle_cooldown = std::chrono::seconds(30);
+    std::chrono::milliseconds check_interval = std::chrono::milliseconds(5);
+};
+
+/**
+ * Workers sharing one queue, as many as the load needs: the group's
+ * own thread checks every check_interval the depth of the queue and
+ * how long its oldest callback has waited, and starts workers (enou
+ * gh for the depth, at once) or retires one idle for a cooldown. Ea
+ * ch resize is reported to ThreadTracker. Any ftor can target it, t
+ * he calls are run in no particular order.
+ **/
+class ElasticGroup : public AbstractThread
+{
+public:
+    explicit ElasticGroup(std::string sn = "Undefined", ElasticPolicy policy = {});
+    ~ElasticGroup() override;
+
+    using AbstractThread::add_callback;
+    void add_callback(AbstractExecutor *to_execute) override;
+
+    bool in_thread() override;
+    void start() override;
+    void stop() override;
+    void process() override {};
+
+    size_t workers();
+
+protected:
+    void looping() override;
+
+private:
+    struct Worker {
+        std::thread thread;
+        bool retire = false;
+        bool idle = false;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+    struct Queued {
+        AbstractExecutor *cb;
+        std::chrono::steady_clock::time_point at;
+    };
+
+    void work(Worker *w);
+    void spawn_locked(size_t to);
+    void report(size_t from, size_t to, std::string reason);
+
+    const ElasticPolicy _policy;
+    //All under mtx.
+    std::deque<Queued> _queue;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::chrono::steady_clock::time_point _last_retire;
+    TrackedCondition _ready;
+    TrackedCondition _tick;
 };
 
 class SingleLooping : public AbstractThread
@@ -146,6 +367,13 @@ private:
     AbstractExecutor *func;
 };
 
+}
+
+//The signals need a complete AbstractThread, so they come once the classes are declared.
+#include "signals_slots.h"
+
+namespace CppUtilities {
+
 //Here are the template functions defs
 template <class C> inline
 void AbstractThread::add_callback(GenericFunctor<C> *f)
@@ -153,11 +381,24 @@ void AbstractThread::add_callback(GenericFunctor<C> *f)
     add_callback(new GenericExecutor<C>(f));
 }
 
+template <class C> inline
+CallbackToken AbstractThread::add_cancellable_callback(GenericFunctor<C> *f)
+{
+    return add_cancellable_callback(new GenericExecutor<C>(f));
+}
+
 template <class C> inline
 void ThreadLooping::add_routine(GenericFunctor<C> *f)
 {
     add_routine(new GenericExecutor<C>(f));
 }
+template <class Ch, class F> inline
+void ThreadLooping::add_source(Ch *channel, F &&handler, size_t batch)
+{
+    channel->set_handler(std::forward<F>(handler));
+    add_source(static_cast<AbstractChannel *>(channel), batch);
+}
+
 template<class C> inline
 SingleLooping::SingleLooping(std::string sn, GenericFunctor<C> *executor, bool del) : AbstractThread(sn)
 {
@@ -0,0 +1,64 @@
+//Time of an emit to 4 direct slots, StaticSignal against SignalMulti: bench_static_signal [emits]
+//g++ -std=c++17 -O2 tools/bench_static_signal.cpp -lcpputilities -lpthread -o bench_static_signal
+//Each slot call would be printed otherwise.
+#define NO_SSCALL_OUTPUTS
+#include "../cpputilities.h"
+
+#include <iostream>
+#include <chrono>
+#include <string>
+
+using namespace CppUtilities;
+
+static volatile int sink = 0;
+
+static void slot_a(int v) {sink = sink + v;}
+static void slot_b(int v) {sink = sink ^ v;}
+static void slot_c(int v) {sink = sink - v;}
+static void slot_d(int v) {sink = sink | v;}
+
+static GenericFunctor<void, int> static_ftor("static ftor", slot_d);
+
+template<class F>
+static double ns_per_emit(size_t emits, F &&emit)
+{
+    //Once before, so the first calls' misses are not counted.
+    for (size_t i = 0; i < emits / 10; i++) {
+        emit(int(i));
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < emits; i++) {
+        emit(int(i));
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / double(emits);
+}
+
+int main(int argc, char **argv)
+{
+    size_t emits = argc > 1 ? std::stoul(argv[1]) : 2000000;
+
+    SignalMulti<void, int> functions("functions");
+    functions.connect(new GenericFunctor<void, int>(slot_a));
+    functions.connect(new GenericFunctor<void, int>(slot_b));
+    functions.connect(new GenericFunctor<void, int>(slot_c));
+    functions.connect(new GenericFunctor<void, int>(slot_d));
+
+    SignalMulti<void, int> delegates("delegates");
+    delegates.connect(new GenericFunctor<void, int>(Delegate<void, int>::bind<slot_a>()));
+    delegates.connect(new GenericFunctor<void, int>(Delegate<void, int>::bind<slot_b>()));
+    delegates.connect(new GenericFunctor<void, int>(Delegate<void, int>::bind<slot_c>()));
+    delegates.connect(new GenericFunctor<void, int>(Delegate<void, int>::bind<slot_d>()));
+
+    double static_ns = ns_per_emit(emits, [](int v) {StaticSignal<slot_a, slot_b, slot_c, slot_d>::emit(v);});
+    double static_ftor_ns = ns_per_emit(emits, [](int v) {StaticSignal<slot_a, slot_b, slot_c, &static_ftor>::emit(v);});
+    double functions_ns = ns_per_emit(emits, [&functions](int v) {functions.emit(v);});
+    double delegates_ns = ns_per_emit(emits, [&delegates](int v) {delegates.emit(v);});
+
+    std::cout << emits << " emits to 4 direct slots, ns per emit:\n"
+              << "    StaticSignal, function pointers:     " << static_ns << "\n"
+              << "    StaticSignal, with a static ftor:    " << static_ftor_ns << "\n"
+              << "    SignalMulti, std::function ftors:    " << functions_ns << "\n"
+              << "    SignalMulti, Delegate ftors:         " << delegates_ns << std::endl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+//Time to symbolize a stack, the Symbolizer against running addr2line for each frame as before: bench_symbolizer [depth]
+//g++ -std=c++17 -O2 -g tools/bench_symbolizer.cpp -lcpputilities -lpthread -o bench_symbolizer
+#include "../cpputilities.h"
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+using namespace CppUtilities;
+using namespace std::chrono;
+
+//How the frames were symbolized before: one addr2line process per frame.
+static std::string addr2line(const SymbolInfo &info)
+{
+    char offset[32];
+    snprintf(offset, sizeof(offset), "%#lx", (unsigned long)info.module_offset);
+    std::string command = "addr2line -C -f -e " + info.module + " " + offset;
+    std::string output;
+    FILE *fp = popen(command.c_str(), "r");
+    if (fp == NULL) {
+        return output;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line) - 1, fp) != NULL) {
+        output.append(line);
+    }
+    pclose(fp);
+    return output;
+}
+
+static double us_since(steady_clock::time_point start)
+{
+    return double(duration_cast<nanoseconds>(steady_clock::now() - start).count()) / 1000.0;
+}
+
+//Not inlined, so each level is a frame of its own.
+__attribute__((noinline)) static StackTrace deep(int depth)
+{
+    if (depth <= 1) {
+        return StackTrace::capture();
+    }
+    StackTrace trace = deep(depth - 1);
+    __asm__ volatile("" ::: "memory");
+    return trace;
+}
+
+int main(int argc, char **argv)
+{
+    int depth = argc > 1 ? std::stoi(argv[1]) : 16;
+    StackTrace trace = deep(depth);
+    //Return addresses: minus one for the line of the call.
+    std::vector<const void *> pcs;
+    for (int i = 0; i < trace.size; i++) {
+        pcs.push_back(static_cast<const char *>(trace.frames[i]) - 1);
+    }
+
+    //The first resolve maps the modules and decodes their line tables.
+    SymbolInfo info;
+    steady_clock::time_point start = steady_clock::now();
+    Symbolizer::get()->resolve(pcs[0], info);
+    double first_us = us_since(start);
+
+    const int rounds = 1000;
+    start = steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (const void *pc : pcs) {
+            SymbolInfo i;
+            Symbolizer::get()->resolve(pc, i);
+        }
+    }
+    double resolve_us = us_since(start) / rounds;
+
+    for (const void *pc : pcs) {
+        Symbolizer::get()->lookup(pc);
+    }
+    start = steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (const void *pc : pcs) {
+            Symbolizer::get()->lookup(pc);
+        }
+    }
+    double lookup_us = us_since(start) / rounds;
+
+    std::vector<SymbolInfo> infos(pcs.size());
+    for (size_t i = 0; i < pcs.size(); i++) {
+        Symbolizer::get()->resolve(pcs[i], infos[i]);
+    }
+    start = steady_clock::now();
+    size_t resolved = 0;
+    for (const SymbolInfo &i : infos) {
+        resolved += addr2line(i).compare(0, 2, "??") != 0;
+    }
+    double addr2line_us = us_since(start);
+
+    std::cout << pcs.size() << " frames, us per stack:\n"
+              << "    Symbolizer, first resolve (loading):  " << first_us << "\n"
+              << "    Symbolizer::resolve():                " << resolve_us << "\n"
+              << "    Symbolizer::lookup(), cached:         " << lookup_us << "\n"
+              << "    addr2line per frame:                  " << addr2line_us << " (" << resolved << " resolved)" << std::endl;
+    return 0;
+}
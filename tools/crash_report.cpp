@@ -0,0 +1,20 @@
+//Prints a crash report written by the crash handler, symbolized: crash_report <file.crash> [max frames per thread]
+#include "../crash_report.h"
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <binary name>.<pid>.crash [max frames per thread]" << std::endl;
+        return 2;
+    }
+    CppUtilities::CrashReport report;
+    if (!report.load(argv[1])) {
+        std::cerr << report.error() << std::endl;
+        return 1;
+    }
+    std::cout << report.to_string(argc > 2 ? std::stoul(argv[2]) : 64);
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include "tracer.h"
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace CppUtilities {
+
+thread_local uint32_t TraceSpan::current = 0;
+
+//The events array is allocated at the first record, so naming a thread that is never traced costs nothing.
+struct Tracer::Buffer {
+    std::atomic<Event *> events = {nullptr};
+    size_t capacity = 0;
+    std::atomic<uint64_t> count = {0}; //Events ever recorded: the next one goes at count % capacity.
+    std::atomic<bool> used = {false};
+    Buffer *next = nullptr;
+    pid_t tid = 0;
+    int id = -1;
+    char name[32] = {0};
+    uint64_t flows = 0;
+    uint64_t ended = 0; //Order its thread ended in, to take back the oldest first.
+};
+
+static std::mutex buffers_mtx;
+static std::atomic<Tracer::Buffer *> buffer_list = {nullptr};
+static Tracer::Buffer *const THREAD_ENDED = reinterpret_cast<Tracer::Buffer *>(1);
+static thread_local Tracer::Buffer *tls_buffer __attribute__((tls_model("initial-exec"))) = nullptr;
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+static std::atomic<size_t> buffer_capacity = {64 * 1024};
+static size_t ended_kept = 16;
+static std::atomic<uint64_t> ended_count = {0};
+static size_t recycled_lost = 0;
+static uint64_t base_ticks = 0;
+static uint64_t base_ns = 0;
+
+static std::mutex labels_mtx;
+static std::vector<std::string> labels = {""};
+static std::unordered_map<std::string, uint32_t> label_ids;
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+Tracer *Tracer::get()
+{
+    static Tracer *inst = new Tracer;
+    return inst;
+}
+
+//pthread key destructor: the buffer is kept for its events, and taken again once they are cleared, or when too
+//many ended threads keep theirs.
+static void thread_ended(void *p)
+{
+    tls_buffer = THREAD_ENDED;
+    Tracer::Buffer *b = static_cast<Tracer::Buffer *>(p);
+    b->ended = ++ended_count;
+    b->used.store(false, std::memory_order_release);
+}
+
+static Tracer::Buffer *claim()
+{
+    buffers_mtx.lock();
+    Tracer::Buffer *b = buffer_list.load();
+    Tracer::Buffer *oldest = nullptr;
+    size_t kept = 0;
+    for (; b; b = b->next) {
+        if (b->used.load(std::memory_order_acquire)) {
+            continue;
+        } else if (!b->count.load(std::memory_order_relaxed)) {
+            break;
+        }
+        kept++;
+        oldest = !oldest || b->ended < oldest->ended ? b : oldest;
+    }
+    //Threads coming and going (an ElasticGroup) would each leave a full buffer behind: past the cap, the
+    //events of the thread that ended first are dropped for the new one.
+    if (!b && kept >= ended_kept) {
+        b = oldest;
+        uint64_t count = b->count.load(std::memory_order_relaxed);
+        recycled_lost += size_t(count < b->capacity ? count : b->capacity);
+        b->count.store(0, std::memory_order_relaxed);
+        if (b->capacity != buffer_capacity.load()) {
+            free(b->events.load(std::memory_order_relaxed));
+            b->events.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    if (b) {
+        b->id = -1;
+        b->name[0] = 0;
+    } else {
+        b = new Tracer::Buffer;
+        b->next = buffer_list.load();
+        buffer_list.store(b, std::memory_order_release);
+    }
+    b->used.store(true, std::memory_order_relaxed);
+    b->tid = pid_t(syscall(SYS_gettid));
+    buffers_mtx.unlock();
+
+    pthread_once(&buffer_key_once, []() {pthread_key_create(&buffer_key, thread_ended);});
+    pthread_setspecific(buffer_key, b);
+    tls_buffer = b;
+    return b;
+}
+
+void Tracer::start(size_t events_per_thread, size_t ended_threads)
+{
+    buffers_mtx.lock();
+    buffer_capacity = events_per_thread ? events_per_thread : 1;
+    ended_kept = ended_threads;
+    if (!base_ticks) {
+        base_ns = monotonic_ns();
+        base_ticks = FlightRecorder::now();
+    }
+    buffers_mtx.unlock();
+    _running = true;
+}
+
+void Tracer::stop()
+{
+    _running = false;
+}
+
+void Tracer::set_thread(const std::string &name, int id)
+{
+    Buffer *b = tls_buffer;
+    if (b == THREAD_ENDED) {
+        return;
+    } else if (!b) {
+        b = claim();
+    }
+    b->id = id;
+    strncpy(b->name, name.c_str(), sizeof(b->name) - 1);
+}
+
+void Tracer::record(TraceKind kind, uint32_t label, uint64_t begin, uint64_t value)
+{
+    Buffer *b = tls_buffer;
+    if (__builtin_expect(b == nullptr, 0)) {
+        b = claim();
+    } else if (b == THREAD_ENDED) {
+        return;
+    }
+    Event *events = b->events.load(std::memory_order_relaxed);
+    if (__builtin_expect(events == nullptr, 0)) {
+        b->capacity = buffer_capacity.load();
+        events = static_cast<Event *>(calloc(b->capacity, sizeof(Event)));
+        if (!events) {
+            return;
+        }
+        b->events.store(events, std::memory_order_release);
+    }
+    uint64_t n = b->count.load(std::memory_order_relaxed);
+    events[n % b->capacity] = {begin, value, kind, label};
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+uint64_t Tracer::flow_out()
+{
+    Buffer *b = tls_buffer;
+    if (!b) {
+        b = claim();
+    } else if (b == THREAD_ENDED) {
+        return 0;
+    }
+    //Unique without a shared counter: the thread's id, then its own count.
+    uint64_t id = uint64_t(uint32_t(b->tid)) << 32 | ++b->flows;
+    record(TraceKind::FlowOut, 0, FlightRecorder::now(), id);
+    return id;
+}
+
+uint32_t Tracer::intern(const std::string &name)
+{
+    labels_mtx.lock();
+    auto it = label_ids.find(name);
+    uint32_t id;
+    if (it != label_ids.end()) {
+        id = it->second;
+    } else {
+        id = uint32_t(labels.size());
+        labels.push_back(name);
+        label_ids[name] = id;
+    }
+    labels_mtx.unlock();
+    return id;
+}
+
+std::string Tracer::label(uint32_t id)
+{
+    labels_mtx.lock();
+    std::string name = id < labels.size() ? labels[id] : "";
+    labels_mtx.unlock();
+    return name;
+}
+
+void Tracer::clear()
+{
+    buffers_mtx.lock();
+    for (Buffer *b = buffer_list.load(); b; b = b->next) {
+        b->count.store(0, std::memory_order_release);
+    }
+    recycled_lost = 0;
+    buffers_mtx.unlock();
+}
+
+size_t Tracer::overwritten()
+{
+    buffers_mtx.lock();
+    size_t lost = recycled_lost;
+    for (Buffer *b = buffer_list.load(); b; b = b->next) {
+        uint64_t count = b->count.load(std::memory_order_acquire);
+        lost += count > b->capacity && b->events.load() ? size_t(count - b->capacity) : 0;
+    }
+    buffers_mtx.unlock();
+    return lost;
+}
+
+static const char *kind_name(TraceKind kind)
+{
+    switch (kind) {
+        case TraceKind::Emit: return "emit";
+        case TraceKind::Slot: return "slot";
+        case TraceKind::Callback: return "callback";
+        case TraceKind::Routines: return "routines";
+        case TraceKind::FlowOut:
+        case TraceKind::FlowIn: return "queued";
+    }
+    return "";
+}
+
+static void json_string(std::ostream &out, const std::string &s)
+{
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+std::string Tracer::chrome_json()
+{
+    std::vector<std::string> names;
+    labels_mtx.lock();
+    names = labels;
+    labels_mtx.unlock();
+    uint64_t ticks = FlightRecorder::now(), ns = monotonic_ns();
+    double us_per_tick = ticks > base_ticks && ns > base_ns ? double(ns - base_ns) / double(ticks - base_ticks) / 1000 : 0.001;
+    int pid = int(getpid());
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    buffers_mtx.lock();
+    for (Buffer *b = buffer_list.load(); b; b = b->next) {
+        Event *events = b->events.load(std::memory_order_acquire);
+        uint64_t count = b->count.load(std::memory_order_acquire);
+        if (!events || !count) {
+            continue;
+        }
+        out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << b->tid << ",\"args\":{\"name\":";
+        json_string(out, b->name[0] ? std::string(b->name) + " [" + std::to_string(b->id) + "]" : "thread " + std::to_string(b->tid));
+        out << "}}";
+        first = false;
+        for (uint64_t i = count > b->capacity ? count - b->capacity : 0; i < count; i++) {
+            const Event &e = events[i % b->capacity];
+            double ts = e.begin > base_ticks ? double(e.begin - base_ticks) * us_per_tick : 0;
+            out << ",\n{\"pid\":" << pid << ",\"tid\":" << b->tid << ",\"ts\":" << ts << ",\"cat\":\"" << kind_name(e.kind) << "\",\"name\":";
+            json_string(out, e.label && e.label < names.size() ? names[e.label] : kind_name(e.kind));
+            if (e.kind == TraceKind::FlowOut || e.kind == TraceKind::FlowIn) {
+                //The arrow binds to the spans around its ends: the slot queueing, the callback running. The id is a
+                //string, as it does not fit the 53 bits a JSON number keeps.
+                out << ",\"ph\":\"" << (e.kind == TraceKind::FlowOut ? "s" : "f\",\"bp\":\"e") << "\",\"id\":\"" << e.value << "\"}";
+            } else {
+                out << ",\"ph\":\"X\",\"dur\":" << (e.value > e.begin ? double(e.value - e.begin) * us_per_tick : 0) << "}";
+            }
+        }
+    }
+    buffers_mtx.unlock();
+    out << "\n]}\n";
+    return out.str();
+}
+
+bool Tracer::write_chrome_json(const std::string &path)
+{
+    std::ofstream file(path);
+    file << chrome_json();
+    return bool(file);
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "cpputilities_global.h"
+#include "flight_recorder.h"
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include <sys/types.h>
+
+namespace CppUtilities {
+
+enum class TraceKind : uint32_t {
+    Emit,       //Span of a signal's emit.
+    Slot,       //Span of a slot called by an emit, direct or queueing.
+    Callback,   //Span of a callback or executor run by a thread, named after the emit that queued it.
+    Routines,   //Span of a pass over a ThreadLooping's routines.
+    FlowOut,    //A callback queued for another thread...
+    FlowIn      //...starting there.
+};
+
+/**
+ * Timeline of the threads, for chrome://tracing or ui.perfetto.dev:
+ * between start() and stop(), the emits, slot calls, callbacks and
+ * routine passes are recorded as spans into a buffer of the thread'
+ * s own (no lock), and a callback queued for another thread links i
+ * ts queueing to its run with a flow arrow. chrome_json() exports i
+ * t all as Chrome trace-event JSON. Off, a span costs a flag check.
+ **/
+class Tracer
+{
+public:
+    static Tracer *get();
+
+    //events_per_thread is the size of the buffers of the threads not yet seen: each keeps its last ones. The
+    //events of at most ended_threads threads that ended are kept, the oldest ones giving their buffer to new threads.
+    void start(size_t events_per_thread = 64 * 1024, size_t ended_threads = 16);
+    void stop();
+    inline static bool running() {return _running.load(std::memory_order_relaxed);};
+
+    //Names the calling thread's timeline (the threads of the library do it when they start).
+    static void set_thread(const std::string &name, int id = -1);
+
+    //The events in trace-event JSON, threads named. To take after stop(): a thread writing meanwhile can tear
+    //its oldest event.
+    std::string chrome_json();
+    bool write_chrome_json(const std::string &path);
+    //Forgets the events.
+    void clear();
+    //Events overwritten in full buffers, or dropped with an ended thread's buffer, since the last clear().
+    size_t overwritten();
+
+    //Labels are interned once, 0 is none (the span is named after its kind).
+    static uint32_t intern(const std::string &name);
+    static std::string label(uint32_t id);
+
+    static void record(TraceKind kind, uint32_t label, uint64_t begin, uint64_t value);
+    //A new flow id, recorded as leaving the calling thread now.
+    static uint64_t flow_out();
+    static inline void flow_in(uint64_t id) {
+        if (id && running()) {
+            record(TraceKind::FlowIn, 0, FlightRecorder::now(), id);
+        }
+    };
+
+    struct Event {
+        uint64_t begin;     //Ticks of FlightRecorder::now().
+        uint64_t value;     //End ticks for a span, the id for a flow.
+        TraceKind kind;
+        uint32_t label;
+    };
+    struct Buffer;
+
+private:
+    Tracer() {};
+
+    inline static std::atomic<bool> _running = {false};
+};
+
+//A span from its construction to its destruction, when the tracer runs. The label is the current one until then:
+//a callback queued meanwhile is named after it.
+class TraceSpan
+{
+public:
+    inline TraceSpan(TraceKind kind, uint32_t label) {
+        if (Tracer::running()) {
+            open(kind, label);
+        }
+    };
+    //Labelled by the name, interned once into cache.
+    template<class F> inline TraceSpan(TraceKind kind, std::atomic<uint32_t> &cache, F &&name) {
+        if (Tracer::running()) {
+            uint32_t id = cache.load(std::memory_order_relaxed);
+            if (!id) {
+                id = Tracer::intern(name());
+                cache.store(id, std::memory_order_relaxed);
+            }
+            open(kind, id);
+        }
+    };
+    inline ~TraceSpan() {
+        if (_begin) {
+            current = _previous;
+            Tracer::record(_kind, _label, _begin, FlightRecorder::now());
+        }
+    };
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    static thread_local uint32_t current;
+
+private:
+    inline void open(TraceKind kind, uint32_t label) {
+        _kind = kind;
+        _label = label;
+        _previous = current;
+        current = label ? label : current;
+        _begin = FlightRecorder::now();
+    };
+
+    uint64_t _begin = 0;
+    TraceKind _kind = TraceKind::Emit;
+    uint32_t _label = 0;
+    uint32_t _previous = 0;
+};
+
+}